@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+
+#include "AccelHistory.h"
+
+/*****************************************************************************/
+
+AccelHistory AccelHistory::sAccel;
+
+AccelHistory::AccelHistory()
+    : mWritten(0)
+{
+    for (int i = 0; i < size; i++) {
+        mSlots[i].seq.store(0, std::memory_order_relaxed);
+        mSlots[i].index.store(0, std::memory_order_relaxed);
+    }
+}
+
+void AccelHistory::push(int64_t timestamp, const float v[3])
+{
+    uint64_t n = mWritten.load(std::memory_order_relaxed);
+    Slot& slot = mSlots[n & (size - 1)];
+    uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.index.store(n, std::memory_order_relaxed);
+    slot.timestamp.store(timestamp, std::memory_order_relaxed);
+    for (int i = 0; i < 3; i++)
+        slot.v[i].store(v[i], std::memory_order_relaxed);
+    slot.seq.store(seq + 2, std::memory_order_release);
+
+    mWritten.store(n + 1, std::memory_order_release);
+}
+
+/* false when the slot no longer (or not yet) holds sample number index */
+bool AccelHistory::read(uint64_t index, struct sensors_accel_sample* sample) const
+{
+    const Slot& slot = mSlots[index & (size - 1)];
+
+    /* only the oldest slot is ever being rewritten, so don't wait for it long */
+    for (int tries = 0; tries < 2; tries++) {
+        uint32_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq & 1)
+            continue;
+        uint64_t stored = slot.index.load(std::memory_order_relaxed);
+        sample->timestamp = slot.timestamp.load(std::memory_order_relaxed);
+        sample->x = slot.v[0].load(std::memory_order_relaxed);
+        sample->y = slot.v[1].load(std::memory_order_relaxed);
+        sample->z = slot.v[2].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == seq)
+            return stored == index;
+    }
+    return false;
+}
+
+/*
+ * The samples a and b with a.timestamp <= t < b.timestamp, given that
+ * oldest is at or before t and newest after it.
+ */
+int AccelHistory::find(int64_t t, uint64_t oldest, uint64_t newest,
+        struct sensors_accel_sample* a, struct sensors_accel_sample* b) const
+{
+    int64_t span = b->timestamp - a->timestamp;
+    uint64_t lo = oldest, hi = newest;
+
+    /* start next to where an evenly spaced stream puts t */
+    uint64_t i = newest - (uint64_t)((b->timestamp - t) * (int64_t)(newest - oldest) / span);
+    if (i >= newest)
+        i = newest - 1;
+    if (i < oldest)
+        i = oldest;
+
+    for (int walk = 0; walk < maxWalk && hi - lo > 1; walk++) {
+        struct sensors_accel_sample s;
+        if (!read(i, &s))
+            return -ERANGE;
+        if (s.timestamp <= t) {
+            lo = i;
+            *a = s;
+            i++;
+        } else {
+            hi = i;
+            *b = s;
+            i--;
+        }
+    }
+
+    /* the stream wasn't even (a gap or a rate change): bisect what is left */
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        struct sensors_accel_sample s;
+        if (!read(mid, &s))
+            return -ERANGE;
+        if (s.timestamp <= t) {
+            lo = mid;
+            *a = s;
+        } else {
+            hi = mid;
+            *b = s;
+        }
+    }
+    return 0;
+}
+
+int AccelHistory::at(int64_t t, struct sensors_accel_sample* sample) const
+{
+    uint64_t written = mWritten.load(std::memory_order_acquire);
+    if (!written)
+        return -EAGAIN;
+
+    struct sensors_accel_sample a, b;
+    uint64_t newest = written - 1;
+    if (!read(newest, &b) || t > b.timestamp)
+        return -EAGAIN;
+    if (t == b.timestamp) {
+        *sample = b;
+        return 0;
+    }
+
+    /* the writer may be reusing the oldest slot right now */
+    uint64_t oldest = written > (uint64_t)size ? written - size : 0;
+    if (!read(oldest, &a) && (oldest == newest || !read(++oldest, &a)))
+        return -ERANGE;
+    if (t < a.timestamp)
+        return -ERANGE;
+
+    int err = find(t, oldest, newest, &a, &b);
+    if (err)
+        return err;
+
+    float f = b.timestamp > a.timestamp ?
+            (float)(t - a.timestamp) / (float)(b.timestamp - a.timestamp) : 0.0f;
+    sample->timestamp = t;
+    sample->x = a.x + (b.x - a.x) * f;
+    sample->y = a.y + (b.y - a.y) * f;
+    sample->z = a.z + (b.z - a.z) * f;
+    return 0;
+}
+
+int AccelHistory::latest(struct sensors_accel_sample* sample) const
+{
+    uint64_t written = mWritten.load(std::memory_order_acquire);
+    if (!written || !read(written - 1, sample))
+        return -EAGAIN;
+    return 0;
+}
+
+/*****************************************************************************/
+
+int sensors_accel_history_at(int64_t boottime_ns, struct sensors_accel_sample* sample)
+{
+    return AccelHistory::sAccel.at(boottime_ns, sample);
+}
+
+int sensors_accel_history_latest(struct sensors_accel_sample* sample)
+{
+    return AccelHistory::sAccel.latest(sample);
+}
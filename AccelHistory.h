@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_ACCEL_HISTORY_H
+#define ANDROID_ACCEL_HISTORY_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+#include <atomic>
+#endif
+
+/*****************************************************************************/
+
+/* one accelerometer reading; timestamp is CLOCK_BOOTTIME like sensor events */
+struct sensors_accel_sample {
+    int64_t timestamp;
+    float x;
+    float y;
+    float z;
+};
+
+#ifdef __cplusplus
+
+/*
+ * The last samples decoded by the accelerometer driver, for readers that
+ * want the value at a given time instead of a stream. One writer (the
+ * poll thread) and any number of readers on any thread; each slot is a
+ * seqlock, so neither side ever blocks the other. Samples are evenly
+ * spaced, so a lookup jumps close to the right slot from the average
+ * period and only walks a few slots from there.
+ */
+class AccelHistory {
+public:
+    static const int size = 512;    // power of 2
+
+            AccelHistory();
+
+    void push(int64_t timestamp, const float v[3]);
+
+    /* 0, -EAGAIN when t is newer than the last sample, -ERANGE when it is gone */
+    int at(int64_t t, struct sensors_accel_sample* sample) const;
+    /* 0, -EAGAIN before the first sample */
+    int latest(struct sensors_accel_sample* sample) const;
+
+    /* the history of the accelerometer in this process */
+    static AccelHistory sAccel;
+
+private:
+    static const int maxWalk = 8;
+
+    struct Slot {
+        std::atomic<uint32_t> seq;
+        std::atomic<uint64_t> index;
+        std::atomic<int64_t> timestamp;
+        std::atomic<float> v[3];
+    };
+
+    bool read(uint64_t index, struct sensors_accel_sample* sample) const;
+    int find(int64_t t, uint64_t oldest, uint64_t newest,
+            struct sensors_accel_sample* a, struct sensors_accel_sample* b) const;
+
+    Slot mSlots[size];
+    std::atomic<uint64_t> mWritten;
+};
+
+#endif
+
+/*****************************************************************************/
+
+__BEGIN_DECLS
+
+/*
+ * Acceleration at a CLOCK_BOOTTIME timestamp, interpolated between the two
+ * samples around it; safe from any thread and doesn't wait for the poll
+ * loop. Returns 0, -EAGAIN when no sample that recent has arrived yet, or
+ * -ERANGE when t is older than the history.
+ */
+int sensors_accel_history_at(int64_t boottime_ns, struct sensors_accel_sample* sample);
+
+/* the most recent sample; 0, or -EAGAIN when the accelerometer hasn't run */
+int sensors_accel_history_latest(struct sensors_accel_sample* sample);
+
+__END_DECLS
+
+#endif  // ANDROID_ACCEL_HISTORY_H
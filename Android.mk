@@ -1,5 +1,29 @@
 LOCAL_PATH := $(call my-dir)
 
+sensors_hal_src_files := \
+	sensors.c \
+	nusensors.cpp \
+	InputEventReader.cpp \
+	SensorBase.cpp \
+	Kxtj3Sensor.cpp \
+	SensorTrace.cpp \
+	SensorsHal2.cpp \
+	TimestampFilter.cpp \
+	IioAccelSensor.cpp \
+	Kxtj3PolledSensor.cpp \
+	SensorPipeline.cpp \
+	BoardConfig.cpp \
+	SensorWatchdog.cpp \
+	MultiHalSensor.cpp \
+	CompactFifo.cpp \
+	UringEngine.cpp \
+	BusyPoll.cpp \
+	WakeLock.cpp \
+	AccelHistory.cpp \
+	SensorClock.cpp \
+	SpillFifo.cpp \
+	Kxtj3I2cSensor.cpp \
+
 # HAL module implemenation, not prelinked, and stored in
 # hw/<SENSORS_HARDWARE_MODULE_ID>.<ro.product.board>.so
 include $(CLEAR_VARS)
@@ -11,6 +35,7 @@ LOCAL_CFLAGS += \
 	-Wformat
 
 LOCAL_CPPFLAGS += \
+	-std=gnu++17 \
 	-Wno-unused-parameter \
 	-Wformat
 
@@ -26,16 +51,130 @@ LOCAL_MODULE_TAGS := optional
 LOCAL_CFLAGS += -DLOG_TAG=\"SensorsHal\" \
 	-DPLATFORM_SDK_VERSION=$(PLATFORM_SDK_VERSION)
 
-LOCAL_SRC_FILES := \
-	sensors.c \
-	nusensors.cpp \
-	InputEventReader.cpp \
-	SensorBase.cpp \
-	Kxtj3Sensor.cpp \
-				
+LOCAL_SRC_FILES := $(sensors_hal_src_files)
+
+LOCAL_SHARED_LIBRARIES := \
+	liblog \
+	libcutils \
+	libutils \
+	libdl
+
+include $(BUILD_SHARED_LIBRARY)
+
+# The same module for the host, to run against gsensor_sim and libgsensor_shim.
+# liblog, libcutils and libutils have host variants: logs go to stderr,
+# properties read as their defaults and ashmem is backed by a temporary file.
+include $(CLEAR_VARS)
+
+LOCAL_CFLAGS += \
+	-Wno-unused-parameter \
+	-Wformat
+
+LOCAL_CPPFLAGS += \
+	-std=gnu++17 \
+	-Wno-unused-parameter \
+	-Wformat
+
+LOCAL_MODULE := sensors.amlogic
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_HEADER_LIBRARIES += \
+    libhardware_headers
+
+LOCAL_CFLAGS += -DLOG_TAG=\"SensorsHal\" \
+	-DPLATFORM_SDK_VERSION=$(PLATFORM_SDK_VERSION)
+
+LOCAL_SRC_FILES := $(sensors_hal_src_files)
+
 LOCAL_SHARED_LIBRARIES := \
 	liblog \
 	libcutils \
 	libutils
 
+LOCAL_LDLIBS := -ldl -lpthread
+
+include $(BUILD_HOST_SHARED_LIBRARY)
+
+# Device simulator for HAL testing without a board: tools/gsensor_sim.c
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gsensor_sim
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS += -Wno-unused-parameter
+LOCAL_SRC_FILES := tools/gsensor_sim.c
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gsensor_sim
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS += -Wno-unused-parameter
+LOCAL_SRC_FILES := tools/gsensor_sim.c
+LOCAL_LDLIBS := -lm
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# LD_PRELOAD stand-in for /dev/gsensor that talks to gsensor_sim
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libgsensor_shim
+LOCAL_MODULE_TAGS := optional
+LOCAL_MULTILIB := both
+LOCAL_CFLAGS += -Wno-unused-parameter
+LOCAL_SRC_FILES := tools/gsensor_shim.c
+LOCAL_SHARED_LIBRARIES := libdl
+
 include $(BUILD_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libgsensor_shim
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS += -Wno-unused-parameter
+LOCAL_SRC_FILES := tools/gsensor_shim.c
+LOCAL_LDLIBS := -ldl -lpthread
+
+include $(BUILD_HOST_SHARED_LIBRARY)
+
+# Streaming and latency client that loads the HAL module: tools/sensor_stream.c
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := sensor_stream
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS += -Wno-unused-parameter
+LOCAL_SRC_FILES := tools/sensor_stream.c
+LOCAL_HEADER_LIBRARIES := libhardware_headers
+LOCAL_SHARED_LIBRARIES := libdl
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := sensor_stream
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS += -Wno-unused-parameter
+LOCAL_SRC_FILES := tools/sensor_stream.c
+LOCAL_HEADER_LIBRARIES := libhardware_headers
+LOCAL_LDLIBS := -ldl -lm
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Offline rate, jitter and latency checks of sensor_stream captures: tools/sensor_conform.c
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := sensor_conform
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS += -O3
+LOCAL_SRC_FILES := tools/sensor_conform.c
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := sensor_conform
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS += -O3
+LOCAL_SRC_FILES := tools/sensor_conform.c
+
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AXIS_TRANSFORM_H
+#define ANDROID_AXIS_TRANSFORM_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/*****************************************************************************/
+
+/*
+ * Raw chip counts to device-frame SI units: out = R * (raw - offset) * scale,
+ * folded into one matrix and one bias when set() is called. A mounting
+ * matrix that only swaps axes and flips signs (the usual case) is applied
+ * as a gather plus one multiply-add per axis.
+ */
+class AxisTransform {
+public:
+    AxisTransform() {
+        static const float identity[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+        static const int zero[3] = { 0, 0, 0 };
+        set(identity, zero, 1.0f);
+    }
+
+    void set(const float rotation[9], const int offset[3], float scale) {
+        bool used[3] = { false, false, false };
+        mPermutation = true;
+        for (int i = 0; i < 3; i++) {
+            mBias[i] = 0;
+            mAxis[i] = 0;
+            mGain[i] = 0;
+            int nonzero = 0;
+            for (int j = 0; j < 3; j++) {
+                float k = rotation[i * 3 + j] * scale;
+                mMatrix[i][j] = k;
+                mBias[i] -= k * offset[j];
+                if (rotation[i * 3 + j] != 0) {
+                    nonzero++;
+                    mAxis[i] = j;
+                    mGain[i] = k;
+                }
+            }
+            if (nonzero != 1 || used[mAxis[i]] ||
+                    (rotation[i * 3 + mAxis[i]] != 1 && rotation[i * 3 + mAxis[i]] != -1))
+                mPermutation = false;
+            else
+                used[mAxis[i]] = true;
+        }
+        invertMatrix();
+    }
+
+    bool isPermutation() const { return mPermutation; }
+
+    void apply(const int raw[3], float out[3]) const {
+        if (mPermutation) {
+            out[0] = raw[mAxis[0]] * mGain[0] + mBias[0];
+            out[1] = raw[mAxis[1]] * mGain[1] + mBias[1];
+            out[2] = raw[mAxis[2]] * mGain[2] + mBias[2];
+        } else {
+            float x = raw[0], y = raw[1], z = raw[2];
+            out[0] = mMatrix[0][0] * x + mMatrix[0][1] * y + mMatrix[0][2] * z + mBias[0];
+            out[1] = mMatrix[1][0] * x + mMatrix[1][1] * y + mMatrix[1][2] * z + mBias[1];
+            out[2] = mMatrix[2][0] * x + mMatrix[2][1] * y + mMatrix[2][2] * z + mBias[2];
+        }
+    }
+
+    /*
+     * Device-frame SI units back to chip counts, rounded and saturated at
+     * 16 bits like the chip's own output. Used for injected samples.
+     */
+    void invert(const float in[3], int raw[3]) const {
+        float v[3];
+        if (mPermutation) {
+            for (int i = 0; i < 3; i++)
+                v[mAxis[i]] = (in[i] - mBias[i]) / mGain[i];
+        } else {
+            float x = in[0] - mBias[0], y = in[1] - mBias[1], z = in[2] - mBias[2];
+            for (int i = 0; i < 3; i++)
+                v[i] = mInverse[i][0] * x + mInverse[i][1] * y + mInverse[i][2] * z;
+        }
+        for (int i = 0; i < 3; i++) {
+            float r = rintf(v[i]);
+            raw[i] = r > INT16_MAX ? INT16_MAX : (r < INT16_MIN ? INT16_MIN : (int)r);
+        }
+    }
+
+private:
+    /* a singular mounting matrix leaves the inverse zero */
+    void invertMatrix() {
+        const float (*m)[3] = mMatrix;
+        float det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                  - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                  + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        memset(mInverse, 0, sizeof(mInverse));
+        if (det == 0)
+            return;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                /* cofactor of m[j][i] over the determinant */
+                int r0 = (j + 1) % 3, r1 = (j + 2) % 3;
+                int c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+                mInverse[i][j] = (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) / det;
+            }
+        }
+    }
+
+    bool mPermutation;
+    int mAxis[3];
+    float mGain[3];
+    float mMatrix[3][3];
+    float mInverse[3][3];
+    float mBias[3];
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_AXIS_TRANSFORM_H
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "nusensors.h"
+#include "BoardConfig.h"
+
+/*****************************************************************************/
+
+static void setDefaults(struct board_config* cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    strcpy(cfg->accel_device, GSENSOR_DEV_PATH);
+    strcpy(cfg->accel_input, "gsensor");
+    cfg->accel_rotation[0] = cfg->accel_rotation[4] = cfg->accel_rotation[8] = 1.0f;
+    cfg->accel_range = 2.0f;
+    cfg->accel_lsb_per_g = 16384.0f;
+    /* no ODR table: the sensor list keeps its built-in delays */
+    cfg->accel_odr_count = 0;
+    strcpy(cfg->accel_spill_path, "/data/vendor/sensors/accel.spill");
+    cfg->accel_spill_sync_ms = 30000;
+    cfg->accel_i2c_addr = 0x0e;
+}
+
+static char* trim(char* s)
+{
+    while (isspace((unsigned char)*s))
+        s++;
+    char* end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    return s;
+}
+
+/* parse up to max floats separated by blanks or commas, returns how many */
+static int parseFloats(const char* s, float* out, int max)
+{
+    int n = 0;
+    while (n < max) {
+        char* end;
+        while (isspace((unsigned char)*s) || *s == ',')
+            s++;
+        if (!*s)
+            break;
+        float v = strtof(s, &end);
+        if (end == s)
+            return -1;
+        out[n++] = v;
+        s = end;
+    }
+    return n;
+}
+
+static void copyString(char* dst, size_t size, const char* src)
+{
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = '\0';
+}
+
+static void parseLine(struct board_config* cfg, const char* key, const char* value, int line)
+{
+    if (!strcmp(key, "accel.device")) {
+        copyString(cfg->accel_device, sizeof(cfg->accel_device), value);
+    } else if (!strcmp(key, "accel.input")) {
+        copyString(cfg->accel_input, sizeof(cfg->accel_input), value);
+    } else if (!strcmp(key, "accel.rotation")) {
+        float m[9];
+        if (parseFloats(value, m, 9) != 9) {
+            LOGE("board config line %d: accel.rotation needs 9 values", line);
+            return;
+        }
+        memcpy(cfg->accel_rotation, m, sizeof(m));
+    } else if (!strcmp(key, "accel.range")) {
+        cfg->accel_range = strtof(value, NULL);
+        cfg->accel_scale_set = 1;
+    } else if (!strcmp(key, "accel.lsb_per_g")) {
+        cfg->accel_lsb_per_g = strtof(value, NULL);
+        cfg->accel_scale_set = 1;
+    } else if (!strcmp(key, "accel.odr")) {
+        int n = parseFloats(value, cfg->accel_odr_hz, BOARD_CONFIG_MAX_ODR);
+        cfg->accel_odr_count = n > 0 ? n : 0;
+    } else if (!strcmp(key, "accel.fifo_reserved")) {
+        cfg->accel_fifo_reserved = strtoul(value, NULL, 0);
+    } else if (!strcmp(key, "accel.fifo_max")) {
+        cfg->accel_fifo_max = strtoul(value, NULL, 0);
+    } else if (!strcmp(key, "accel.spill_path")) {
+        copyString(cfg->accel_spill_path, sizeof(cfg->accel_spill_path), value);
+    } else if (!strcmp(key, "accel.spill_samples")) {
+        cfg->accel_spill_samples = strtoul(value, NULL, 0);
+    } else if (!strcmp(key, "accel.spill_sync_ms")) {
+        cfg->accel_spill_sync_ms = strtoul(value, NULL, 0);
+    } else if (!strcmp(key, "accel.i2c_bus")) {
+        copyString(cfg->accel_i2c_bus, sizeof(cfg->accel_i2c_bus), value);
+    } else if (!strcmp(key, "accel.i2c_addr")) {
+        cfg->accel_i2c_addr = strtoul(value, NULL, 0);
+    } else if (!strcmp(key, "subhal")) {
+        if (cfg->subhal_count >= BOARD_CONFIG_MAX_SUBHAL) {
+            LOGE("board config line %d: more than %d sub-HALs", line, BOARD_CONFIG_MAX_SUBHAL);
+            return;
+        }
+        copyString(cfg->subhal[cfg->subhal_count], sizeof(cfg->subhal[0]), value);
+        cfg->subhal_count++;
+    } else {
+        LOGW("board config line %d: unknown key '%s'", line, key);
+    }
+}
+
+int board_config_load(const char* path, struct board_config* cfg)
+{
+    setDefaults(cfg);
+
+    FILE* f = fopen(path, "re");
+    if (!f)
+        return -errno;
+
+    char buf[256];
+    int line = 0;
+    while (fgets(buf, sizeof(buf), f)) {
+        line++;
+        char* hash = strchr(buf, '#');
+        if (hash)
+            *hash = '\0';
+        char* eq = strchr(buf, '=');
+        if (!eq) {
+            LOGE_IF(*trim(buf), "board config line %d: expected key = value", line);
+            continue;
+        }
+        *eq = '\0';
+        parseLine(cfg, trim(buf), trim(eq + 1), line);
+    }
+    fclose(f);
+
+    if (cfg->accel_range <= 0 || cfg->accel_lsb_per_g <= 0) {
+        LOGE("board config: bad accel range/scale, using defaults");
+        cfg->accel_range = 2.0f;
+        cfg->accel_lsb_per_g = 16384.0f;
+        cfg->accel_scale_set = 0;
+    }
+    return 0;
+}
+
+static struct board_config sBoardConfig;
+static pthread_once_t sBoardConfigOnce = PTHREAD_ONCE_INIT;
+
+static void loadBoardConfig()
+{
+    int err = board_config_load(BOARD_CONFIG_PATH, &sBoardConfig);
+    if (err < 0) {
+        LOGI("no board config at %s (%s), using defaults", BOARD_CONFIG_PATH, strerror(-err));
+        return;
+    }
+    const float* m = sBoardConfig.accel_rotation;
+    LOGI("board config: accel %s/%s rotation [%g %g %g; %g %g %g; %g %g %g] %d ODRs, %d sub-HALs",
+            sBoardConfig.accel_device, sBoardConfig.accel_input,
+            m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7], m[8],
+            sBoardConfig.accel_odr_count, sBoardConfig.subhal_count);
+}
+
+const struct board_config* board_config_get(void)
+{
+    pthread_once(&sBoardConfigOnce, loadBoardConfig);
+    return &sBoardConfig;
+}
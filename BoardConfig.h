@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BOARD_CONFIG_H
+#define ANDROID_BOARD_CONFIG_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+/*****************************************************************************/
+
+#define BOARD_CONFIG_PATH       "/vendor/etc/sensors/board.conf"
+#define BOARD_CONFIG_MAX_ODR    8
+#define BOARD_CONFIG_MAX_SUBHAL 4
+
+/*
+ * Per-board description of the accelerometer, read from BOARD_CONFIG_PATH
+ * as "key = value" lines ('#' starts a comment):
+ *
+ *   accel.device       = /dev/gsensor
+ *   accel.input        = gsensor
+ *   accel.rotation     = 0 1 0  -1 0 0  0 0 1    # chip -> device axes, row major
+ *   accel.range        = 2                        # full scale, g
+ *   accel.lsb_per_g    = 16384
+ *   accel.odr          = 12.5 25 50 100 200       # supported rates, Hz
+ *   accel.fifo_reserved = 0                       # 0: the HAL's own batching FIFO
+ *   accel.fifo_max     = 0
+ *   accel.spill_path   = /data/vendor/sensors/accel.spill   # batches past the RAM FIFO
+ *   accel.spill_samples = 0                       # 0: no spill file
+ *   accel.spill_sync_ms = 30000                   # least time between writebacks
+ *   accel.i2c_bus      = /dev/i2c-1               # drive the chip from the HAL, no kernel driver
+ *   accel.i2c_addr     = 0x0e
+ *   subhal             = /vendor/lib/hw/sensors.light.so   # repeatable
+ *
+ * Missing keys keep the defaults, which describe the stock KXTJ3 board.
+ */
+struct board_config {
+    char accel_device[64];
+    char accel_input[32];
+    float accel_rotation[9];
+    float accel_range;
+    float accel_lsb_per_g;
+    /* range or scale came from the file; if not, the sensor list keeps its own */
+    int accel_scale_set;
+    int accel_odr_count;
+    float accel_odr_hz[BOARD_CONFIG_MAX_ODR];
+    uint32_t accel_fifo_reserved;
+    uint32_t accel_fifo_max;
+    char accel_spill_path[128];
+    uint32_t accel_spill_samples;
+    uint32_t accel_spill_sync_ms;
+    char accel_i2c_bus[32];
+    uint32_t accel_i2c_addr;
+    /* other vendors' sensors modules aggregated behind this one */
+    int subhal_count;
+    char subhal[BOARD_CONFIG_MAX_SUBHAL][128];
+};
+
+/* fill cfg with the defaults, then override from path; -errno if unreadable */
+int board_config_load(const char* path, struct board_config* cfg);
+
+/* the board configuration, loaded from BOARD_CONFIG_PATH on first use */
+const struct board_config* board_config_get(void);
+
+/*****************************************************************************/
+
+__END_DECLS
+
+#endif  // ANDROID_BOARD_CONFIG_H
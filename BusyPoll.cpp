@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "BusyPoll.h"
+
+/*****************************************************************************/
+
+BusyPoll::BusyPoll()
+    : mWindow(0),
+      mLastEvent(0)
+{
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+void BusyPoll::fed(int64_t now)
+{
+    mLastEvent = now;
+}
+
+int64_t BusyPoll::spinStart(int64_t period) const
+{
+    if (!mWindow || !period || !mLastEvent)
+        return -1;
+    /* a spin window as long as the period would never sleep */
+    if (mWindow >= period)
+        return -1;
+    return mLastEvent + period - mWindow / 2;
+}
+
+void BusyPoll::spun(bool hit, int64_t cpuNs)
+{
+    mStats.spins++;
+    if (hit)
+        mStats.hits++;
+    mStats.spin_cpu_ns += cpuNs;
+}
+
+void BusyPoll::getStats(struct sensors_busy_poll_stats* stats) const
+{
+    *stats = mStats;
+    stats->window_ns = mWindow;
+}
+
+/*****************************************************************************/
+
+SpinBudget::SpinBudget()
+    : mPercent(defaultPercent),
+      mStart(0),
+      mSpent(0)
+{
+}
+
+bool SpinBudget::allows(int64_t now)
+{
+    if (now - mStart >= intervalNs) {
+        mStart = now;
+        mSpent = 0;
+    }
+    return mSpent * 100 < intervalNs * mPercent;
+}
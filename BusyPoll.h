@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BUSY_POLL_H
+#define ANDROID_BUSY_POLL_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <atomic>
+
+#include "nusensors.h"
+
+/*****************************************************************************/
+
+/*
+ * Low-latency mode for one driver. The owner reports each delivery with
+ * fed(); from the stream period, spinStart() tells when the next sample
+ * is due, minus half the spin window. Between spinStart() and
+ * spinStart() + window the poll loop polls without sleeping, so the
+ * sample is picked up without a wakeup. A window of 0 turns it off;
+ * it may be set from another thread than the poll loop's.
+ */
+class BusyPoll {
+public:
+            BusyPoll();
+
+    void setWindow(int64_t ns) { mWindow = ns; }
+    int64_t getWindow() const { return mWindow; }
+
+    void fed(int64_t now);
+    /* when spinning should begin, -1 when off or nothing is expected */
+    int64_t spinStart(int64_t period) const;
+    void spun(bool hit, int64_t cpuNs);
+    void skipped() { mStats.budget_skips++; }
+
+    void getStats(struct sensors_busy_poll_stats* stats) const;
+
+private:
+    std::atomic<int64_t> mWindow;
+    int64_t mLastEvent;
+    struct sensors_busy_poll_stats mStats;
+};
+
+/*
+ * CPU time all spinning may use, as a share of each second. Spinning
+ * that would go past it is skipped and the loop sleeps as usual.
+ */
+class SpinBudget {
+public:
+    static const int defaultPercent = 10;
+
+            SpinBudget();
+
+    void setPercent(int percent) { mPercent = percent; }
+    bool allows(int64_t now);
+    void spend(int64_t cpuNs) { mSpent += cpuNs; }
+
+private:
+    static const int64_t intervalNs = 1000000000LL;
+
+    int mPercent;
+    int64_t mStart;
+    int64_t mSpent;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_BUSY_POLL_H
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "CompactFifo.h"
+
+/*****************************************************************************/
+
+static inline int16_t clampAxis(int v)
+{
+    return v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v);
+}
+
+CompactFifo::CompactFifo(int blocks, int blockSamples)
+    : mBlocks(blocks),
+      mBlockSamples(blockSamples),
+      mBlockBytes(sizeof(Block) + blockSamples * sizeof(Record))
+{
+    mStorage = new uint8_t[mBlocks * mBlockBytes];
+    clear();
+}
+
+CompactFifo::~CompactFifo()
+{
+    delete [] mStorage;
+}
+
+void CompactFifo::clear()
+{
+    mHead = mTail = 0;
+    mUsedBlocks = 0;
+    mSize = 0;
+}
+
+bool CompactFifo::push(int64_t timestamp, const int raw[3])
+{
+    bool kept = true;
+    Block* b = mUsedBlocks ? block(mTail) : NULL;
+
+    /* a new block when this one is full or the delta doesn't fit in 32 bits */
+    if (!b || b->count == mBlockSamples || timestamp < b->base ||
+            timestamp - b->base > (int64_t)UINT32_MAX) {
+        if (mUsedBlocks == mBlocks) {
+            Block* oldest = block(mHead);
+            mSize -= oldest->count - oldest->read;
+            mHead = (mHead + 1) % mBlocks;
+            mUsedBlocks--;
+            kept = false;
+        }
+        if (mUsedBlocks)
+            mTail = (mTail + 1) % mBlocks;
+        else
+            mHead = mTail;
+        mUsedBlocks++;
+
+        b = block(mTail);
+        b->base = timestamp;
+        b->count = 0;
+        b->read = 0;
+    }
+
+    Record* r = records(b) + b->count++;
+    r->axis[0] = clampAxis(raw[0]);
+    r->axis[1] = clampAxis(raw[1]);
+    r->axis[2] = clampAxis(raw[2]);
+    r->delta = (uint32_t)(timestamp - b->base);
+    mSize++;
+    return kept;
+}
+
+void CompactFifo::front(int64_t* timestamp, int raw[3]) const
+{
+    Block* b = block(mHead);
+    const Record* r = records(b) + b->read;
+    *timestamp = b->base + r->delta;
+    raw[0] = r->axis[0];
+    raw[1] = r->axis[1];
+    raw[2] = r->axis[2];
+}
+
+void CompactFifo::pop()
+{
+    if (!mSize)
+        return;
+
+    Block* b = block(mHead);
+    b->read++;
+    mSize--;
+    if (b->read == b->count) {
+        mUsedBlocks--;
+        if (mUsedBlocks)
+            mHead = (mHead + 1) % mBlocks;
+    }
+}
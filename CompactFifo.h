@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_COMPACT_FIFO_H
+#define ANDROID_COMPACT_FIFO_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Batching storage for raw 3-axis samples: 16-bit counts per axis and a
+ * 32-bit timestamp delta against the base of the block holding them,
+ * 10 bytes a sample instead of a 104 byte sensors_event_t. All memory is
+ * allocated up front. When full, the oldest block is dropped, like a
+ * hardware FIFO in stream mode.
+ */
+class CompactFifo {
+public:
+            CompactFifo(int blocks, int blockSamples);
+            ~CompactFifo();
+
+    int capacity() const { return mBlocks * mBlockSamples; }
+    int size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+
+    /* false when the oldest samples had to be dropped to make room */
+    bool push(int64_t timestamp, const int raw[3]);
+    /* oldest sample; only valid when not empty */
+    void front(int64_t* timestamp, int raw[3]) const;
+    void pop();
+    void clear();
+
+private:
+    struct Record {
+        int16_t axis[3];
+        uint32_t delta;
+    } __attribute__((packed));
+
+    struct Block {
+        int64_t base;
+        uint16_t count;         // records written
+        uint16_t read;          // records already popped
+    };
+
+    Block* block(int index) const {
+        return (Block*)(mStorage + (size_t)index * mBlockBytes);
+    }
+    Record* records(Block* b) const { return (Record*)(b + 1); }
+
+    int mBlocks;
+    int mBlockSamples;
+    size_t mBlockBytes;
+    uint8_t* mStorage;
+    int mHead;                  // oldest block
+    int mTail;                  // block being written
+    int mUsedBlocks;
+    int mSize;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_COMPACT_FIFO_H
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DRIVER_REGISTRY_H
+#define ANDROID_DRIVER_REGISTRY_H
+
+#include <errno.h>
+#include <stddef.h>
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/*****************************************************************************/
+
+/*
+ * The drivers of the poll context, by concrete type. A driver's index is
+ * its position in the list; forEach() and visit() hand out the driver
+ * with its own type, so with final driver classes the calls the poll
+ * loop makes on it are direct and can be inlined.
+ */
+template <typename... Drivers>
+class DriverRegistry {
+public:
+    static constexpr int size = sizeof...(Drivers);
+
+    template <typename Driver>
+    static constexpr int indexOf() {
+        static_assert((std::is_same<Driver, Drivers>::value + ... + 0) == 1,
+                "driver class not in the registry, or listed twice");
+        constexpr bool matches[] = { std::is_same<Driver, Drivers>::value... };
+        int index = 0;
+        while (!matches[index])
+            index++;
+        return index;
+    }
+
+    DriverRegistry() : mDrivers() {}
+
+    template <typename Driver>
+    Driver*& get() { return std::get<Driver*>(mDrivers); }
+
+    /* f(index, driver) for each driver that exists */
+    template <typename F>
+    void forEach(F&& f) const {
+        forEach(f, std::index_sequence_for<Drivers...>());
+    }
+
+    /* f(driver) for the driver at index, -EINVAL when there is none */
+    template <typename F>
+    int visit(int index, F&& f) const {
+        return visit(index, f, std::index_sequence_for<Drivers...>());
+    }
+
+private:
+    template <typename F, size_t... I>
+    void forEach(F& f, std::index_sequence<I...>) const {
+        ((std::get<I>(mDrivers) ? (void)f((int)I, std::get<I>(mDrivers)) : (void)0), ...);
+    }
+
+    template <typename F, size_t... I>
+    int visit(int index, F& f, std::index_sequence<I...>) const {
+        int result = -EINVAL;
+        ((index == (int)I && std::get<I>(mDrivers) ?
+                (result = f(std::get<I>(mDrivers)), true) : false) || ...);
+        return result;
+    }
+
+    std::tuple<Drivers*...> mDrivers;
+};
+
+/*
+ * A sensor handle, the index of the driver serving it, whether it wakes
+ * the AP and whether it is urgent, i.e. not a continuous stream.
+ */
+struct SensorRoute {
+    int handle;
+    int driver;
+    bool wakeUp;
+    bool urgent;
+};
+
+template <size_t N>
+constexpr bool routesHaveUniqueHandles(const SensorRoute (&routes)[N])
+{
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = i + 1; j < N; j++) {
+            if (routes[i].handle == routes[j].handle)
+                return false;
+        }
+    }
+    return true;
+}
+
+template <size_t N>
+constexpr bool routesBelow(const SensorRoute (&routes)[N], int limit)
+{
+    for (size_t i = 0; i < N; i++) {
+        if (routes[i].handle < 0 || routes[i].handle >= limit)
+            return false;
+    }
+    return true;
+}
+
+template <size_t N>
+constexpr bool routesServe(const SensorRoute (&routes)[N], int driver)
+{
+    for (size_t i = 0; i < N; i++) {
+        if (routes[i].driver == driver)
+            return true;
+    }
+    return false;
+}
+
+/*****************************************************************************/
+
+#endif  // ANDROID_DRIVER_REGISTRY_H
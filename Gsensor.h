@@ -9,6 +9,18 @@
 
 #define GSENSOR_IOCTL_MAGIC				'a'
 
+/* Rx buffer size of GSENSOR_IOCTL_GETDATA */
+#ifndef RBUFF_SIZE
+#define RBUFF_SIZE 12
+#endif
+
+/* what the driver copies out for GSENSOR_IOCTL_GETDATA, raw chip units */
+struct gsensor_axis {
+    int x;
+    int y;
+    int z;
+};
+
 /* IOCTLs for GSENSOR library */
 #define GSENSOR_IOCTL_INIT                  _IO(GSENSOR_IOCTL_MAGIC, 0x01)
 #define GSENSOR_IOCTL_RESET      	        _IO(GSENSOR_IOCTL_MAGIC, 0x04)
@@ -0,0 +1,402 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "BoardConfig.h"
+#include "IioAccelSensor.h"
+#include "SensorTrace.h"
+#include "AccelHistory.h"
+#include "SensorClock.h"
+
+/*****************************************************************************/
+
+IioAccelSensor::IioAccelSensor(const char* sysfsRoot, const char* devRoot)
+    : SensorBase(NULL, NULL),
+      mScanSize(0),
+      mScale(1.0f),
+      mReadBuffer(NULL),
+      mEnabled(0),
+      mDelay(200000000),
+      mLatency(0),
+      mWatermark(1),
+      mNumPendingFlushes(0)
+{
+    pthread_mutex_init(&mFlushLock, NULL);
+    static const char* const names[numChannels] = {
+        "in_accel_x", "in_accel_y", "in_accel_z", "in_timestamp",
+    };
+
+    memset(mChannels, 0, sizeof(mChannels));
+    for (int i = 0; i < numChannels; i++)
+        mChannels[i].name = names[i];
+    mDevicePath[0] = '\0';
+    mDevName[0] = '\0';
+    mDataPath[0] = '\0';
+
+    mPendingEvent.version = sizeof(sensors_event_t);
+    mPendingEvent.sensor = ID_A;
+    mPendingEvent.type = SENSOR_TYPE_ACCELEROMETER;
+    memset(mPendingEvent.data, 0, sizeof(mPendingEvent.data));
+    mPendingEvent.acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
+
+    if (!findDevice(sysfsRoot) || !parseScanElements())
+        return;
+
+    char buf[32];
+    if (readAttr("in_accel_scale", buf, sizeof(buf)) > 0)
+        mScale = strtof(buf, NULL);
+
+    /* the driver reports chip axes; in_accel_scale already gives m/s^2 */
+    static const int noOffset[3] = { 0, 0, 0 };
+    mTransform.set(board_config_get()->accel_rotation, noOffset, mScale);
+
+    /* hardware timestamps in the same clock as getTimestamp() */
+    writeAttr("current_timestamp_clock", "boottime");
+
+    writeAttr("buffer/enable", 0L);
+    for (int i = 0; i < numChannels; i++) {
+        if (mChannels[i].present) {
+            char attr[64];
+            snprintf(attr, sizeof(attr), "scan_elements/%s_en", mChannels[i].name);
+            writeAttr(attr, 1L);
+        }
+    }
+    writeAttr("buffer/length", (long)readBufferRecords * 4);
+    writeAttr("buffer/watermark", (long)mWatermark);
+
+    mReadBuffer = new uint8_t[readBufferRecords * mScanSize];
+
+    snprintf(mDataPath, sizeof(mDataPath), "%s/%s", devRoot, mDevName);
+    data_fd = open(mDataPath, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    LOGE_IF(data_fd < 0, "couldn't open %s (%s)", mDataPath, strerror(errno));
+
+    LOGI("iio accelerometer %s: %d byte scan, scale %f, %s timestamps", mDevName,
+            mScanSize, mScale, mChannels[chanTimestamp].present ? "hardware" : "read");
+}
+
+IioAccelSensor::~IioAccelSensor()
+{
+    if (mEnabled)
+        enable(0, 0);
+    delete [] mReadBuffer;
+    pthread_mutex_destroy(&mFlushLock);
+}
+
+bool IioAccelSensor::findDevice(const char* sysfsRoot)
+{
+    DIR* dir = opendir(sysfsRoot);
+    if (!dir)
+        return false;
+
+    struct dirent* de;
+    while ((de = readdir(dir))) {
+        if (strncmp(de->d_name, "iio:device", 10))
+            continue;
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s/scan_elements/in_accel_x_en", sysfsRoot, de->d_name);
+        if (access(path, F_OK))
+            continue;
+
+        snprintf(mDevicePath, sizeof(mDevicePath), "%s/%s", sysfsRoot, de->d_name);
+        strncpy(mDevName, de->d_name, sizeof(mDevName) - 1);
+        mDevName[sizeof(mDevName) - 1] = '\0';
+        break;
+    }
+    closedir(dir);
+    return mDevName[0] != '\0';
+}
+
+bool IioAccelSensor::parseScanElements()
+{
+    for (int i = 0; i < numChannels; i++) {
+        Channel& c = mChannels[i];
+        char attr[64];
+        char buf[32];
+
+        snprintf(attr, sizeof(attr), "scan_elements/%s_index", c.name);
+        if (readAttr(attr, buf, sizeof(buf)) <= 0)
+            continue;
+        c.index = atoi(buf);
+
+        /* e.g. "le:s12/16>>4" */
+        snprintf(attr, sizeof(attr), "scan_elements/%s_type", c.name);
+        char endian, sign;
+        unsigned bits, storage, shift = 0;
+        if (readAttr(attr, buf, sizeof(buf)) <= 0 ||
+                sscanf(buf, "%ce:%c%u/%u>>%u", &endian, &sign, &bits, &storage, &shift) < 4) {
+            LOGE("bad scan type '%s' for %s", buf, c.name);
+            continue;
+        }
+        if (storage != 8 && storage != 16 && storage != 32 && storage != 64)
+            continue;
+
+        c.present = true;
+        c.bigEndian = endian == 'b';
+        c.isSigned = sign == 's';
+        c.bits = bits;
+        c.bytes = storage / 8;
+        c.shift = shift;
+    }
+
+    if (!mChannels[chanX].present || !mChannels[chanY].present || !mChannels[chanZ].present) {
+        LOGE("%s: incomplete accel scan elements", mDevName);
+        return false;
+    }
+
+    /* the kernel packs enabled channels by index, each aligned to its own size */
+    int offset = 0, maxBytes = 1;
+    for (int index = 0, placed = 0; placed < numChannels && index < 64; index++) {
+        for (int i = 0; i < numChannels; i++) {
+            Channel& c = mChannels[i];
+            if (!c.present || c.index != index)
+                continue;
+            offset = (offset + c.bytes - 1) & ~(c.bytes - 1);
+            c.offset = offset;
+            offset += c.bytes;
+            if (c.bytes > maxBytes)
+                maxBytes = c.bytes;
+            placed++;
+        }
+    }
+    mScanSize = (offset + maxBytes - 1) & ~(maxBytes - 1);
+    return true;
+}
+
+int64_t IioAccelSensor::decode(const uint8_t* record, const Channel& c) const
+{
+    const uint8_t* p = record + c.offset;
+    uint64_t v = 0;
+
+    if (c.bigEndian) {
+        for (int i = 0; i < c.bytes; i++)
+            v = (v << 8) | p[i];
+    } else {
+        for (int i = c.bytes - 1; i >= 0; i--)
+            v = (v << 8) | p[i];
+    }
+
+    v >>= c.shift;
+    if (c.bits < 64) {
+        v &= (1ULL << c.bits) - 1;
+        if (c.isSigned && (v & (1ULL << (c.bits - 1))))
+            v |= ~((1ULL << c.bits) - 1);
+    }
+    return (int64_t)v;
+}
+
+int IioAccelSensor::writeAttr(const char* attr, const char* value) const
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", mDevicePath, attr);
+
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    int err = write(fd, value, strlen(value)) < 0 ? -errno : 0;
+    close(fd);
+    return err;
+}
+
+int IioAccelSensor::writeAttr(const char* attr, long value) const
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", value);
+    return writeAttr(attr, buf);
+}
+
+int IioAccelSensor::readAttr(const char* attr, char* value, size_t size) const
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", mDevicePath, attr);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    ssize_t n = read(fd, value, size - 1);
+    close(fd);
+    if (n < 0)
+        return -errno;
+    value[n] = '\0';
+    return n;
+}
+
+int IioAccelSensor::enable(int32_t /* handle */, int en)
+{
+    int newState = en ? 1 : 0;
+    int err = 0;
+
+    if ((int)mEnabled != newState) {
+        SENSOR_TRACE_SCOPE("iio_enable", newState);
+        err = writeAttr("buffer/enable", (long)newState);
+        if (err < 0) {
+            LOGE("fail to %s iio buffer (%s)", newState ? "enable" : "disable", strerror(-err));
+            return err;
+        }
+        mEnabled = newState;
+    }
+    return 0;
+}
+
+int IioAccelSensor::setDelay(int32_t /* handle */, int64_t ns)
+{
+    if (ns <= 0)
+        return -EINVAL;
+
+    mDelay = ns;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f", 1e9 / ns);
+
+    SENSOR_TRACE_SCOPE("iio_set_rate", 0);
+    int err = writeAttr("sampling_frequency", buf);
+    if (err < 0)
+        err = writeAttr("in_accel_sampling_frequency", buf);
+    LOGE_IF(err < 0, "fail to set iio sampling_frequency %s (%s)", buf, strerror(-err));
+    updateWatermark();
+    return err;
+}
+
+int IioAccelSensor::batch(int handle, int /* flags */, int64_t period_ns, int64_t timeout)
+{
+    mLatency = timeout > 0 ? timeout : 0;
+    return setDelay(handle, period_ns);
+}
+
+/*
+ * As many records as fit in the latency, at most what one read takes.
+ * The buffer has to be off while the watermark changes.
+ */
+void IioAccelSensor::updateWatermark()
+{
+    int64_t records = mLatency / mDelay;
+    int watermark = records < 1 ? 1 :
+            records > readBufferRecords ? readBufferRecords : (int)records;
+    if (watermark == mWatermark)
+        return;
+
+    if (mEnabled)
+        writeAttr("buffer/enable", 0L);
+    int err = writeAttr("buffer/watermark", (long)watermark);
+    if (mEnabled)
+        writeAttr("buffer/enable", 1L);
+    if (err < 0) {
+        LOGE("fail to set iio buffer watermark %d (%s)", watermark, strerror(-err));
+        return;
+    }
+    mWatermark = watermark;
+}
+
+/* records under the watermark don't wake poll(), so readEvents() is asked to look */
+int IioAccelSensor::flush(int handle)
+{
+    if (mWatermark <= 1)
+        return -ENOSYS;
+
+    pthread_mutex_lock(&mFlushLock);
+    int err = 0;
+    if (mNumPendingFlushes < maxPendingFlushes)
+        mPendingFlushes[mNumPendingFlushes++] = handle;
+    else
+        err = -EBUSY;
+    pthread_mutex_unlock(&mFlushLock);
+    return err;
+}
+
+/* restart the buffer and take a fresh handle on the character device */
+int IioAccelSensor::recover()
+{
+    LOGW("%s stalled, restarting the buffer", mDevName);
+    SENSOR_TRACE_SCOPE("iio_recover", 0);
+
+    writeAttr("buffer/enable", 0L);
+
+    int fd = open(mDataPath, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("couldn't reopen %s (%s)", mDataPath, strerror(errno));
+    } else {
+        close(data_fd);
+        data_fd = fd;
+    }
+
+    int err = writeAttr("buffer/enable", (long)mEnabled);
+    LOGE_IF(err < 0, "fail to restart iio buffer (%s)", strerror(-err));
+    return fd < 0 ? -ENODEV : err;
+}
+
+int IioAccelSensor::isActivated(int /* handle */)
+{
+    return mEnabled;
+}
+
+int IioAccelSensor::readEvents(sensors_event_t* data, int count)
+{
+    if (count < 1)
+        return -EINVAL;
+    int want = count > readBufferRecords ? readBufferRecords : count;
+
+    ssize_t n = read(data_fd, mReadBuffer, want * mScanSize);
+    if (n < 0 && errno != EAGAIN)
+        return -errno;
+    int records = n < 0 ? 0 : n / mScanSize;
+    SENSOR_TRACE(FILL, ID_A, records);
+
+    /* hardware time doesn't follow a simulated clock */
+    bool hwTimestamp = mChannels[chanTimestamp].present && !SensorClock::get()->isVirtual();
+    int64_t now = hwTimestamp ? 0 : getTimestamp();
+
+    for (int i = 0; i < records; i++) {
+        const uint8_t* record = mReadBuffer + i * mScanSize;
+        const int raw[3] = {
+            (int)decode(record, mChannels[chanX]),
+            (int)decode(record, mChannels[chanY]),
+            (int)decode(record, mChannels[chanZ]),
+        };
+        mTransform.apply(raw, mPendingEvent.acceleration.v);
+        mPendingEvent.timestamp = hwTimestamp ?
+                decode(record, mChannels[chanTimestamp]) :
+                now - (records - 1 - i) * mDelay;
+        AccelHistory::sAccel.push(mPendingEvent.timestamp, mPendingEvent.acceleration.v);
+        data[i] = mPendingEvent;
+    }
+
+    /* a short read emptied the buffer: everything before the flushes is out */
+    int done = 0;
+    if (records < want) {
+        pthread_mutex_lock(&mFlushLock);
+        while (records + done < count && done < mNumPendingFlushes) {
+            sensors_event_t& ev = data[records + done];
+            memset(&ev, 0, sizeof(ev));
+            ev.version = META_DATA_VERSION;
+            ev.type = SENSOR_TYPE_META_DATA;
+            ev.meta_data.what = META_DATA_FLUSH_COMPLETE;
+            ev.meta_data.sensor = mPendingFlushes[done++];
+        }
+        mNumPendingFlushes -= done;
+        memmove(mPendingFlushes, mPendingFlushes + done, mNumPendingFlushes * sizeof(int));
+        pthread_mutex_unlock(&mFlushLock);
+        SENSOR_TRACE(FLUSH_DELIVERED, ID_A, done);
+    }
+
+    SENSOR_TRACE(DECODE, ID_A, records);
+    return records + done;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_IIO_ACCEL_SENSOR_H
+#define ANDROID_IIO_ACCEL_SENSOR_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "nusensors.h"
+#include "SensorBase.h"
+#include "AxisTransform.h"
+
+/*****************************************************************************/
+
+#define IIO_SYSFS_ROOT      "/sys/bus/iio/devices"
+#define IIO_DEV_ROOT        "/dev"
+
+/*
+ * Accelerometer backend for mainline IIO drivers in buffered mode. Scan
+ * records (x, y, z and the hardware timestamp channel) are read from
+ * /dev/iio:deviceN in bulk and decoded straight into sensors_event_t;
+ * the rate goes through sampling_frequency. A batch latency becomes the
+ * buffer watermark, so the device wakes poll() once per batch rather
+ * than once per sample. The roots are parameters so a fake sysfs tree
+ * and a pipe can stand in for the device.
+ */
+class IioAccelSensor : public SensorBase {
+public:
+            IioAccelSensor(const char* sysfsRoot = IIO_SYSFS_ROOT,
+                    const char* devRoot = IIO_DEV_ROOT);
+    virtual ~IioAccelSensor();
+
+    /* false when no buffered IIO accelerometer was found */
+    bool isValid() const { return mScanSize > 0 && data_fd >= 0; }
+
+    virtual int setDelay(int32_t handle, int64_t ns);
+    virtual int enable(int32_t handle, int enabled);
+    virtual int isActivated(int handle);
+    virtual int readEvents(sensors_event_t* data, int count);
+    virtual bool hasPendingEvents() const { return mNumPendingFlushes > 0; }
+    virtual int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
+    virtual int flush(int handle);
+    /* records arrive a watermark at a time */
+    virtual int64_t getStreamPeriod() const { return mEnabled ? mDelay * mWatermark : 0; }
+    virtual int recover();
+
+private:
+    enum {
+        chanX = 0,
+        chanY,
+        chanZ,
+        chanTimestamp,
+        numChannels,
+    };
+
+    struct Channel {
+        const char* name;
+        bool present;
+        int index;
+        int offset;         // byte offset in the scan record
+        int bytes;          // storage size
+        int bits;           // real bits
+        int shift;
+        bool isSigned;
+        bool bigEndian;
+    };
+
+    static const int readBufferRecords = 64;
+    static const int maxPendingFlushes = 8;
+
+    bool findDevice(const char* sysfsRoot);
+    bool parseScanElements();
+    int64_t decode(const uint8_t* record, const Channel& c) const;
+    int writeAttr(const char* attr, const char* value) const;
+    int writeAttr(const char* attr, long value) const;
+    int readAttr(const char* attr, char* value, size_t size) const;
+    void updateWatermark();
+
+    char mDevicePath[PATH_MAX];
+    char mDevName[32];
+    char mDataPath[PATH_MAX];
+    Channel mChannels[numChannels];
+    int mScanSize;
+    float mScale;
+    AxisTransform mTransform;
+    uint8_t* mReadBuffer;
+    uint32_t mEnabled;
+    int64_t mDelay;
+    int64_t mLatency;
+    int mWatermark;
+    /* flush() handles answered once the buffer below the watermark is read */
+    pthread_mutex_t mFlushLock;
+    int mPendingFlushes[maxPendingFlushes];
+    int mNumPendingFlushes;
+    sensors_event_t mPendingEvent;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_IIO_ACCEL_SENSOR_H
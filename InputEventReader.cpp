@@ -49,26 +49,41 @@ InputEventCircularReader::~InputEventCircularReader()
 }
 
 ssize_t InputEventCircularReader::fill(int fd)
+{
+    void* buffer;
+    size_t size = prepareFill(&buffer);
+    if (!size)
+        return 0;
+
+    const ssize_t nread = read(fd, buffer, size);
+    return commitFill(nread < 0 ? -errno : nread);
+}
+
+/* the second half of mBuffer takes reads that run past mBufferEnd */
+size_t InputEventCircularReader::prepareFill(void** buffer)
+{
+    *buffer = mHead;
+    return mFreeSpace * sizeof(input_event);
+}
+
+ssize_t InputEventCircularReader::commitFill(ssize_t nread)
 {
     size_t numEventsRead = 0;
-    if (mFreeSpace) {
-        const ssize_t nread = read(fd, mHead, mFreeSpace * sizeof(input_event));
-        if (nread<0 || nread % sizeof(input_event)) {
-            // we got a partial event!!
-            return nread<0 ? -errno : -EINVAL;
-        }
+    if (nread<0 || nread % sizeof(input_event)) {
+        // we got a partial event!!
+        return nread<0 ? nread : -EINVAL;
+    }
 
-        numEventsRead = nread / sizeof(input_event);
-        // dumpEvents(mHead, numEventsRead);
-        D("nread = %ld, numEventsRead = %d.", nread, numEventsRead);
-        if (numEventsRead) {
-            mHead += numEventsRead;
-            mFreeSpace -= numEventsRead;
-            if (mHead > mBufferEnd) {
-                size_t s = mHead - mBufferEnd;
-                memcpy(mBuffer, mBufferEnd, s * sizeof(input_event));
-                mHead = mBuffer + s;
-            }
+    numEventsRead = nread / sizeof(input_event);
+    // dumpEvents(mHead, numEventsRead);
+    D("nread = %ld, numEventsRead = %d.", nread, numEventsRead);
+    if (numEventsRead) {
+        mHead += numEventsRead;
+        mFreeSpace -= numEventsRead;
+        if (mHead > mBufferEnd) {
+            size_t s = mHead - mBufferEnd;
+            memcpy(mBuffer, mBufferEnd, s * sizeof(input_event));
+            mHead = mBuffer + s;
         }
     }
 
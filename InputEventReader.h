@@ -38,6 +38,9 @@ public:
     InputEventCircularReader(size_t numEvents);
     ~InputEventCircularReader();
     ssize_t fill(int fd);
+    /* fill() split in two, for reads issued elsewhere: room to read into, then the result */
+    size_t prepareFill(void** buffer);
+    ssize_t commitFill(ssize_t nread);
     ssize_t readEvent(input_event const** events);
     void next();
 
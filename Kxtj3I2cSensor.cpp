@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "BoardConfig.h"
+#include "Kxtj3I2cSensor.h"
+#include "SensorTrace.h"
+#include "AccelHistory.h"
+
+/*****************************************************************************/
+
+/* KXTJ3-1057 registers */
+#define KXTJ3_XOUT_L            0x06    /* X, Y, Z low/high bytes follow */
+#define KXTJ3_WHO_AM_I          0x0f
+#define KXTJ3_CTRL_REG1         0x1b
+#define KXTJ3_DATA_CTRL_REG     0x21
+
+#define KXTJ3_WHO_AM_I_VALUE    0x35
+
+/* CTRL_REG1 */
+#define KXTJ3_PC1               0x80    /* operating mode; settings change only in standby */
+#define KXTJ3_RES               0x40    /* high resolution */
+#define KXTJ3_RANGE_2G          0x00
+#define KXTJ3_RANGE_4G          0x08
+#define KXTJ3_RANGE_8G          0x10
+#define KXTJ3_RANGE_16G         0x1c
+
+/* DATA_CTRL_REG output data rates, slowest first */
+static const struct {
+    int mhz;
+    uint8_t osa;
+} sOdrTable[] = {
+    {    781, 0x08 }, {   1563, 0x09 }, {   3125, 0x0a }, {   6250, 0x0b },
+    {  12500, 0x00 }, {  25000, 0x01 }, {  50000, 0x02 }, { 100000, 0x03 },
+    { 200000, 0x04 }, { 400000, 0x05 }, { 800000, 0x06 }, { 1600000, 0x07 },
+};
+
+/* slowest rate that still has a fresh sample for every read */
+static int odrIndex(int64_t period)
+{
+    int n = sizeof(sOdrTable) / sizeof(sOdrTable[0]);
+    for (int i = 0; i < n; i++) {
+        if ((int64_t)sOdrTable[i].mhz * period >= 1000000000000LL)
+            return i;
+    }
+    return n - 1;
+}
+
+Kxtj3I2cSensor::Kxtj3I2cSensor()
+    : Kxtj3Sensor(NULL, NULL),
+      mI2cFd(-1),
+      mCtrl(0)
+{
+    const struct board_config* cfg = board_config_get();
+
+    int fd = open(cfg->accel_i2c_bus, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("couldn't open %s (%s)", cfg->accel_i2c_bus, strerror(errno));
+        return;
+    }
+    /* EBUSY means a kernel driver owns the chip; never force past it */
+    if (ioctl(fd, I2C_SLAVE, cfg->accel_i2c_addr) < 0) {
+        LOGE("couldn't address gsensor 0x%02x on %s (%s)", cfg->accel_i2c_addr,
+                cfg->accel_i2c_bus, strerror(errno));
+        close(fd);
+        return;
+    }
+    mI2cFd = fd;
+
+    if (probe() < 0) {
+        close(mI2cFd);
+        mI2cFd = -1;
+        return;
+    }
+
+    data_fd = timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    LOGE_IF(data_fd < 0, "couldn't create gsensor timer (%s)", strerror(errno));
+    LOGI("gsensor on %s at 0x%02x, driven over i2c", cfg->accel_i2c_bus, cfg->accel_i2c_addr);
+}
+
+Kxtj3I2cSensor::~Kxtj3I2cSensor()
+{
+    if (mEnabled) {
+        enable(0, 0);
+    }
+    if (mI2cFd >= 0)
+        close(mI2cFd);
+}
+
+int Kxtj3I2cSensor::readReg(uint8_t reg, uint8_t* value)
+{
+    union i2c_smbus_data data;
+    struct i2c_smbus_ioctl_data args;
+
+    args.read_write = I2C_SMBUS_READ;
+    args.command = reg;
+    args.size = I2C_SMBUS_BYTE_DATA;
+    args.data = &data;
+    if (ioctl(mI2cFd, I2C_SMBUS, &args) < 0)
+        return -errno;
+    *value = data.byte;
+    return 0;
+}
+
+int Kxtj3I2cSensor::writeReg(uint8_t reg, uint8_t value)
+{
+    union i2c_smbus_data data;
+    struct i2c_smbus_ioctl_data args;
+
+    data.byte = value;
+    args.read_write = I2C_SMBUS_WRITE;
+    args.command = reg;
+    args.size = I2C_SMBUS_BYTE_DATA;
+    args.data = &data;
+    if (ioctl(mI2cFd, I2C_SMBUS, &args) < 0)
+        return -errno;
+    return 0;
+}
+
+/* consecutive registers in one transaction, the chip auto-increments */
+int Kxtj3I2cSensor::readBlock(uint8_t reg, uint8_t* buf, int len)
+{
+    union i2c_smbus_data data;
+    struct i2c_smbus_ioctl_data args;
+
+    data.block[0] = len;
+    args.read_write = I2C_SMBUS_READ;
+    args.command = reg;
+    args.size = I2C_SMBUS_I2C_BLOCK_DATA;
+    args.data = &data;
+    if (ioctl(mI2cFd, I2C_SMBUS, &args) < 0)
+        return -errno;
+    if (data.block[0] < len)
+        return -EIO;
+    memcpy(buf, data.block + 1, len);
+    return 0;
+}
+
+/* check the chip is there and leave it in standby, set up for the current rate */
+int Kxtj3I2cSensor::probe()
+{
+    const struct board_config* cfg = board_config_get();
+    uint8_t id;
+
+    int err = readReg(KXTJ3_WHO_AM_I, &id);
+    if (err < 0) {
+        LOGE("gsensor doesn't answer on i2c (%s)", strerror(-err));
+        return err;
+    }
+    if (id != KXTJ3_WHO_AM_I_VALUE) {
+        LOGE("not a KXTJ3 on i2c, WHO_AM_I is 0x%02x", id);
+        return -ENODEV;
+    }
+
+    /* samples are read as left-justified 16 bits: 32768 counts per full scale */
+    int range;
+    if (cfg->accel_range <= 2) {
+        mCtrl = KXTJ3_RES | KXTJ3_RANGE_2G;
+        range = 2;
+    } else if (cfg->accel_range <= 4) {
+        mCtrl = KXTJ3_RES | KXTJ3_RANGE_4G;
+        range = 4;
+    } else if (cfg->accel_range <= 8) {
+        mCtrl = KXTJ3_RES | KXTJ3_RANGE_8G;
+        range = 8;
+    } else {
+        mCtrl = KXTJ3_RES | KXTJ3_RANGE_16G;
+        range = 16;
+    }
+    if (cfg->accel_lsb_per_g != 32768.0f / range)
+        LOGW("board accel.lsb_per_g %g, the chip gives %g at +/-%dg",
+                cfg->accel_lsb_per_g, 32768.0f / range, range);
+
+    err = writeReg(KXTJ3_CTRL_REG1, mCtrl);
+    if (err < 0) {
+        LOGE("couldn't configure gsensor (%s)", strerror(-err));
+        return err;
+    }
+    return writeReg(KXTJ3_DATA_CTRL_REG, sOdrTable[odrIndex(mDelay)].osa);
+}
+
+int Kxtj3I2cSensor::armTimer()
+{
+    struct itimerspec spec;
+    int64_t period = mEnabled && !mInjecting ? mDelay : 0;
+
+    spec.it_interval.tv_sec = period / 1000000000LL;
+    spec.it_interval.tv_nsec = period % 1000000000LL;
+    spec.it_value = spec.it_interval;
+
+    if (timerfd_settime(data_fd, 0, &spec, NULL) < 0) {
+        LOGE("couldn't arm gsensor timer (%s)", strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+int Kxtj3I2cSensor::setPower(bool on)
+{
+    SENSOR_TRACE_SCOPE("gsensor_enable", I2C_SMBUS);
+    int err = writeReg(KXTJ3_CTRL_REG1, on ? mCtrl | KXTJ3_PC1 : mCtrl);
+    LOGE_IF(err < 0, "couldn't %s gsensor (%s)", on ? "start" : "stop", strerror(-err));
+    return err;
+}
+
+int Kxtj3I2cSensor::update_delay()
+{
+    /* applied when injection ends */
+    if (mInjecting)
+        return 0;
+
+    int index = odrIndex(mDelay);
+    LOGI("Kxtj3I2cSensor update delay: %lld ns, ODR %d mHz", (long long)mDelay,
+            sOdrTable[index].mhz);
+
+    /* the rate can only change in standby */
+    SENSOR_TRACE_SCOPE("gsensor_set_rate", I2C_SMBUS);
+    if (mEnabled)
+        writeReg(KXTJ3_CTRL_REG1, mCtrl);
+    int err = writeReg(KXTJ3_DATA_CTRL_REG, sOdrTable[index].osa);
+    LOGE_IF(err < 0, "couldn't set gsensor rate (%s)", strerror(-err));
+    if (mEnabled)
+        writeReg(KXTJ3_CTRL_REG1, mCtrl | KXTJ3_PC1);
+    return err;
+}
+
+int Kxtj3I2cSensor::enable(int32_t handle, int en)
+{
+    int err = Kxtj3Sensor::enable(handle, en);
+    if (err < 0)
+        return err;
+    return armTimer();
+}
+
+int Kxtj3I2cSensor::setDelay(int32_t handle, int64_t ns)
+{
+    if (ns <= 0)
+        return -EINVAL;
+
+    int err = Kxtj3Sensor::setDelay(handle, ns);
+    if (err < 0)
+        return err;
+    return armTimer();
+}
+
+int Kxtj3I2cSensor::setInjectionMode(bool injecting)
+{
+    int err = Kxtj3Sensor::setInjectionMode(injecting);
+    if (err < 0)
+        return err;
+    return armTimer();
+}
+
+/* the chip may have been reset under us: check it and program it again */
+int Kxtj3I2cSensor::recover()
+{
+    LOGW("gsensor stalled, reprogramming it over i2c at %lld ns", (long long)mDelay);
+    SENSOR_TRACE_SCOPE("gsensor_recover", I2C_SMBUS);
+
+    int err = probe();
+    if (err < 0)
+        return err;
+    if (mEnabled && !mInjecting) {
+        err = setPower(true);
+        if (err < 0)
+            return err;
+    }
+
+    mTimestampFilter.reset(mDelay);
+    mWasLocked = false;
+    return armTimer();
+}
+
+int Kxtj3I2cSensor::readEvents(sensors_event_t* data, int count)
+{
+    if (count < 1)
+        return -EINVAL;
+
+    if (mInjecting)
+        return readInjected(data, count);
+
+    bool batching = mBatchLatency > 0 || !heldEmpty();
+    int numEventReceived = 0;
+
+    uint64_t expirations;
+    if (read(data_fd, &expirations, sizeof(expirations)) < 0) {
+        if (errno != EAGAIN)
+            return -errno;
+    } else {
+        SENSOR_TRACE(FILL, mPendingEvent.sensor, expirations);
+
+        /*
+         * The output registers hold only the latest sample, so expirations
+         * we slept through are lost rather than filled with copies of it.
+         */
+        uint8_t buf[6];
+        int err = readBlock(KXTJ3_XOUT_L, buf, sizeof(buf));
+        if (err < 0) {
+            LOGE("gsensor i2c read failed (%s)", strerror(-err));
+        } else {
+            for (int i = 0; i < 3; i++)
+                accel_raw[i] = (int16_t)(buf[2 * i] | (buf[2 * i + 1] << 8));
+            /* read time, smoothed onto the rate's grid */
+            int64_t timestamp = mTimestampFilter.filter(getTimestamp());
+            if (emitSample(timestamp, batching, data)) {
+                data++;
+                count--;
+                numEventReceived++;
+            }
+        }
+    }
+
+    if (batchDue())
+        numEventReceived += drainFifo(data, count);
+
+    SENSOR_TRACE(DECODE, mPendingEvent.sensor, numEventReceived);
+    return numEventReceived;
+}
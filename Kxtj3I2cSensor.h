@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_KXTJ3_I2C_SENSOR_H
+#define ANDROID_KXTJ3_I2C_SENSOR_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "Kxtj3Sensor.h"
+
+/*****************************************************************************/
+
+/*
+ * Kxtj3 backend that drives the chip itself through /dev/i2c-N, for
+ * boards where no kernel driver is bound to it. The HAL programs the
+ * output data rate and range, and each expiry of a timerfd at the
+ * requested rate fetches all three axes with a single I2C block read.
+ * The KXTJ3 holds only its latest sample, so there is nothing to burst
+ * out of the chip; longer batches go through the HAL's own FIFO.
+ */
+class Kxtj3I2cSensor : public Kxtj3Sensor {
+public:
+            Kxtj3I2cSensor();
+    virtual ~Kxtj3I2cSensor();
+
+    /* false when the bus or the chip couldn't be reached */
+    bool isValid() const { return mI2cFd >= 0 && data_fd >= 0; }
+
+    virtual int setDelay(int32_t handle, int64_t ns);
+    virtual int enable(int32_t handle, int enabled);
+    virtual int readEvents(sensors_event_t* data, int count);
+    virtual int recover();
+    virtual int setInjectionMode(bool injecting);
+
+protected:
+    virtual int setPower(bool on);
+    virtual int update_delay();
+
+private:
+    int probe();
+    int armTimer();
+    int readReg(uint8_t reg, uint8_t* value);
+    int writeReg(uint8_t reg, uint8_t value);
+    int readBlock(uint8_t reg, uint8_t* buf, int len);
+
+    int mI2cFd;
+    uint8_t mCtrl;              // CTRL_REG1 range and resolution bits
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_KXTJ3_I2C_SENSOR_H
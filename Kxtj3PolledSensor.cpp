@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "Gsensor.h"
+#include "BoardConfig.h"
+#include "Kxtj3PolledSensor.h"
+#include "SensorTrace.h"
+#include "AccelHistory.h"
+
+/*****************************************************************************/
+
+/* time the chip needs after GSENSOR_IOCTL_START before GETDATA is valid */
+#define KXTJ3_STARTUP_US    20000
+
+Kxtj3PolledSensor::Kxtj3PolledSensor()
+    : Kxtj3Sensor(board_config_get()->accel_device, NULL)
+{
+    data_fd = timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    LOGE_IF(data_fd < 0, "couldn't create gsensor timer (%s)", strerror(errno));
+}
+
+Kxtj3PolledSensor::~Kxtj3PolledSensor()
+{
+    if (mEnabled) {
+        enable(0, 0);
+    }
+}
+
+int Kxtj3PolledSensor::armTimer()
+{
+    struct itimerspec spec;
+    int64_t period = mEnabled && !mInjecting ? mDelay : 0;
+
+    spec.it_interval.tv_sec = period / 1000000000LL;
+    spec.it_interval.tv_nsec = period % 1000000000LL;
+    spec.it_value = spec.it_interval;
+
+    if (timerfd_settime(data_fd, 0, &spec, NULL) < 0) {
+        LOGE("couldn't arm gsensor timer (%s)", strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+int Kxtj3PolledSensor::enable(int32_t handle, int en)
+{
+    int err = Kxtj3Sensor::enable(handle, en);
+    if (err < 0)
+        return err;
+    return armTimer();
+}
+
+int Kxtj3PolledSensor::setDelay(int32_t handle, int64_t ns)
+{
+    if (ns <= 0)
+        return -EINVAL;
+
+    /* the driver may not support APP_SET_RATE here, the timer paces us anyway */
+    Kxtj3Sensor::setDelay(handle, ns);
+    return armTimer();
+}
+
+int Kxtj3PolledSensor::batch(int handle, int /* flags */, int64_t period_ns, int64_t /* timeout */)
+{
+    /* GETDATA has no history to batch from, every expiry is delivered */
+    return setDelay(handle, period_ns);
+}
+
+int Kxtj3PolledSensor::recover()
+{
+    int err = Kxtj3Sensor::recover();
+    if (err < 0)
+        return err;
+    return armTimer();
+}
+
+int Kxtj3PolledSensor::setInjectionMode(bool injecting)
+{
+    int err = Kxtj3Sensor::setInjectionMode(injecting);
+    if (err < 0)
+        return err;
+    return armTimer();
+}
+
+int Kxtj3PolledSensor::getData(int fd, const AxisTransform& transform, sensors_event_t* event)
+{
+    union {
+        char raw[RBUFF_SIZE + 1];
+        struct gsensor_axis axis;
+    } buf;
+
+    SENSOR_TRACE_SCOPE("gsensor_getdata", GSENSOR_IOCTL_GETDATA);
+    if (ioctl(fd, GSENSOR_IOCTL_GETDATA, buf.raw) < 0) {
+        LOGE("fail to perform GSENSOR_IOCTL_GETDATA, error is '%s'", strerror(errno));
+        return -errno;
+    }
+
+    const int raw[3] = { buf.axis.x, buf.axis.y, buf.axis.z };
+    transform.apply(raw, event->acceleration.v);
+    return 0;
+}
+
+int Kxtj3PolledSensor::readEvents(sensors_event_t* data, int count)
+{
+    if (count < 1)
+        return -EINVAL;
+
+    if (mInjecting)
+        return readInjected(data, count);
+
+    uint64_t expirations;
+    if (read(data_fd, &expirations, sizeof(expirations)) < 0)
+        return errno == EAGAIN ? 0 : -errno;
+    SENSOR_TRACE(FILL, mPendingEvent.sensor, expirations);
+
+    /*
+     * GETDATA only ever returns the current sample, so expirations we slept
+     * through are lost rather than filled with copies of this one.
+     */
+    if (getData(dev_fd, mTransform, &mPendingEvent) < 0)
+        return 0;
+
+    mPendingEvent.timestamp = mTimestampFilter.filter(getTimestamp());
+    AccelHistory::sAccel.push(mPendingEvent.timestamp, mPendingEvent.acceleration.v);
+    *data = mPendingEvent;
+
+    SENSOR_TRACE(DECODE, mPendingEvent.sensor, 1);
+    return 1;
+}
+
+int Kxtj3PolledSensor::readLatest(sensors_event_t* event)
+{
+    static int fd = -1;
+    static AxisTransform transform;
+    const struct board_config* cfg = board_config_get();
+    int err;
+
+    /* enable() powers the chip and counts the stream under the same lock */
+    pthread_mutex_lock(&sPowerLock);
+
+    if (fd < 0) {
+        fd = open(cfg->accel_device, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            err = -errno;
+            LOGE("couldn't open %s (%s)", cfg->accel_device, strerror(errno));
+            pthread_mutex_unlock(&sPowerLock);
+            return err;
+        }
+        int offset[3];
+        if (ioctl(fd, GSENSOR_IOCTL_GET_CALIBRATION, offset) < 0)
+            memset(offset, 0, sizeof(offset));
+        transform.set(cfg->accel_rotation, offset, GRAVITY_EARTH / cfg->accel_lsb_per_g);
+    }
+
+    /* a running stream keeps the chip powered, otherwise power it just for this read */
+    bool powered = sStreams.load() > 0;
+    if (!powered) {
+        if (ioctl(fd, GSENSOR_IOCTL_START) < 0) {
+            err = -errno;
+            LOGE("fail to perform GSENSOR_IOCTL_START, error is '%s'", strerror(errno));
+            pthread_mutex_unlock(&sPowerLock);
+            return err;
+        }
+        usleep(KXTJ3_STARTUP_US);
+    }
+
+    memset(event, 0, sizeof(*event));
+    event->version = sizeof(sensors_event_t);
+    event->sensor = ID_A;
+    event->type = SENSOR_TYPE_ACCELEROMETER;
+    event->acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
+    err = getData(fd, transform, event);
+    event->timestamp = getTimestamp();
+
+    if (!powered)
+        ioctl(fd, GSENSOR_IOCTL_CLOSE);
+
+    pthread_mutex_unlock(&sPowerLock);
+    return err;
+}
+
+int sensors_read_latest_accel(sensors_event_t* event)
+{
+    return Kxtj3PolledSensor::readLatest(event);
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_KXTJ3_POLLED_SENSOR_H
+#define ANDROID_KXTJ3_POLLED_SENSOR_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "Kxtj3Sensor.h"
+
+/*****************************************************************************/
+
+/*
+ * Kxtj3 backend for drivers that don't report through an input device:
+ * a timerfd fires at the requested rate and each expiry samples the chip
+ * with GSENSOR_IOCTL_GETDATA. The timerfd is what pollEvents() waits on.
+ */
+class Kxtj3PolledSensor : public Kxtj3Sensor {
+public:
+            Kxtj3PolledSensor();
+    virtual ~Kxtj3PolledSensor();
+
+    virtual int setDelay(int32_t handle, int64_t ns);
+    virtual int enable(int32_t handle, int enabled);
+    virtual int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
+    virtual int readEvents(sensors_event_t* data, int count);
+    virtual int recover();
+    virtual int setInjectionMode(bool injecting);
+
+    /*
+     * One current reading without a stream: powers the chip up around
+     * the read if no stream has it enabled. Safe from any thread.
+     */
+    static int readLatest(sensors_event_t* event);
+
+private:
+    int armTimer();
+    static int getData(int fd, const AxisTransform& transform, sensors_event_t* event);
+};
+
+/*****************************************************************************/
+
+__BEGIN_DECLS
+
+/* exported for one-shot consumers; returns 0 and fills *event on success */
+int sensors_read_latest_accel(sensors_event_t* event);
+
+__END_DECLS
+
+#endif  // ANDROID_KXTJ3_POLLED_SENSOR_H
@@ -22,19 +22,44 @@
 #include <dirent.h>
 #include <sys/select.h>
 #include <stdio.h>
+#include <time.h>
 #include <math.h>
 
 #include "Gsensor.h"
+#include "BoardConfig.h"
 #include "Kxtj3Sensor.h"
+#include "SensorTrace.h"
+#include "AccelHistory.h"
+#include "SensorClock.h"
+#include "SpillFifo.h"
 
 /*****************************************************************************/
 
+std::atomic<int> Kxtj3Sensor::sStreams(0);
+pthread_mutex_t Kxtj3Sensor::sPowerLock = PTHREAD_MUTEX_INITIALIZER;
+
 Kxtj3Sensor::Kxtj3Sensor()
-: SensorBase(KXTJ3_DEVICE_NAME, "gsensor"),
+: Kxtj3Sensor(board_config_get()->accel_device, board_config_get()->accel_input)
+{
+}
+
+Kxtj3Sensor::Kxtj3Sensor(const char* dev_name, const char* data_name)
+: SensorBase(dev_name, data_name),
       mEnabled(0),
-      mInputReader(32)
+      mInputReader(32),
+      mFifo(KXTJ3_FIFO_BLOCKS, KXTJ3_FIFO_BLOCK_SAMPLES),
+      mSpilling(false),
+      mBatchLatency(0),
+      mFifoOverflowed(false),
+      mNumPendingFlushes(0),
+      mInjecting(false),
+      mAsyncRead(false),
+      mDrain(false)
 {
+    mInjectFds[0] = mInjectFds[1] = -1;
+    pthread_mutex_init(&mFlushLock, NULL);
     memset(accel_offset, 0, sizeof(accel_offset));
+    memset(accel_raw, 0, sizeof(accel_raw));
 
     mPendingEvent.version = sizeof(sensors_event_t);
     mPendingEvent.sensor = ID_A;
@@ -44,9 +69,29 @@ Kxtj3Sensor::Kxtj3Sensor()
 
     mDelay = 200000000; // 200 ms by default
 
-    open_device();
+    /* stamp samples with the kernel's event time, in the same clock as getTimestamp() */
+    int clockId = CLOCK_BOOTTIME;
+    mKernelTimestamps = data_fd >= 0 && !ioctl(data_fd, EVIOCSCLOCKID, &clockId);
+    /* readEvents() may be called for batched samples with nothing to read */
+    if (data_fd >= 0)
+        fcntl(data_fd, F_SETFL, O_NONBLOCK);
+    LOGE_IF(data_name && !mKernelTimestamps, "gsensor: no kernel timestamps, using read time");
+    mWasLocked = false;
+    mTimestampFilter.reset(mDelay);
+    mSampleCount = 0;
 
-    readCalibration();
+    /* the misc device holds the calibration; without it the offset stays 0 */
+    if (dev_name) {
+        open_device();
+        readCalibration();
+    } else {
+        updateTransform();
+    }
+
+    const struct board_config* cfg = board_config_get();
+    if (cfg->accel_spill_samples)
+        mSpill.open(cfg->accel_spill_path, cfg->accel_spill_samples,
+                cfg->accel_spill_sync_ms * 1000000LL);
 }
 
 Kxtj3Sensor::~Kxtj3Sensor() {
@@ -57,6 +102,10 @@ Kxtj3Sensor::~Kxtj3Sensor() {
         close(dev_fd);
         dev_fd = -1;
     }
+    if (mInjectFds[0] >= 0) {
+        close(mInjectFds[0]);
+        close(mInjectFds[1]);
+    }
 }
 
 int Kxtj3Sensor::enable(int32_t /* handle */, int en)
@@ -64,36 +113,57 @@ int Kxtj3Sensor::enable(int32_t /* handle */, int en)
     int newState  = en ? 1 : 0;
     int err = 0;
 
-    if ((int)mEnabled != newState) {
-        if (dev_fd < 0) {
-            open_device();
-        }
+    /* the chip stays off while injected samples stand in for it */
+    if (mInjecting) {
+        mEnabled = newState;
+        return 0;
+    }
 
-        if (1 == newState) {
-            if (0 > (err = ioctl(dev_fd, GSENSOR_IOCTL_START))) {
-                LOGE("fail to perform GSENSOR_IOCTL_START, err = %d, error is '%s'", err, strerror(errno));
-                goto EXIT;
-            }
-        }
-        else {
-            if (0 > (err = ioctl(dev_fd, GSENSOR_IOCTL_CLOSE))) {
-                LOGE("fail to perform GSENSOR_IOCTL_CLOSE, err = %d, error is '%s'", err, strerror(errno));
-                goto EXIT;
-            }
-        }
+    if ((int)mEnabled != newState) {
+        /* a one-shot read mustn't power the chip down between the two */
+        pthread_mutex_lock(&sPowerLock);
+        err = setPower(newState);
+        if (err >= 0)
+            sStreams += newState ? 1 : -1;
+        pthread_mutex_unlock(&sPowerLock);
+        if (err < 0)
+            goto EXIT;
         mEnabled = newState;
+        mTimestampFilter.reset(mDelay);
+        mWasLocked = false;
     }
 
 EXIT:
     return err;
 }
 
+/* start or stop the chip through the kernel driver */
+int Kxtj3Sensor::setPower(bool on)
+{
+    int cmd = on ? GSENSOR_IOCTL_START : GSENSOR_IOCTL_CLOSE;
+
+    if (dev_fd < 0) {
+        open_device();
+    }
+
+    SENSOR_TRACE_SCOPE("gsensor_enable", cmd);
+    if (0 > ioctl(dev_fd, cmd)) {
+        int err = -errno;
+        LOGE("fail to perform %s, error is '%s'",
+                on ? "GSENSOR_IOCTL_START" : "GSENSOR_IOCTL_CLOSE", strerror(errno));
+        return err;
+    }
+    return 0;
+}
+
 int Kxtj3Sensor::setDelay(int32_t /* handle */, int64_t ns)
 {
     if (ns < 0)
         return -EINVAL;
 
     mDelay = ns;
+    mTimestampFilter.reset(mDelay);
+    mWasLocked = false;
     return update_delay();
 }
 
@@ -101,12 +171,17 @@ int Kxtj3Sensor::update_delay()
 {
     int result = 0;
 
+    /* applied when injection ends */
+    if (mInjecting)
+        return 0;
+
     if (dev_fd < 0)
         open_device();
 
     short delay = mDelay / 1000000;
     LOGI("Kxtj3Sensor update delay: %dms\n", delay);
 
+    SENSOR_TRACE_SCOPE("gsensor_set_rate", GSENSOR_IOCTL_APP_SET_RATE);
     if (0 > (result = ioctl(dev_fd, GSENSOR_IOCTL_APP_SET_RATE, &delay))) {
         LOGE("fail to perform GSENSOR_IOCTL_APP_SET_RATE, result = %d, error is '%s'", result, strerror(errno));
     }
@@ -126,55 +201,413 @@ int Kxtj3Sensor::readEvents(sensors_event_t* data, int count)
     if (count < 1)
         return -EINVAL;
 
-    ssize_t n = mInputReader.fill(data_fd);
-    if (n < 0)
+    if (mInjecting)
+        return readInjected(data, count);
+
+    ssize_t n = mAsyncRead ? 0 : mInputReader.fill(data_fd);
+    if (n < 0 && n != -EAGAIN)
         return n;
+    SENSOR_TRACE(FILL, mPendingEvent.sensor, n);
+
+    /* leftovers of a batch go out before anything newer */
+    bool batching = mBatchLatency > 0 || !heldEmpty();
 
     int numEventReceived = 0;       /* Ѿܵ event , . */
     input_event const* event;
 
-    while (count && mInputReader.readEvent(&event)) {
-        int type = event->type;
-        if (type == EV_ABS) {
-            processEvent(event->code, event->value);
-        } else if (type == EV_SYN) {
-            mPendingEvent.timestamp = getTimestamp();
-            *data++ = mPendingEvent;
-            count--;
-            numEventReceived++;
-        } else {
-            LOGE("Kxtj3Sensor: unknown event (type=%d, code=%d)",
-                    type, event->code);
+    for (;;) {
+        while ((batching || count) && mInputReader.readEvent(&event)) {
+            int type = event->type;
+            if (type == EV_ABS) {
+                processEvent(event->code, event->value);
+            } else if (type == EV_SYN) {
+                /* kernel time doesn't follow a simulated clock */
+                int64_t raw = mKernelTimestamps && !SensorClock::get()->isVirtual() ?
+                        timevalToNano(event->time) : getTimestamp();
+                mPendingEvent.timestamp = mTimestampFilter.filter(raw);
+                if (!mWasLocked && mTimestampFilter.isLocked()) {
+                    LOGI("gsensor measured period %lld ns (requested %lld ns)",
+                            (long long)mTimestampFilter.getPeriod(), (long long)mDelay);
+                    mWasLocked = true;
+                }
+                if (emitSample(mPendingEvent.timestamp, batching, data)) {
+                    data++;
+                    count--;
+                    numEventReceived++;
+                }
+            } else {
+                LOGE("Kxtj3Sensor: unknown event (type=%d, code=%d)",
+                        type, event->code);
+            }
+            mInputReader.next();
         }
-        mInputReader.next();
+
+        /* the reader ran dry with room left: the kernel may hold more */
+        if (!mDrain || mAsyncRead || n <= 0 || !(batching || count))
+            break;
+        n = mInputReader.fill(data_fd);
+        SENSOR_TRACE(FILL, mPendingEvent.sensor, n);
     }
 
+    if (batchDue())
+        numEventReceived += drainFifo(data, count);
+
+    SENSOR_TRACE(DECODE, mPendingEvent.sensor, numEventReceived);
     return numEventReceived;
 }
 
+/*
+ * One complete sample in accel_raw: held back in the FIFO while batching,
+ * otherwise converted into *data. Returns true when *data was written.
+ */
+bool Kxtj3Sensor::emitSample(int64_t timestamp, bool batching, sensors_event_t* data)
+{
+    mPendingEvent.timestamp = timestamp;
+    mTransform.apply(accel_raw, mPendingEvent.acceleration.v);
+    /* timestamp queries see the sample now, even when it is batched */
+    AccelHistory::sAccel.push(timestamp, mPendingEvent.acceleration.v);
+    mSampleCount++;
+    if (batching) {
+        bool kept = mSpilling ? mSpill.push(timestamp, accel_raw) : mFifo.push(timestamp, accel_raw);
+        if (!kept && !mFifoOverflowed) {
+            LOGW("gsensor batch FIFO full, dropping the oldest samples");
+            mFifoOverflowed = true;
+        }
+        return false;
+    }
+    *data = mPendingEvent;
+    return true;
+}
+
+/*
+ * Injected events are turned back into chip counts, so they are quantized,
+ * saturated, batched and converted exactly like samples from the chip.
+ * Their timestamps are kept as given; 0 means now.
+ */
+int Kxtj3Sensor::readInjected(sensors_event_t* data, int count)
+{
+    static const int chunk = 16;
+    sensors_event_t in[chunk];
+    bool batching = mBatchLatency > 0 || !heldEmpty();
+    int numEventReceived = 0;
+
+    while (batching || count) {
+        int want = batching || count > chunk ? chunk : count;
+        ssize_t n = read(mInjectFds[0], in, want * sizeof(sensors_event_t));
+        if (n <= 0) {
+            LOGE_IF(n < 0 && errno != EAGAIN, "error reading injected events (%s)", strerror(errno));
+            break;
+        }
+        n /= sizeof(sensors_event_t);
+        SENSOR_TRACE(FILL, mPendingEvent.sensor, n);
+
+        for (int i = 0; i < n; i++) {
+            mTransform.invert(in[i].acceleration.v, accel_raw);
+            int64_t timestamp = in[i].timestamp ? in[i].timestamp : getTimestamp();
+            if (emitSample(timestamp, batching, data)) {
+                data++;
+                count--;
+                numEventReceived++;
+            }
+        }
+    }
+
+    if (batchDue())
+        numEventReceived += drainFifo(data, count);
+
+    SENSOR_TRACE(DECODE, mPendingEvent.sensor, numEventReceived);
+    return numEventReceived;
+}
+
+/*
+ * Deliver the batch once the oldest sample has waited out the latency,
+ * before the FIFO would start dropping, or when a flush asks for it.
+ * Nothing goes out while the stream is off: what the spill file kept
+ * from before a restart waits for the stream to be enabled again.
+ */
+bool Kxtj3Sensor::batchDue() const
+{
+    if (mNumPendingFlushes)
+        return true;
+    if (!mEnabled || heldEmpty())
+        return false;
+    if (!mBatchLatency || mFifo.size() > mFifo.capacity() - KXTJ3_FIFO_BLOCK_SAMPLES ||
+            mSpill.nearlyFull())
+        return true;
+
+    int64_t oldest;
+    int raw[3];
+    frontHeld(&oldest, raw);
+    return getTimestamp() - oldest >= mBatchLatency;
+}
+
+/*
+ * Oldest held sample. Each store is in order, and one that was filled
+ * before a latency change moved the batch over is older than the other;
+ * returns true when it comes from the spill file.
+ */
+bool Kxtj3Sensor::frontHeld(int64_t* timestamp, int raw[3]) const
+{
+    if (mSpill.empty()) {
+        mFifo.front(timestamp, raw);
+        return false;
+    }
+    mSpill.front(timestamp, raw);
+    if (mFifo.empty())
+        return true;
+
+    int64_t t;
+    int r[3];
+    mFifo.front(&t, r);
+    if (*timestamp <= t)
+        return true;
+    *timestamp = t;
+    memcpy(raw, r, sizeof(r));
+    return false;
+}
+
+/* the filter's period is only the requested one until it locks */
+int64_t Kxtj3Sensor::getMeasuredPeriod() const
+{
+    return mEnabled && mTimestampFilter.isLocked() ? mTimestampFilter.getPeriod() : 0;
+}
+
+bool Kxtj3Sensor::hasPendingEvents() const
+{
+    return batchDue();
+}
+
+int Kxtj3Sensor::drainFifo(sensors_event_t* data, int count)
+{
+    int n = 0;
+    int raw[3];
+
+    while (n < count && !heldEmpty()) {
+        sensors_event_t& ev = data[n++];
+        ev = mPendingEvent;
+        if (frontHeld(&ev.timestamp, raw))
+            mSpill.pop();
+        else
+            mFifo.pop();
+        mTransform.apply(raw, ev.acceleration.v);
+    }
+    if (!heldEmpty())
+        return n;
+    mFifoOverflowed = false;
+
+    /* everything requested before the flush is out, now report it complete */
+    pthread_mutex_lock(&mFlushLock);
+    int done = 0;
+    while (n < count && done < mNumPendingFlushes) {
+        sensors_event_t& ev = data[n++];
+        memset(&ev, 0, sizeof(ev));
+        ev.version = META_DATA_VERSION;
+        ev.type = SENSOR_TYPE_META_DATA;
+        ev.meta_data.what = META_DATA_FLUSH_COMPLETE;
+        ev.meta_data.sensor = mPendingFlushes[done++];
+    }
+    mNumPendingFlushes -= done;
+    memmove(mPendingFlushes, mPendingFlushes + done, mNumPendingFlushes * sizeof(int));
+    pthread_mutex_unlock(&mFlushLock);
+
+    SENSOR_TRACE(FLUSH_DELIVERED, mPendingEvent.sensor, done);
+    return n;
+}
+
+int Kxtj3Sensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
+{
+    /* a latency longer than the FIFO holds is cut short by the watermark */
+    mBatchLatency = timeout > 0 ? timeout : 0;
+    int err = setDelay(handle, period_ns);
+
+    /* past what the RAM FIFO holds at this rate, batch into the spill file */
+    bool spilling = mSpill.isOpen() && mBatchLatency > mDelay * mFifo.capacity();
+    if (spilling != mSpilling)
+        LOGI("gsensor batch of %lld ms %s the spill file", (long long)(mBatchLatency / 1000000),
+                spilling ? "goes to" : "leaves");
+    mSpilling = spilling;
+    return err;
+}
+
+int Kxtj3Sensor::flush(int handle)
+{
+    /* nothing held back: the generic flush-complete path is exact */
+    if (!mBatchLatency && heldEmpty())
+        return -ENOSYS;
+
+    pthread_mutex_lock(&mFlushLock);
+    int err = 0;
+    if (mNumPendingFlushes < maxPendingFlushes)
+        mPendingFlushes[mNumPendingFlushes++] = handle;
+    else
+        err = -EBUSY;
+    pthread_mutex_unlock(&mFlushLock);
+    return err;
+}
+
+ssize_t Kxtj3Sensor::prepareRead(void** buffer)
+{
+    /* the polled backend and the injection queue aren't input devices */
+    if (!data_name || mInjecting || data_fd < 0)
+        return -ENOSYS;
+    mAsyncRead = true;
+    return mInputReader.prepareFill(buffer);
+}
+
+void Kxtj3Sensor::completeRead(ssize_t result)
+{
+    ssize_t n = mInputReader.commitFill(result);
+    LOGE_IF(n < 0 && n != -EAGAIN && n != -ECANCELED, "gsensor read failed (%s)", strerror(-n));
+}
+
+int Kxtj3Sensor::getFd() const
+{
+    return mInjecting ? mInjectFds[0] : data_fd;
+}
+
+int Kxtj3Sensor::setInjectionMode(bool injecting)
+{
+    int err;
+
+    if (injecting == mInjecting)
+        return 0;
+
+    if (injecting && mInjectFds[0] < 0) {
+        if (pipe2(mInjectFds, O_CLOEXEC) < 0) {
+            err = -errno;
+            LOGE("error creating gsensor injection queue (%s)", strerror(errno));
+            mInjectFds[0] = mInjectFds[1] = -1;
+            return err;
+        }
+        fcntl(mInjectFds[0], F_SETFL, O_NONBLOCK);
+        /* room for bursts far above the chip's fastest rate */
+        fcntl(mInjectFds[1], F_SETPIPE_SZ, KXTJ3_INJECT_QUEUE_BYTES);
+    }
+
+    /* hand the chip over: off while injecting, back at the current rate after */
+    if (mEnabled) {
+        pthread_mutex_lock(&sPowerLock);
+        err = setPower(!injecting);
+        if (err >= 0)
+            sStreams += injecting ? -1 : 1;
+        pthread_mutex_unlock(&sPowerLock);
+        if (err < 0) {
+            LOGE("fail to switch gsensor for injection");
+            return err;
+        }
+    }
+
+    mInjecting = injecting;
+    if (!injecting) {
+        sensors_event_t buf[16];
+        while (read(mInjectFds[0], buf, sizeof(buf)) > 0)
+            ;
+        if (mEnabled)
+            update_delay();
+    }
+
+    /* samples already in the FIFO still go out, in timestamp order */
+    mTimestampFilter.reset(mDelay);
+    mWasLocked = false;
+
+    LOGI("gsensor data injection %s", injecting ? "on" : "off");
+    return 0;
+}
+
+int Kxtj3Sensor::inject(const sensors_event_t* event)
+{
+    if (!mInjecting)
+        return -EPERM;
+    if (event->type != SENSOR_TYPE_ACCELEROMETER)
+        return -EINVAL;
+    /* like the chip, a disabled sensor produces nothing */
+    if (!mEnabled)
+        return 0;
+
+    /*
+     * One event per write stays atomic. A full queue blocks the caller,
+     * which paces a replay to what the HAL actually sustains.
+     */
+    if (write(mInjectFds[1], event, sizeof(*event)) < 0) {
+        int err = -errno;
+        LOGE("error queueing injected event (%s)", strerror(errno));
+        return err;
+    }
+    return 0;
+}
+
+/*
+ * Bring a stalled chip back: fresh handles on both devices, then the same
+ * ioctl sequence as a normal start at the current rate.
+ */
+int Kxtj3Sensor::recover()
+{
+    int err = 0;
+
+    LOGW("gsensor stalled, restarting at %lld ns", (long long)mDelay);
+    SENSOR_TRACE_SCOPE("gsensor_recover", GSENSOR_IOCTL_START);
+
+    if (data_name) {
+        err = reopenInput();
+        if (err < 0)
+            return err;
+        int clockId = CLOCK_BOOTTIME;
+        mKernelTimestamps = !ioctl(data_fd, EVIOCSCLOCKID, &clockId);
+        fcntl(data_fd, F_SETFL, O_NONBLOCK);
+    }
+
+    close_device();
+    err = open_device();
+    if (err < 0)
+        return err;
+
+    ioctl(dev_fd, GSENSOR_IOCTL_CLOSE);
+    if (ioctl(dev_fd, GSENSOR_IOCTL_START) < 0) {
+        err = -errno;
+        LOGE("fail to perform GSENSOR_IOCTL_START, error is '%s'", strerror(errno));
+        return err;
+    }
+    update_delay();
+
+    mTimestampFilter.reset(mDelay);
+    mWasLocked = false;
+    return 0;
+}
+
 void Kxtj3Sensor::processEvent(int code, int value)
 {
     switch (code) {
+        /* chip axes; converted to the device frame once the sample is complete */
         case EVENT_TYPE_ACCEL_X:
-            mPendingEvent.acceleration.x = (value - accel_offset[0]) * ACCELERATION_RATIO_ANDROID_TO_HW;
+            accel_raw[0] = value;
             break;
         case EVENT_TYPE_ACCEL_Y:
-            mPendingEvent.acceleration.y = (value - accel_offset[1]) * ACCELERATION_RATIO_ANDROID_TO_HW;
+            accel_raw[1] = value;
             break;
         case EVENT_TYPE_ACCEL_Z:
-            mPendingEvent.acceleration.z = (value - accel_offset[2]) * ACCELERATION_RATIO_ANDROID_TO_HW;
+            accel_raw[2] = value;
             break;
     }
 }
 
+void Kxtj3Sensor::updateTransform()
+{
+    const struct board_config* cfg = board_config_get();
+    mTransform.set(cfg->accel_rotation, accel_offset, GRAVITY_EARTH / cfg->accel_lsb_per_g);
+}
+
 void Kxtj3Sensor::readCalibration()
 {
     if (dev_fd < 0)
         open_device();
 
+    SENSOR_TRACE_SCOPE("gsensor_get_calibration", GSENSOR_IOCTL_GET_CALIBRATION);
     int result = ioctl(dev_fd, GSENSOR_IOCTL_GET_CALIBRATION, &accel_offset);
-    if (result < 0)
+    if (result < 0) {
         LOGE("fail to perform GSENSOR_IOCTL_GET_CALIBRATION, result = %d, error is '%s'", result, strerror(errno));
-    else
+        memset(accel_offset, 0, sizeof(accel_offset));
+    } else {
         LOGI("gsensor calibration is %d, %d, %d\n", accel_offset[0], accel_offset[1], accel_offset[2]);
+    }
+    updateTransform();
 }
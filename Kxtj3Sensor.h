@@ -21,11 +21,17 @@
 #include <errno.h>
 #include <sys/cdefs.h>
 #include <sys/types.h>
+#include <pthread.h>
 
+#include <atomic>
 
 #include "nusensors.h"
 #include "SensorBase.h"
 #include "InputEventReader.h"
+#include "TimestampFilter.h"
+#include "AxisTransform.h"
+#include "CompactFifo.h"
+#include "SpillFifo.h"
 
 /*****************************************************************************/
 
@@ -36,20 +42,82 @@ public:
             Kxtj3Sensor();
     virtual ~Kxtj3Sensor();
 
+    /* number of enabled gsensor streams in this process, for one-shot reads */
+    static std::atomic<int> sStreams;
+    /* held around chip power changes together with the sStreams update */
+    static pthread_mutex_t sPowerLock;
+
     virtual int setDelay(int32_t handle, int64_t ns);
     virtual int enable(int32_t handle, int enabled);
     virtual int isActivated(int handle);
     virtual int readEvents(sensors_event_t* data, int count);
+    virtual bool hasPendingEvents() const;
+    virtual int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
+    virtual int flush(int handle);
+    virtual int64_t getStreamPeriod() const { return mEnabled && !mInjecting ? mDelay : 0; }
+    virtual int recover();
+    virtual uint64_t getSampleCount() const { return mSampleCount; }
+    virtual int getFd() const;
+    virtual int setInjectionMode(bool injecting);
+    virtual int inject(const sensors_event_t* event);
+    virtual ssize_t prepareRead(void** buffer);
+    virtual void completeRead(ssize_t result);
+    virtual void cancelRead() { mAsyncRead = false; }
+    virtual void setDrain(bool drain) { mDrain = drain; }
+    virtual int64_t getMeasuredPeriod() const;
     void processEvent(int code, int value);
 
-private:
-    int update_delay();
+protected:
+    /*
+     * dev_name NULL: the backend doesn't use the misc device, e.g. it
+     * drives the chip itself; data_name NULL: it doesn't read an input device
+     */
+            Kxtj3Sensor(const char* dev_name, const char* data_name);
+
+    static const int maxPendingFlushes = 8;
+
+    /* chip power and output rate; the kernel driver's ioctls by default */
+    virtual int setPower(bool on);
+    virtual int update_delay();
+    bool batchDue() const;
+    int drainFifo(sensors_event_t* data, int count);
+    bool emitSample(int64_t timestamp, bool batching, sensors_event_t* data);
+    bool heldEmpty() const { return mFifo.empty() && mSpill.empty(); }
+    bool frontHeld(int64_t* timestamp, int raw[3]) const;
+    int readInjected(sensors_event_t* data, int count);
     void readCalibration();
+    void updateTransform();
     uint32_t mEnabled;
     InputEventCircularReader mInputReader;
     sensors_event_t mPendingEvent;
     int64_t mDelay;
     int accel_offset[3];
+    int accel_raw[3];
+    AxisTransform mTransform;
+    bool mKernelTimestamps;
+    bool mWasLocked;
+    TimestampFilter mTimestampFilter;
+    uint64_t mSampleCount;
+
+    /* samples held back for the batch latency, raw until delivery */
+    CompactFifo mFifo;
+    /* where the samples go instead when the latency outlasts mFifo */
+    SpillFifo mSpill;
+    bool mSpilling;
+    int64_t mBatchLatency;
+    bool mFifoOverflowed;
+    pthread_mutex_t mFlushLock;
+    int mPendingFlushes[maxPendingFlushes];
+    int mNumPendingFlushes;
+
+    /* injected events queue here; the read end stands in for data_fd */
+    std::atomic<bool> mInjecting;
+    int mInjectFds[2];
+
+    /* the I/O engine has a read queued for us, readEvents() doesn't read */
+    bool mAsyncRead;
+    /* refill the input reader while readEvents() has room; set from another thread */
+    std::atomic<bool> mDrain;
 };
 
 /*****************************************************************************/
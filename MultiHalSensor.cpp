@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "BoardConfig.h"
+#include "MultiHalSensor.h"
+
+/*****************************************************************************/
+
+/* events per write, small enough for the write to stay atomic */
+#define SUBHAL_POLL_EVENTS  (PIPE_BUF / sizeof(sensors_event_t))
+
+struct SubHal {
+    const char* path;
+    sensors_module_t* module;
+    sensors_poll_device_1_t* device;
+    int base;                   // added to the sub-HAL's own handles
+    const struct sensor_t* list;
+    int count;
+    bool* enabled;
+    pthread_t thread;
+};
+
+static SubHal sSubHals[BOARD_CONFIG_MAX_SUBHAL];
+static int sNumSubHals;
+static struct sensor_t* sSubHalList;
+static int sSubHalListCount;
+static int sQueue[2] = { -1, -1 };
+static pthread_once_t sLoadOnce = PTHREAD_ONCE_INIT;
+static pthread_once_t sOpenOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t sLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void loadSubHals()
+{
+    const struct board_config* cfg = board_config_get();
+    int total = 0;
+
+    for (int i = 0; i < cfg->subhal_count; i++) {
+        const char* path = cfg->subhal[i];
+        void* dso = dlopen(path, RTLD_NOW);
+        if (!dso) {
+            LOGE("couldn't load sub-HAL %s (%s)", path, dlerror());
+            continue;
+        }
+        sensors_module_t* module = (sensors_module_t*)dlsym(dso, HAL_MODULE_INFO_SYM_AS_STR);
+        if (!module) {
+            LOGE("sub-HAL %s has no %s", path, HAL_MODULE_INFO_SYM_AS_STR);
+            dlclose(dso);
+            continue;
+        }
+        module->common.dso = dso;
+
+        SubHal& hal = sSubHals[sNumSubHals];
+        hal.path = path;
+        hal.module = module;
+        hal.device = NULL;
+        hal.base = (sNumSubHals + 1) << SUBHAL_HANDLE_SHIFT;
+        hal.count = module->get_sensors_list(module, &hal.list);
+        if (hal.count < 0)
+            hal.count = 0;
+        hal.enabled = new bool[hal.count + 1]();
+        total += hal.count;
+        sNumSubHals++;
+        LOGI("sub-HAL %s: %d sensors at handle 0x%x", path, hal.count, hal.base);
+    }
+
+    sSubHalList = new sensor_t[total + 1];
+    for (int i = 0; i < sNumSubHals; i++) {
+        for (int j = 0; j < sSubHals[i].count; j++) {
+            const struct sensor_t& s = sSubHals[i].list[j];
+            if (s.handle >> SUBHAL_HANDLE_SHIFT) {
+                LOGE("sub-HAL %s: handle 0x%x out of range, skipped", sSubHals[i].path, s.handle);
+                continue;
+            }
+            sSubHalList[sSubHalListCount] = s;
+            sSubHalList[sSubHalListCount].handle |= sSubHals[i].base;
+            sSubHalListCount++;
+        }
+    }
+}
+
+static void* subHalThread(void* arg)
+{
+    SubHal* hal = (SubHal*)arg;
+    sensors_event_t buf[SUBHAL_POLL_EVENTS];
+
+    for (;;) {
+        int n = hal->device->poll(&hal->device->v0, buf, SUBHAL_POLL_EVENTS);
+        if (n < 0) {
+            LOGE("sub-HAL %s poll failed (%s)", hal->path, strerror(-n));
+            usleep(100000);
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            if (buf[i].type == SENSOR_TYPE_META_DATA)
+                buf[i].meta_data.sensor |= hal->base;
+            else
+                buf[i].sensor |= hal->base;
+        }
+        /* blocking: a sub-HAL we can't keep up with waits here, not in pollEvents() */
+        if (n > 0 && write(sQueue[1], buf, n * sizeof(sensors_event_t)) < 0)
+            LOGE("sub-HAL %s: error queueing events (%s)", hal->path, strerror(errno));
+    }
+    return NULL;
+}
+
+static void openSubHals()
+{
+    pthread_once(&sLoadOnce, loadSubHals);
+
+    int opened = 0;
+    for (int i = 0; i < sNumSubHals; i++) {
+        SubHal& hal = sSubHals[i];
+        int err = hal.module->common.methods->open(&hal.module->common,
+                SENSORS_HARDWARE_POLL, (hw_device_t**)&hal.device);
+        if (err || !hal.device) {
+            LOGE("couldn't open sub-HAL %s (%d)", hal.path, err);
+            hal.device = NULL;
+            continue;
+        }
+        opened++;
+    }
+    if (!opened)
+        return;
+
+    if (pipe(sQueue) < 0) {
+        LOGE("error creating sub-HAL queue (%s)", strerror(errno));
+        return;
+    }
+    fcntl(sQueue[0], F_SETFL, O_NONBLOCK);
+    fcntl(sQueue[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sQueue[1], F_SETFD, FD_CLOEXEC);
+
+    for (int i = 0; i < sNumSubHals; i++) {
+        SubHal& hal = sSubHals[i];
+        if (!hal.device)
+            continue;
+        int err = pthread_create(&hal.thread, NULL, subHalThread, &hal);
+        LOGE_IF(err, "couldn't start sub-HAL %s thread (%s)", hal.path, strerror(err));
+    }
+}
+
+/* the open sub-HAL behind a remapped handle, and the handle it knows */
+static SubHal* findSubHal(int handle, int* local, int* index)
+{
+    int n = (handle >> SUBHAL_HANDLE_SHIFT) - 1;
+    if (n < 0 || n >= sNumSubHals || !sSubHals[n].device)
+        return NULL;
+
+    SubHal* hal = &sSubHals[n];
+    *local = handle & ((1 << SUBHAL_HANDLE_SHIFT) - 1);
+    for (int i = 0; i < hal->count; i++) {
+        if (hal->list[i].handle == *local) {
+            *index = i;
+            return hal;
+        }
+    }
+    return NULL;
+}
+
+int multihal_get_sensors_list(struct sensor_t const** list)
+{
+    pthread_once(&sLoadOnce, loadSubHals);
+    *list = sSubHalList;
+    return sSubHalListCount;
+}
+
+/*****************************************************************************/
+
+MultiHalSensor::MultiHalSensor()
+    : SensorBase(NULL, NULL)
+{
+    pthread_once(&sOpenOnce, openSubHals);
+    data_fd = sQueue[0];
+}
+
+MultiHalSensor::~MultiHalSensor()
+{
+    /* the queue outlives us, don't let SensorBase close it */
+    data_fd = -1;
+}
+
+int MultiHalSensor::readEvents(sensors_event_t* data, int count)
+{
+    if (count < 1)
+        return -EINVAL;
+
+    /* writers queue whole events atomically, so reads never split one */
+    ssize_t n = read(data_fd, data, count * sizeof(sensors_event_t));
+    if (n < 0)
+        return errno == EAGAIN ? 0 : -errno;
+    return n / sizeof(sensors_event_t);
+}
+
+int MultiHalSensor::enable(int32_t handle, int en)
+{
+    int local, index;
+    SubHal* hal = findSubHal(handle, &local, &index);
+    if (!hal)
+        return -EINVAL;
+
+    pthread_mutex_lock(&sLock);
+    int err = hal->device->activate(&hal->device->v0, local, en);
+    if (!err)
+        hal->enabled[index] = en != 0;
+    pthread_mutex_unlock(&sLock);
+    return err;
+}
+
+int MultiHalSensor::setDelay(int32_t handle, int64_t ns)
+{
+    return batch(handle, 0, ns, 0);
+}
+
+int MultiHalSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
+{
+    int local, index;
+    SubHal* hal = findSubHal(handle, &local, &index);
+    if (!hal)
+        return -EINVAL;
+
+    sensors_poll_device_1_t* dev = hal->device;
+    if (dev->common.version >= SENSORS_DEVICE_API_VERSION_1_0 && dev->batch)
+        return dev->batch(dev, local, flags, period_ns, timeout);
+    return dev->setDelay(&dev->v0, local, period_ns);
+}
+
+int MultiHalSensor::flush(int handle)
+{
+    int local, index;
+    SubHal* hal = findSubHal(handle, &local, &index);
+    if (!hal)
+        return -EINVAL;
+
+    sensors_poll_device_1_t* dev = hal->device;
+    if (dev->common.version < SENSORS_DEVICE_API_VERSION_1_1 || !dev->flush)
+        return -ENOSYS;
+    return dev->flush(dev, local);
+}
+
+int MultiHalSensor::isActivated(int handle)
+{
+    int local, index;
+    SubHal* hal = findSubHal(handle, &local, &index);
+    if (!hal)
+        return 0;
+
+    pthread_mutex_lock(&sLock);
+    int enabled = hal->enabled[index];
+    pthread_mutex_unlock(&sLock);
+    return enabled;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_MULTI_HAL_SENSOR_H
+#define ANDROID_MULTI_HAL_SENSOR_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "nusensors.h"
+#include "SensorBase.h"
+
+/*****************************************************************************/
+
+/*
+ * The sensors modules listed as "subhal" in the board config, presented
+ * as one more driver. Each sub-HAL device is polled by its own thread,
+ * which remaps the handles and writes the events into a shared pipe;
+ * data_fd is the read end, so a slow sub-HAL only ever blocks its own
+ * thread. The modules, devices and threads live for the whole process
+ * and are shared by every MultiHalSensor.
+ */
+class MultiHalSensor final : public SensorBase {
+public:
+            MultiHalSensor();
+    virtual ~MultiHalSensor();
+
+    /* false when no sub-HAL could be opened */
+    bool isValid() const { return data_fd >= 0; }
+
+    virtual int readEvents(sensors_event_t* data, int count);
+    virtual int setDelay(int32_t handle, int64_t ns);
+    virtual int enable(int32_t handle, int enabled);
+    virtual int isActivated(int handle);
+
+    virtual int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
+    /* -ENOSYS when the sub-HAL predates flush, the caller then reports it */
+    virtual int flush(int handle);
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_MULTI_HAL_SENSOR_H
@@ -21,11 +21,11 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/select.h>
-#include <utils/SystemClock.h>
 
 #include <linux/input.h>
 
 #include "SensorBase.h"
+#include "SensorClock.h"
 
 //#define ENABLE_DEBUG_LOG
 #include "custom_log.h"
@@ -38,7 +38,9 @@ SensorBase::SensorBase(
     : dev_name(dev_name), data_name(data_name),
       dev_fd(-1), data_fd(-1)
 {
-    data_fd = openInput(data_name);
+    /* backends that don't report through an input device pass NULL */
+    if (data_name)
+        data_fd = openInput(data_name);
 }
 
 SensorBase::~SensorBase() {
@@ -84,13 +86,8 @@ bool SensorBase::hasPendingEvents() const {
 }
 
 int64_t SensorBase::getTimestamp() {
-/*
-    struct timespec t;
-    t.tv_sec = t.tv_nsec = 0;
-    clock_gettime(CLOCK_MONOTONIC, &t);
-    return int64_t(t.tv_sec)*1000000000LL + t.tv_nsec;
-*/
-    return android::elapsedRealtimeNano();
+    /* elapsedRealtimeNano(), unless a simulation replaced the clock */
+    return SensorClock::get()->boottime();
 }
 
 struct input_dev {
@@ -98,12 +95,14 @@ struct input_dev {
     char name[80];
 };
 
+/* input devices opened by name, shared by every sensor in the process */
+static struct input_dev sInputDev[255];
+
 static int getInput(const char *inputName)
 {
     int fd = -1;
     unsigned i;
     static bool first = true;
-    static struct input_dev dev[255];
 
     if (first) {
         int fd = -1;
@@ -114,9 +113,9 @@ static int getInput(const char *inputName)
         struct dirent *de;
 
         first = false;
-        for (i = 0; i < sizeof(dev)/sizeof(dev[0]); i++) {
-            dev[i].fd = -1;
-            dev[i].name[0] = '\0';
+        for (i = 0; i < sizeof(sInputDev)/sizeof(sInputDev[0]); i++) {
+            sInputDev[i].fd = -1;
+            sInputDev[i].name[0] = '\0';
         }
         i = 0;
 
@@ -135,8 +134,8 @@ static int getInput(const char *inputName)
             if (fd >= 0) {
                 char name[80];
                 if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), &name) >= 1) {
-                    dev[i].fd = fd;
-                    strncpy(dev[i].name, name, sizeof(dev[i].name));
+                    sInputDev[i].fd = fd;
+                    strncpy(sInputDev[i].name, name, sizeof(sInputDev[i].name));
                 }
             }
             i++;
@@ -144,9 +143,9 @@ static int getInput(const char *inputName)
         closedir(dir);
     }
 
-    for (i = 0; i < sizeof(dev)/sizeof(dev[0]); i++) {
-        if (!strncmp(inputName, dev[i].name, sizeof(dev[i].name))) {
-            fd = dev[i].fd;
+    for (i = 0; i < sizeof(sInputDev)/sizeof(sInputDev[0]); i++) {
+        if (!strncmp(inputName, sInputDev[i].name, sizeof(sInputDev[i].name))) {
+            fd = sInputDev[i].fd;
             break;
         }
     }
@@ -155,6 +154,109 @@ static int getInput(const char *inputName)
     return fd;
 }
 
+/*
+ * Replace data_fd with a fresh handle on the same input device, for a
+ * stream that stopped delivering events. The device is looked up again
+ * since it may have been re-registered under another node.
+ */
+int SensorBase::reopenInput()
+{
+    const char *dirname = "/dev/input";
+    char devname[PATH_MAX];
+    char *filename;
+    DIR *dir;
+    struct dirent *de;
+    int fd = -1;
+
+    if (!data_name)
+        return -EINVAL;
+
+    dir = opendir(dirname);
+    if (dir == NULL)
+        return -errno;
+    strcpy(devname, dirname);
+    filename = devname + strlen(devname);
+    *filename++ = '/';
+    while ((de = readdir(dir))) {
+        if (de->d_name[0] == '.')
+            continue;
+        strcpy(filename, de->d_name);
+        fd = open(devname, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            char name[80];
+            if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), &name) < 1)
+                name[0] = '\0';
+            if (!strcmp(name, data_name))
+                break;
+            close(fd);
+            fd = -1;
+        }
+    }
+    closedir(dir);
+    if (fd < 0) {
+        LOGE("couldn't reopen '%s' input device", data_name);
+        return -ENODEV;
+    }
+
+    for (unsigned i = 0; i < sizeof(sInputDev)/sizeof(sInputDev[0]); i++) {
+        if (data_fd >= 0 && sInputDev[i].fd == data_fd)
+            sInputDev[i].fd = fd;
+    }
+    if (data_fd >= 0)
+        close(data_fd);
+    data_fd = fd;
+    return 0;
+}
+
+int SensorBase::batch(int handle, int flags, int64_t period_ns, int64_t timeout) {
+    return setDelay(handle, period_ns);
+}
+
+int SensorBase::flush(int handle) {
+    return -ENOSYS;
+}
+
+int SensorBase::recover() {
+    return -ENOSYS;
+}
+
+uint64_t SensorBase::getSampleCount() const {
+    return 0;
+}
+
+int SensorBase::setInjectionMode(bool injecting) {
+    return -ENOSYS;
+}
+
+int SensorBase::inject(const sensors_event_t* event) {
+    return -ENOSYS;
+}
+
+ssize_t SensorBase::prepareRead(void** buffer) {
+    return -ENOSYS;
+}
+
+void SensorBase::completeRead(ssize_t result) {
+}
+
+void SensorBase::cancelRead() {
+}
+
+void SensorBase::setDrain(bool drain) {
+}
+
+int64_t SensorBase::getWakeupDeadline() const {
+    return 0;
+}
+
+int64_t SensorBase::getStreamPeriod() const {
+    return 0;
+}
+
+int64_t SensorBase::getMeasuredPeriod() const {
+    return 0;
+}
+
 int SensorBase::openInput(const char* inputName) {
     int fd = -1;
     const char *dirname = "/dev/input";
@@ -47,6 +47,7 @@ protected:
 
     int open_device();
     int close_device();
+    int reopenInput();
 
 public:
             SensorBase(
@@ -61,6 +62,54 @@ public:
     virtual int setDelay(int32_t handle, int64_t ns);
     virtual int enable(int32_t handle, int enabled) = 0;
     virtual int isActivated(int handle);
+
+    /* default: no batching in the driver, the latency is ignored */
+    virtual int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
+    /* -ENOSYS: nothing buffered, the caller reports flush completion itself */
+    virtual int flush(int handle);
+
+    /* expected sample period while streaming, 0 when idle or not periodic */
+    virtual int64_t getStreamPeriod() const;
+    /* period measured from the sample timestamps, 0 until known or when not measured */
+    virtual int64_t getMeasuredPeriod() const;
+    /* called by the stall watchdog; may replace the fd returned by getFd() */
+    virtual int recover();
+    /*
+     * Samples taken from the device so far, including those held back for
+     * a batch; the stall watchdog sees the driver alive while this moves,
+     * even when readEvents() returns nothing. 0 when not counted.
+     */
+    virtual uint64_t getSampleCount() const;
+
+    /*
+     * Data injection: while on, the hardware is left alone and samples
+     * handed to inject() take its place. -ENOSYS when not supported.
+     */
+    virtual int setInjectionMode(bool injecting);
+    virtual int inject(const sensors_event_t* event);
+
+    /*
+     * Reads of getFd() issued by an I/O engine: prepareRead() gives the
+     * buffer and its size (0 while full, -ENOSYS when the driver reads
+     * for itself), completeRead() the result. Once a driver has handed
+     * out a buffer, readEvents() only decodes what was completed, until
+     * cancelRead() says the engine couldn't queue the read after all.
+     */
+    virtual ssize_t prepareRead(void** buffer);
+    virtual void completeRead(ssize_t result);
+    virtual void cancelRead();
+
+    /*
+     * Drain mode: readEvents() keeps reading the device until count is
+     * used up or nothing is left, instead of reading it once.
+     */
+    virtual void setDrain(bool drain);
+
+    /*
+     * CLOCK_BOOTTIME by which readEvents() has to run to hand over the
+     * wake-up events the driver holds, even from suspend. 0 for none.
+     */
+    virtual int64_t getWakeupDeadline() const;
 };
 
 /*****************************************************************************/
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <time.h>
+
+#include "SensorClock.h"
+
+/*****************************************************************************/
+
+static RealClock sRealClock;
+std::atomic<SensorClock*> SensorClock::sClock(NULL);
+
+SensorClock* SensorClock::get()
+{
+    SensorClock* clock = sClock.load(std::memory_order_acquire);
+    return clock ? clock : &sRealClock;
+}
+
+void SensorClock::set(SensorClock* clock)
+{
+    sClock.store(clock, std::memory_order_release);
+}
+
+static inline int64_t read_clock(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int64_t RealClock::boottime() const
+{
+    return read_clock(CLOCK_BOOTTIME);
+}
+
+int64_t RealClock::uptime() const
+{
+    return read_clock(CLOCK_MONOTONIC);
+}
+
+/*****************************************************************************/
+
+VirtualClock::VirtualClock()
+    : mNow(0),
+      mAutoAdvance(false)
+{
+}
+
+void VirtualClock::reset(int64_t start, bool autoAdvance)
+{
+    mNow.store(start, std::memory_order_relaxed);
+    mAutoAdvance = autoAdvance;
+}
+
+int64_t VirtualClock::realWait(int64_t ns) const
+{
+    if (ns == 0)
+        return 0;
+    /* a timeout is either skipped right away or left to advance() and a wakeup */
+    return mAutoAdvance && ns > 0 ? 0 : -1;
+}
+
+void VirtualClock::waited(int64_t ns)
+{
+    if (mAutoAdvance && ns > 0)
+        advance(ns);
+}
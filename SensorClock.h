@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_CLOCK_H
+#define ANDROID_SENSOR_CLOCK_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <atomic>
+
+/*****************************************************************************/
+
+/*
+ * Every time the HAL reads goes through the current SensorClock, so a
+ * simulation can swap in virtual time. boottime() stamps samples and
+ * times batches and wake-up deadlines; uptime() times stall windows and
+ * busy-poll spins, which must not count a suspend. The poll loop asks
+ * realWait() how long to really block for a timeout and reports with
+ * waited() when one passed with nothing to do.
+ */
+class SensorClock {
+public:
+    virtual ~SensorClock() {}
+
+    virtual int64_t boottime() const = 0;
+    virtual int64_t uptime() const = 0;
+
+    /* real ns to block for a wait of ns on this clock, -1 for no limit */
+    virtual int64_t realWait(int64_t ns) const { return ns; }
+    virtual void waited(int64_t /* ns */) {}
+    virtual bool isVirtual() const { return false; }
+
+    static SensorClock* get();
+    /* NULL goes back to the real clocks; switch before streams start */
+    static void set(SensorClock* clock);
+
+private:
+    static std::atomic<SensorClock*> sClock;
+};
+
+/* CLOCK_BOOTTIME and CLOCK_MONOTONIC */
+class RealClock : public SensorClock {
+public:
+    virtual int64_t boottime() const;
+    virtual int64_t uptime() const;
+};
+
+/*
+ * Simulated time, which only moves through advance() and, in auto mode,
+ * jumps to the end of each wait the poll loop would sleep through. With
+ * auto mode off the poll loop waits for fds or a wakeup instead of
+ * timeouts, so the driver of the simulation decides when time passes.
+ * Both clocks read the same; nothing suspends in a simulation.
+ */
+class VirtualClock : public SensorClock {
+public:
+            VirtualClock();
+
+    void reset(int64_t start, bool autoAdvance);
+    void advance(int64_t ns) { mNow.fetch_add(ns, std::memory_order_relaxed); }
+
+    virtual int64_t boottime() const { return mNow.load(std::memory_order_relaxed); }
+    virtual int64_t uptime() const { return mNow.load(std::memory_order_relaxed); }
+    virtual int64_t realWait(int64_t ns) const;
+    virtual void waited(int64_t ns);
+    virtual bool isVirtual() const { return true; }
+
+private:
+    std::atomic<int64_t> mNow;
+    bool mAutoAdvance;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSOR_CLOCK_H
@@ -0,0 +1,680 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "SensorPipeline.h"
+#include "SensorClock.h"
+
+/*****************************************************************************/
+
+LowPassStage::LowPassStage(float tau)
+    : mTau(tau)
+{
+    reset();
+}
+
+void LowPassStage::reset()
+{
+    mPrimed = false;
+    mLast = 0;
+    memset(mState, 0, sizeof(mState));
+}
+
+int LowPassStage::process(const PipelineSample* in, int count, PipelineSample* out)
+{
+    for (int i = 0; i < count; i++) {
+        if (!mPrimed) {
+            memcpy(mState, in[i].v, sizeof(mState));
+            mPrimed = true;
+        } else {
+            float dt = (in[i].timestamp - mLast) * 1e-9f;
+            float alpha = dt > 0 ? dt / (mTau + dt) : 0;
+            for (int j = 0; j < 3; j++)
+                mState[j] += alpha * (in[i].v[j] - mState[j]);
+        }
+        mLast = in[i].timestamp;
+        out[i].timestamp = in[i].timestamp;
+        memcpy(out[i].v, mState, sizeof(mState));
+    }
+    return count;
+}
+
+HighPassStage::HighPassStage(float tau)
+    : LowPassStage(tau)
+{
+}
+
+int HighPassStage::process(const PipelineSample* in, int count, PipelineSample* out)
+{
+    LowPassStage::process(in, count, out);
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < 3; j++)
+            out[i].v[j] = in[i].v[j] - out[i].v[j];
+    }
+    return count;
+}
+
+MedianStage::MedianStage()
+{
+    reset();
+}
+
+void MedianStage::reset()
+{
+    mFilled = 0;
+}
+
+static inline float median3(float a, float b, float c)
+{
+    if (a > b) {
+        float t = a; a = b; b = t;
+    }
+    return c < a ? a : (c > b ? b : c);
+}
+
+int MedianStage::process(const PipelineSample* in, int count, PipelineSample* out)
+{
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (mFilled == 0) {
+            /* nothing to compare against yet, let the first sample through */
+            out[n++] = in[i];
+            mHistory[0] = in[i];
+            mFilled = 1;
+            continue;
+        }
+        if (mFilled == 1) {
+            mHistory[1] = in[i];
+            mFilled = 2;
+            continue;
+        }
+
+        /* output the middle sample, filtered against its neighbours */
+        out[n].timestamp = mHistory[1].timestamp;
+        for (int j = 0; j < 3; j++)
+            out[n].v[j] = median3(mHistory[0].v[j], mHistory[1].v[j], in[i].v[j]);
+        n++;
+        mHistory[0] = mHistory[1];
+        mHistory[1] = in[i];
+    }
+    return n;
+}
+
+DecimateStage::DecimateStage()
+    : mFactor(1), mPhase(0)
+{
+}
+
+void DecimateStage::reset()
+{
+    mPhase = 0;
+}
+
+void DecimateStage::setRate(int64_t inPeriod, int64_t outPeriod)
+{
+    mFactor = (inPeriod > 0 && outPeriod > inPeriod) ? outPeriod / inPeriod : 1;
+    if (mPhase >= mFactor)
+        mPhase = 0;
+}
+
+int DecimateStage::process(const PipelineSample* in, int count, PipelineSample* out)
+{
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (mPhase == 0)
+            out[n++] = in[i];
+        if (++mPhase >= mFactor)
+            mPhase = 0;
+    }
+    return n;
+}
+
+SampleFifo::SampleFifo(int capacity)
+    : mSamples(new PipelineSample[capacity]),
+      mCapacity(capacity),
+      mHead(0),
+      mSize(0)
+{
+}
+
+SampleFifo::~SampleFifo()
+{
+    delete [] mSamples;
+}
+
+bool SampleFifo::push(const PipelineSample& sample)
+{
+    bool room = mSize < mCapacity;
+    if (!room)
+        pop();
+    int tail = mHead + mSize;
+    if (tail >= mCapacity)
+        tail -= mCapacity;
+    mSamples[tail] = sample;
+    mSize++;
+    return room;
+}
+
+void SampleFifo::pop()
+{
+    if (++mHead == mCapacity)
+        mHead = 0;
+    mSize--;
+}
+
+void SampleFifo::clear()
+{
+    mHead = 0;
+    mSize = 0;
+}
+
+/*****************************************************************************/
+
+/* wake-up deadlines have to keep counting through suspend */
+static int64_t getBoottime()
+{
+    return SensorClock::get()->boottime();
+}
+
+PipelineSensor::PipelineSensor(SensorBase* driver, int handle)
+    : SensorBase(NULL, NULL),
+      mDriver(driver),
+      mHandle(handle),
+      mEnabled(false),
+      mDelay(200000000),
+      mLatency(0),
+      mNumNodes(0),
+      mNumOutputs(0),
+      mHeldSamples(0)
+{
+    pthread_mutex_init(&mLock, NULL);
+}
+
+PipelineSensor::~PipelineSensor()
+{
+    for (int i = 0; i < mNumNodes; i++)
+        delete mNodes[i].stage;
+    for (int i = 0; i < mNumOutputs; i++)
+        delete mOutputs[i].fifo;
+    delete mDriver;
+    pthread_mutex_destroy(&mLock);
+}
+
+int PipelineSensor::addStage(int parent, PipelineStage* stage)
+{
+    if (mNumNodes >= maxNodes || parent >= mNumNodes) {
+        delete stage;
+        return -EINVAL;
+    }
+    Node& node = mNodes[mNumNodes];
+    node.parent = parent;
+    node.stage = stage;
+    node.active = false;
+    node.period = 0;
+    node.count = 0;
+    return mNumNodes++;
+}
+
+int PipelineSensor::addOutput(int node, int handle, int type)
+{
+    if (mNumOutputs >= maxOutputs || node < 0 || node >= mNumNodes)
+        return -EINVAL;
+    Output& out = mOutputs[mNumOutputs++];
+    out.node = node;
+    out.handle = handle;
+    out.type = type;
+    out.enabled = false;
+    out.delay = 200000000;
+    out.latency = 0;
+    out.fifo = NULL;
+    out.since = 0;
+    out.flushes = 0;
+    out.overflowed = false;
+    return mNumOutputs - 1;
+}
+
+int PipelineSensor::addWakeupOutput(int node, int handle, int type, int fifoSamples)
+{
+    if (fifoSamples < 1)
+        return -EINVAL;
+    int i = addOutput(node, handle, type);
+    if (i < 0)
+        return i;
+    mOutputs[i].fifo = new SampleFifo(fifoSamples);
+    return i;
+}
+
+int PipelineSensor::findOutput(int handle) const
+{
+    for (int i = 0; i < mNumOutputs; i++) {
+        if (mOutputs[i].handle == handle)
+            return i;
+    }
+    return -EINVAL;
+}
+
+int PipelineSensor::numActiveOutputs() const
+{
+    int n = 0;
+    for (int i = 0; i < mNumOutputs; i++) {
+        if (mOutputs[i].enabled)
+            n++;
+    }
+    return n;
+}
+
+/*
+ * Recompute which nodes run, the source rate (fastest consumer), the
+ * shortest batch latency and the rate each node has to keep up, then
+ * bring the driver in line. Called with mLock held.
+ */
+int PipelineSensor::update()
+{
+    bool wasActive[maxNodes];
+    int64_t delay = mEnabled ? mDelay : 0;
+    int64_t latency = mEnabled ? mLatency : -1;
+
+    for (int i = 0; i < mNumNodes; i++) {
+        wasActive[i] = mNodes[i].active;
+        mNodes[i].active = false;
+        mNodes[i].period = 0;
+    }
+    for (int i = 0; i < mNumOutputs; i++) {
+        const Output& out = mOutputs[i];
+        if (!out.enabled)
+            continue;
+        if (!delay || out.delay < delay)
+            delay = out.delay;
+        /* a wake-up output batches in its own FIFO */
+        if (!out.fifo && (latency < 0 || out.latency < latency))
+            latency = out.latency;
+        for (int n = out.node; n != source; n = mNodes[n].parent) {
+            if (!mNodes[n].period || out.delay < mNodes[n].period)
+                mNodes[n].period = out.delay;
+            mNodes[n].active = true;
+        }
+    }
+
+    for (int i = 0; i < mNumNodes; i++) {
+        if (mNodes[i].active) {
+            if (!wasActive[i])
+                mNodes[i].stage->reset();
+            mNodes[i].stage->setRate(delay, mNodes[i].period);
+        }
+    }
+
+    int err = 0;
+    bool on = delay != 0;
+    if (latency < 0)
+        latency = 0;
+    if (on)
+        err = mDriver->batch(mHandle, 0, delay, latency);
+    int result = mDriver->enable(mHandle, on);
+    return result < 0 ? result : err;
+}
+
+int PipelineSensor::getFd() const
+{
+    return mDriver->getFd();
+}
+
+bool PipelineSensor::hasPendingEvents() const
+{
+    if (mDriver->hasPendingEvents())
+        return true;
+    int64_t deadline = getWakeupDeadline();
+    return deadline && deadline <= getBoottime();
+}
+
+/* the held samples are due once the latency is up or the FIFO is 90% full */
+int64_t PipelineSensor::wakeupDeadline(const Output& out) const
+{
+    if (!out.fifo || !out.enabled)
+        return 0;
+    if (out.flushes)
+        return out.since ? out.since : 1;
+    if (out.fifo->empty())
+        return 0;
+    int64_t fill = out.delay * (out.fifo->capacity() - out.fifo->capacity() / 10);
+    return out.since + (out.latency < fill ? out.latency : fill);
+}
+
+int64_t PipelineSensor::getWakeupDeadline() const
+{
+    int64_t deadline = 0;
+    pthread_mutex_lock(&mLock);
+    for (int i = 0; i < mNumOutputs; i++) {
+        int64_t t = wakeupDeadline(mOutputs[i]);
+        if (t && (!deadline || t < deadline))
+            deadline = t;
+    }
+    pthread_mutex_unlock(&mLock);
+    return deadline;
+}
+
+int64_t PipelineSensor::getStreamPeriod() const
+{
+    return mDriver->getStreamPeriod();
+}
+
+int64_t PipelineSensor::getMeasuredPeriod() const
+{
+    return mDriver->getMeasuredPeriod();
+}
+
+/* the driver's count misses what the wake-up FIFOs took and returned nothing for */
+uint64_t PipelineSensor::getSampleCount() const
+{
+    pthread_mutex_lock(&mLock);
+    uint64_t held = mHeldSamples;
+    pthread_mutex_unlock(&mLock);
+    return mDriver->getSampleCount() + held;
+}
+
+int PipelineSensor::recover()
+{
+    /* stages keep their state, the gap shows up in the sample timestamps */
+    return mDriver->recover();
+}
+
+int PipelineSensor::setInjectionMode(bool injecting)
+{
+    return mDriver->setInjectionMode(injecting);
+}
+
+int PipelineSensor::inject(const sensors_event_t* event)
+{
+    /* derived outputs are computed from injected raw samples, not injected themselves */
+    if (event->sensor != mHandle)
+        return -EINVAL;
+    return mDriver->inject(event);
+}
+
+ssize_t PipelineSensor::prepareRead(void** buffer)
+{
+    return mDriver->prepareRead(buffer);
+}
+
+void PipelineSensor::completeRead(ssize_t result)
+{
+    mDriver->completeRead(result);
+}
+
+void PipelineSensor::cancelRead()
+{
+    mDriver->cancelRead();
+}
+
+void PipelineSensor::setDrain(bool drain)
+{
+    mDriver->setDrain(drain);
+}
+
+int PipelineSensor::setDelay(int32_t handle, int64_t ns)
+{
+    return batch(handle, 0, ns, 0);
+}
+
+int PipelineSensor::batch(int handle, int /* flags */, int64_t period_ns, int64_t timeout)
+{
+    if (period_ns < 0)
+        return -EINVAL;
+    if (timeout < 0)
+        timeout = 0;
+
+    int i = handle == mHandle ? -1 : findOutput(handle);
+    if (handle != mHandle && i < 0)
+        return i;
+
+    pthread_mutex_lock(&mLock);
+    if (i < 0) {
+        mDelay = period_ns;
+        mLatency = timeout;
+    } else {
+        mOutputs[i].delay = period_ns;
+        mOutputs[i].latency = timeout;
+    }
+    int err = update();
+    pthread_mutex_unlock(&mLock);
+    return err;
+}
+
+int PipelineSensor::flush(int handle)
+{
+    int i = handle == mHandle ? -1 : findOutput(handle);
+    if (handle != mHandle && i < 0)
+        return -EINVAL;
+    /* completion follows the samples held for the wake-up output */
+    if (i >= 0 && mOutputs[i].fifo) {
+        pthread_mutex_lock(&mLock);
+        mOutputs[i].flushes++;
+        pthread_mutex_unlock(&mLock);
+        return 0;
+    }
+    /* the driver echoes the handle back in the flush-complete event */
+    return mDriver->flush(handle);
+}
+
+int PipelineSensor::enable(int32_t handle, int enabled)
+{
+    int i = handle == mHandle ? -1 : findOutput(handle);
+    if (handle != mHandle && i < 0)
+        return i;
+
+    pthread_mutex_lock(&mLock);
+    if (i < 0) {
+        mEnabled = enabled != 0;
+    } else {
+        mOutputs[i].enabled = enabled != 0;
+        /* the poll thread pushes and pops under the same lock */
+        if (!enabled && mOutputs[i].fifo) {
+            mOutputs[i].fifo->clear();
+            mOutputs[i].since = 0;
+            mOutputs[i].flushes = 0;
+            mOutputs[i].overflowed = false;
+        }
+    }
+    int err = update();
+    pthread_mutex_unlock(&mLock);
+    return err;
+}
+
+int PipelineSensor::isActivated(int handle)
+{
+    int i = handle == mHandle ? -1 : findOutput(handle);
+    if (handle != mHandle && i < 0)
+        return 0;
+
+    pthread_mutex_lock(&mLock);
+    int enabled = i < 0 ? mEnabled : mOutputs[i].enabled;
+    pthread_mutex_unlock(&mLock);
+    return enabled;
+}
+
+int PipelineSensor::readEvents(sensors_event_t* data, int count)
+{
+    pthread_mutex_lock(&mLock);
+    int n = readBatch(data, count);
+    pthread_mutex_unlock(&mLock);
+    return n;
+}
+
+/* one batch from the driver through the enabled nodes; called with mLock held */
+int PipelineSensor::readBatch(sensors_event_t* data, int count)
+{
+    int outputs = numActiveOutputs();
+    if (!outputs)
+        return mDriver->readEvents(data, count);
+
+    /* every stream emits at most one event per raw sample, so this always fits */
+    int streams = outputs + (mEnabled ? 1 : 0);
+    int n = count / streams;
+    if (n < 1)
+        return count < 1 ? -EINVAL : 0;
+    if (n > maxBatch)
+        n = maxBatch;
+
+    n = mDriver->readEvents(mRaw, n);
+    if (n < 0)
+        return n;
+
+    /* flush-complete events follow every sample of the batch */
+    sensors_event_t meta[maxBatch];
+    int numMeta = 0;
+    int numSamples = 0;
+    for (int i = 0; i < n; i++) {
+        if (mRaw[i].type == SENSOR_TYPE_META_DATA)
+            meta[numMeta++] = mRaw[i];
+        else
+            mRaw[numSamples++] = mRaw[i];
+    }
+    n = numSamples;
+
+    PipelineSample in[maxBatch];
+    for (int i = 0; i < n; i++) {
+        in[i].timestamp = mRaw[i].timestamp;
+        in[i].v[0] = mRaw[i].acceleration.x;
+        in[i].v[1] = mRaw[i].acceleration.y;
+        in[i].v[2] = mRaw[i].acceleration.z;
+    }
+
+    for (int i = 0; i < mNumNodes; i++) {
+        Node& node = mNodes[i];
+        if (!node.active)
+            continue;
+        if (node.parent == source)
+            node.count = node.stage->process(in, n, node.samples);
+        else
+            node.count = node.stage->process(mNodes[node.parent].samples,
+                    mNodes[node.parent].count, node.samples);
+    }
+
+    /* wake-up outputs hold their samples until the batch is due */
+    int64_t now = 0;
+    for (int i = 0; i < mNumOutputs; i++) {
+        Output& out = mOutputs[i];
+        const Node& node = mNodes[out.node];
+        if (!out.fifo || !out.enabled || !node.count)
+            continue;
+        if (!now)
+            now = getBoottime();
+        if (out.fifo->empty())
+            out.since = now;
+        mHeldSamples += node.count;
+        for (int j = 0; j < node.count; j++) {
+            if (!out.fifo->push(node.samples[j]) && !out.overflowed) {
+                LOGW("wake-up sensor %d FIFO full, dropping the oldest samples", out.handle);
+                out.overflowed = true;
+            }
+        }
+    }
+
+    /* merge the raw stream and the enabled outputs back into timestamp order */
+    int pos[maxOutputs + 1];
+    memset(pos, 0, sizeof(pos));
+    int numEvents = 0;
+    for (;;) {
+        int best = -1;
+        int64_t bestTs = 0;
+        if (mEnabled && pos[maxOutputs] < n) {
+            best = maxOutputs;
+            bestTs = mRaw[pos[maxOutputs]].timestamp;
+        }
+        for (int i = 0; i < mNumOutputs; i++) {
+            const Node& node = mNodes[mOutputs[i].node];
+            if (!mOutputs[i].enabled || mOutputs[i].fifo || pos[i] >= node.count)
+                continue;
+            if (best < 0 || node.samples[pos[i]].timestamp < bestTs) {
+                best = i;
+                bestTs = node.samples[pos[i]].timestamp;
+            }
+        }
+        if (best < 0)
+            break;
+
+        if (best == maxOutputs) {
+            data[numEvents++] = mRaw[pos[best]++];
+            continue;
+        }
+
+        const Output& out = mOutputs[best];
+        const PipelineSample& s = mNodes[out.node].samples[pos[best]++];
+        sensors_event_t& ev = data[numEvents++];
+        memset(&ev, 0, sizeof(ev));
+        ev.version = sizeof(sensors_event_t);
+        ev.sensor = out.handle;
+        ev.type = out.type;
+        ev.timestamp = s.timestamp;
+        ev.acceleration.x = s.v[0];
+        ev.acceleration.y = s.v[1];
+        ev.acceleration.z = s.v[2];
+        ev.acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
+    }
+
+    for (int i = 0; i < numMeta; i++)
+        data[numEvents++] = meta[i];
+    return numEvents + drainWakeup(data + numEvents, count - numEvents);
+}
+
+/* the held samples of every due wake-up output, then its flush completions */
+int PipelineSensor::drainWakeup(sensors_event_t* data, int count)
+{
+    int64_t now = 0;
+    int numEvents = 0;
+
+    for (int i = 0; i < mNumOutputs && numEvents < count; i++) {
+        Output& out = mOutputs[i];
+        int64_t deadline = wakeupDeadline(out);
+        if (!deadline)
+            continue;
+        if (!now)
+            now = getBoottime();
+        if (deadline > now)
+            continue;
+
+        while (numEvents < count && !out.fifo->empty()) {
+            const PipelineSample& s = out.fifo->front();
+            sensors_event_t& ev = data[numEvents++];
+            memset(&ev, 0, sizeof(ev));
+            ev.version = sizeof(sensors_event_t);
+            ev.sensor = out.handle;
+            ev.type = out.type;
+            ev.timestamp = s.timestamp;
+            ev.acceleration.x = s.v[0];
+            ev.acceleration.y = s.v[1];
+            ev.acceleration.z = s.v[2];
+            ev.acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
+            out.fifo->pop();
+        }
+        if (!out.fifo->empty())
+            continue;
+        out.since = 0;
+        out.overflowed = false;
+
+        while (numEvents < count && out.flushes) {
+            sensors_event_t& ev = data[numEvents++];
+            memset(&ev, 0, sizeof(ev));
+            ev.version = META_DATA_VERSION;
+            ev.type = SENSOR_TYPE_META_DATA;
+            ev.meta_data.sensor = out.handle;
+            ev.meta_data.what = META_DATA_FLUSH_COMPLETE;
+            out.flushes--;
+        }
+    }
+    return numEvents;
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_PIPELINE_H
+#define ANDROID_SENSOR_PIPELINE_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "nusensors.h"
+#include "SensorBase.h"
+
+/*****************************************************************************/
+
+struct PipelineSample {
+    int64_t timestamp;
+    float v[3];
+};
+
+/*
+ * One processing step. process() consumes a batch from the parent node and
+ * may emit fewer samples than it got (decimation, median warm-up).
+ */
+class PipelineStage {
+public:
+    virtual ~PipelineStage() {}
+
+    /* called when the node goes from idle to active */
+    virtual void reset() {}
+    /* period of the incoming stream and the slowest period needed downstream */
+    virtual void setRate(int64_t /* inPeriod */, int64_t /* outPeriod */) {}
+    virtual int process(const PipelineSample* in, int count, PipelineSample* out) = 0;
+};
+
+/* first order IIR low-pass, time constant in seconds, uses sample timestamps */
+class LowPassStage : public PipelineStage {
+public:
+            LowPassStage(float tau);
+    virtual void reset();
+    virtual int process(const PipelineSample* in, int count, PipelineSample* out);
+
+protected:
+    float mTau;
+    bool mPrimed;
+    int64_t mLast;
+    float mState[3];
+};
+
+/* complement of LowPassStage: input minus its low-passed value */
+class HighPassStage : public LowPassStage {
+public:
+            HighPassStage(float tau);
+    virtual int process(const PipelineSample* in, int count, PipelineSample* out);
+};
+
+/* 3-tap median per axis, rejects single-sample spikes; one sample of delay */
+class MedianStage : public PipelineStage {
+public:
+            MedianStage();
+    virtual void reset();
+    virtual int process(const PipelineSample* in, int count, PipelineSample* out);
+
+private:
+    PipelineSample mHistory[2];
+    int mFilled;
+};
+
+/* keeps every Nth sample, N derived from the rates */
+class DecimateStage : public PipelineStage {
+public:
+            DecimateStage();
+    virtual void reset();
+    virtual void setRate(int64_t inPeriod, int64_t outPeriod);
+    virtual int process(const PipelineSample* in, int count, PipelineSample* out);
+
+private:
+    int mFactor;
+    int mPhase;
+};
+
+/*
+ * Samples of a wake-up output waiting for delivery, allocated up front.
+ * When full the oldest sample is dropped.
+ */
+class SampleFifo {
+public:
+            SampleFifo(int capacity);
+            ~SampleFifo();
+
+    int capacity() const { return mCapacity; }
+    int size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+
+    /* false when the oldest sample had to be dropped to make room */
+    bool push(const PipelineSample& sample);
+    /* oldest sample; only valid when not empty */
+    const PipelineSample& front() const { return mSamples[mHead]; }
+    void pop();
+    void clear();
+
+private:
+    PipelineSample* mSamples;
+    int mCapacity;
+    int mHead;
+    int mSize;
+};
+
+/*****************************************************************************/
+
+/*
+ * Wraps a raw driver and publishes derived streams as extra handles. The
+ * stages form a tree rooted at the driver's samples; a node is computed
+ * once per batch, and only while some handle at or below it is enabled.
+ * With only the raw handle enabled, readEvents() passes straight through.
+ *
+ * A wake-up output keeps its samples in a FIFO of its own instead of
+ * returning them as they come. They go out as one batch when its latency
+ * is up, the FIFO is nearly full or a flush asks for them; its latency
+ * doesn't hold back the other streams, and getWakeupDeadline() tells the
+ * poll loop when to wake the AP for the batch.
+ *
+ * The framework thread reconfigures the tree while the poll thread runs
+ * it, so the configuration, the stage state and the FIFOs are all under
+ * mLock.
+ */
+class PipelineSensor final : public SensorBase {
+public:
+    enum { source = -1 };
+
+            PipelineSensor(SensorBase* driver, int handle);
+    virtual ~PipelineSensor();
+
+    /* nodes must be added parents first; the sensor owns the stage */
+    int addStage(int parent, PipelineStage* stage);
+    int addOutput(int node, int handle, int type);
+    int addWakeupOutput(int node, int handle, int type, int fifoSamples);
+
+    virtual int readEvents(sensors_event_t* data, int count);
+    virtual bool hasPendingEvents() const;
+    virtual int getFd() const;
+    virtual int setDelay(int32_t handle, int64_t ns);
+    virtual int enable(int32_t handle, int enabled);
+    virtual int isActivated(int handle);
+    virtual int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
+    virtual int flush(int handle);
+    virtual int64_t getStreamPeriod() const;
+    virtual int64_t getMeasuredPeriod() const;
+    virtual int recover();
+    virtual uint64_t getSampleCount() const;
+    virtual int setInjectionMode(bool injecting);
+    virtual int inject(const sensors_event_t* event);
+    virtual ssize_t prepareRead(void** buffer);
+    virtual void completeRead(ssize_t result);
+    virtual void cancelRead();
+    virtual void setDrain(bool drain);
+    virtual int64_t getWakeupDeadline() const;
+
+private:
+    static const int maxNodes = 8;
+    static const int maxOutputs = 4;
+    static const int maxBatch = 64;
+
+    struct Node {
+        int parent;
+        PipelineStage* stage;
+        bool active;
+        int64_t period;
+        int count;
+        PipelineSample samples[maxBatch];
+    };
+
+    struct Output {
+        int node;
+        int handle;
+        int type;
+        bool enabled;
+        int64_t delay;
+        int64_t latency;
+
+        /* wake-up outputs only */
+        SampleFifo* fifo;
+        int64_t since;          /* CLOCK_BOOTTIME the oldest held sample came in */
+        int flushes;            /* completions to send after the held samples */
+        bool overflowed;
+    };
+
+    int findOutput(int handle) const;
+    int numActiveOutputs() const;
+    int update();
+    int64_t wakeupDeadline(const Output& out) const;
+    int readBatch(sensors_event_t* data, int count);
+    int drainWakeup(sensors_event_t* data, int count);
+
+    mutable pthread_mutex_t mLock;
+    SensorBase* mDriver;
+    int mHandle;
+    bool mEnabled;
+    int64_t mDelay;
+    int64_t mLatency;
+    int mNumNodes;
+    Node mNodes[maxNodes];
+    int mNumOutputs;
+    Output mOutputs[maxOutputs];
+    sensors_event_t mRaw[maxBatch];
+    /* samples pushed to wake-up FIFOs, progress for the stall watchdog */
+    uint64_t mHeldSamples;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSOR_PIPELINE_H
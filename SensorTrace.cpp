@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "SensorTrace.h"
+#include "SensorClock.h"
+
+#include "custom_log.h"
+
+/*****************************************************************************/
+
+static const char* const sTypeNames[SensorTrace::numTypes] = {
+    "poll_wakeup",
+    "fill",
+    "decode",
+    "ioctl",
+    "flush_request",
+    "flush_delivered",
+    "spin",
+};
+
+std::atomic<int> SensorTrace::sMode(SensorTrace::MODE_OFF);
+std::atomic<int> SensorTrace::sMarkerFd(-1);
+std::atomic<uint32_t> SensorTrace::sNumRings(0);
+SensorTrace::Ring* SensorTrace::sRings[SensorTrace::kMaxThreads];
+
+void SensorTrace::setMode(int mode)
+{
+    if (mode == MODE_FTRACE && sMarkerFd.load() < 0) {
+        int fd = open("/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+        if (fd < 0)
+            fd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+        if (fd < 0) {
+            LOGW("SensorTrace: no trace_marker (%s), ring only", strerror(errno));
+            mode = MODE_RING;
+        } else {
+            int expected = -1;
+            if (!sMarkerFd.compare_exchange_strong(expected, fd))
+                close(fd);
+        }
+    }
+    sMode.store(mode, std::memory_order_relaxed);
+}
+
+int64_t SensorTrace::now()
+{
+    return SensorClock::get()->boottime();
+}
+
+SensorTrace::Ring* SensorTrace::threadRing()
+{
+    static __thread Ring* ring = NULL;
+    static __thread bool full = false;
+
+    if (ring || full)
+        return ring;
+
+    uint32_t slot = sNumRings.fetch_add(1);
+    if (slot >= kMaxThreads) {
+        /* leave the count saturated; this thread just doesn't trace */
+        full = true;
+        return NULL;
+    }
+    ring = new Ring();
+    ring->tid = (pid_t)syscall(SYS_gettid);
+    ring->head.store(0);
+    sRings[slot] = ring;
+    return ring;
+}
+
+void SensorTrace::record(int type, int32_t arg, int64_t value)
+{
+    Ring* ring = threadRing();
+    if (!ring)
+        return;
+
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    Record& r = ring->records[head & (kRingSize - 1)];
+    r.timestamp = now();
+    r.type = type;
+    r.reserved = 0;
+    r.arg = arg;
+    r.value = value;
+    ring->head.store(head + 1, std::memory_order_release);
+
+    if (mode() == MODE_FTRACE && type != IOCTL) {
+        /* IOCTL already produced a span from SensorTraceScope */
+        counter(sTypeNames[type], value);
+    }
+}
+
+void SensorTrace::writeMarker(const char* buf, int len)
+{
+    int fd = sMarkerFd.load(std::memory_order_relaxed);
+    if (fd >= 0 && len > 0)
+        write(fd, buf, len);
+}
+
+void SensorTrace::counter(const char* name, int64_t value)
+{
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), "C|%d|sensors_%s|%lld",
+            getpid(), name, (long long)value);
+    writeMarker(buf, len);
+}
+
+void SensorTrace::dump(int fd)
+{
+    uint32_t numRings = sNumRings.load();
+    if (numRings > kMaxThreads)
+        numRings = kMaxThreads;
+
+    for (uint32_t i = 0; i < numRings; i++) {
+        Ring* ring = sRings[i];
+        if (!ring)
+            continue;
+
+        uint32_t head = ring->head.load(std::memory_order_acquire);
+        uint32_t first = head > kRingSize ? head - kRingSize : 0;
+        char buf[128];
+        int len;
+
+        len = snprintf(buf, sizeof(buf), "tid %d: %u records\n", ring->tid, head - first);
+        if (fd >= 0)
+            write(fd, buf, len);
+        else
+            LOGI("%s", buf);
+
+        for (uint32_t n = first; n < head; n++) {
+            const Record& r = ring->records[n & (kRingSize - 1)];
+            len = snprintf(buf, sizeof(buf), "  %lld %s %d %lld\n",
+                    (long long)r.timestamp,
+                    r.type < numTypes ? sTypeNames[r.type] : "?",
+                    r.arg, (long long)r.value);
+            if (fd >= 0)
+                write(fd, buf, len);
+            else
+                LOGI("%s", buf);
+        }
+    }
+}
+
+/*****************************************************************************/
+
+SensorTraceScope::SensorTraceScope(const char* name, int32_t cmd)
+    : mName(name), mCmd(cmd), mStart(0)
+{
+    if (SensorTrace::mode() == SensorTrace::MODE_OFF)
+        return;
+
+    mStart = SensorTrace::now();
+    if (SensorTrace::mode() == SensorTrace::MODE_FTRACE) {
+        char buf[64];
+        int len = snprintf(buf, sizeof(buf), "B|%d|%s", getpid(), mName);
+        SensorTrace::writeMarker(buf, len);
+    }
+}
+
+SensorTraceScope::~SensorTraceScope()
+{
+    if (!mStart)
+        return;
+
+    SensorTrace::record(SensorTrace::IOCTL, mCmd, SensorTrace::now() - mStart);
+    if (SensorTrace::mode() == SensorTrace::MODE_FTRACE)
+        SensorTrace::writeMarker("E", 1);
+}
+
+void sensors_trace_dump(int fd)
+{
+    SensorTrace::dump(fd);
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_TRACE_H
+#define ANDROID_SENSOR_TRACE_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <atomic>
+
+/*
+ * Binary trace of the event path. Each thread records fixed-size records
+ * into its own ring, so tracing never formats strings or takes a lock on
+ * the hot path. Build with -DSENSOR_TRACE_ENABLED=0 to compile it out.
+ */
+#ifndef SENSOR_TRACE_ENABLED
+#define SENSOR_TRACE_ENABLED 1
+#endif
+
+/*****************************************************************************/
+
+class SensorTrace {
+public:
+    enum Mode {
+        MODE_OFF        = 0,
+        MODE_RING       = 1,    // binary ring only
+        MODE_FTRACE     = 2,    // ring + trace_marker spans/counters
+    };
+
+    enum Type {
+        POLL_WAKEUP     = 0,    // arg = poll() result
+        FILL            = 1,    // arg = driver, value = input_events read
+        DECODE          = 2,    // arg = driver, value = sensors_event_t decoded
+        IOCTL           = 3,    // arg = ioctl cmd, value = duration (ns)
+        FLUSH_REQUEST   = 4,    // arg = handle
+        FLUSH_DELIVERED = 5,    // value = flush events delivered
+        SPIN            = 6,    // arg = driver spun for, value = CPU spent (ns)
+        numTypes,
+    };
+
+    struct Record {
+        int64_t  timestamp;     // CLOCK_BOOTTIME, ns
+        uint16_t type;
+        uint16_t reserved;
+        int32_t  arg;
+        int64_t  value;
+    };
+
+    static const size_t kRingSize = 1024;   // records per thread, power of 2
+    static const size_t kMaxThreads = 16;
+
+    static int mode() {
+        return sMode.load(std::memory_order_relaxed);
+    }
+    static void setMode(int mode);
+
+    static int64_t now();
+    static void record(int type, int32_t arg, int64_t value);
+
+    /* ftrace counter, e.g. "C|pid|gsensor_fill|12" */
+    static void counter(const char* name, int64_t value);
+
+    /* dump every thread's ring as text; fd < 0 dumps to logcat */
+    static void dump(int fd);
+
+private:
+    friend class SensorTraceScope;
+
+    struct Ring {
+        pid_t tid;
+        std::atomic<uint32_t> head;
+        Record records[kRingSize];
+    };
+
+    static Ring* threadRing();
+    static void writeMarker(const char* buf, int len);
+
+    static std::atomic<int> sMode;
+    static std::atomic<int> sMarkerFd;
+    static std::atomic<uint32_t> sNumRings;
+    static Ring* sRings[kMaxThreads];
+};
+
+/*
+ * Times a control-path call (ioctl etc.) and records it as an IOCTL record,
+ * plus a B/E span on trace_marker in MODE_FTRACE.
+ */
+class SensorTraceScope {
+public:
+    SensorTraceScope(const char* name, int32_t cmd);
+    ~SensorTraceScope();
+
+private:
+    const char* mName;
+    int32_t mCmd;
+    int64_t mStart;
+};
+
+#if SENSOR_TRACE_ENABLED
+#define SENSOR_TRACE(type, arg, value) \
+    do { \
+        if (SensorTrace::mode() != SensorTrace::MODE_OFF) \
+            SensorTrace::record(SensorTrace::type, (arg), (value)); \
+    } while (0)
+#define SENSOR_TRACE_SCOPE(name, cmd) \
+    SensorTraceScope __sensor_trace_scope((name), (cmd))
+#else
+#define SENSOR_TRACE(type, arg, value)  ((void)0)
+#define SENSOR_TRACE_SCOPE(name, cmd)   ((void)0)
+#endif
+
+__BEGIN_DECLS
+
+/* exported so test tools can dlsym() it and dump the rings on demand */
+void sensors_trace_dump(int fd);
+
+__END_DECLS
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSOR_TRACE_H
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "SensorWatchdog.h"
+
+/*****************************************************************************/
+
+SensorWatchdog::SensorWatchdog()
+    : mPeriods(defaultPeriods),
+      mWatching(false),
+      mLastEvent(0),
+      mBackoff(1),
+      mStalled(false),
+      mStallStart(0)
+{
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+int64_t SensorWatchdog::window(int64_t period) const
+{
+    int64_t w = period * mPeriods;
+    if (w < minWindowNs)
+        w = minWindowNs;
+    return w * mBackoff;
+}
+
+void SensorWatchdog::watch(int64_t now, int64_t period)
+{
+    if (!period) {
+        /* stream stopped; a stall in progress is abandoned, not recovered */
+        mWatching = false;
+        mStalled = false;
+        return;
+    }
+    if (!mWatching) {
+        mWatching = true;
+        mLastEvent = now;
+        mBackoff = 1;
+    }
+}
+
+void SensorWatchdog::feed(int64_t now, int64_t period)
+{
+    watch(now, period);
+    if (!mWatching)
+        return;
+
+    mLastEvent = now;
+    mBackoff = 1;
+    if (mStalled) {
+        int64_t ttr = now - mStallStart;
+        mStats.recoveries++;
+        mStats.last_recover_ns = ttr;
+        mStats.total_recover_ns += ttr;
+        if (ttr > mStats.max_recover_ns)
+            mStats.max_recover_ns = ttr;
+        mStalled = false;
+        LOGI("sensor stream recovered after %lld ms (%u of %u stalls recovered)",
+                (long long)(ttr / 1000000), mStats.recoveries, mStats.stalls);
+    }
+}
+
+bool SensorWatchdog::expired(int64_t now, int64_t period)
+{
+    if (!mPeriods)
+        return false;
+    watch(now, period);
+    return mWatching && now - mLastEvent >= window(period);
+}
+
+int SensorWatchdog::timeoutMs(int64_t now, int64_t period) const
+{
+    if (!mPeriods || !period)
+        return -1;
+    if (!mWatching)
+        return (window(period) + 999999) / 1000000;
+
+    int64_t left = mLastEvent + window(period) - now;
+    return left > 0 ? (left + 999999) / 1000000 : 0;
+}
+
+void SensorWatchdog::attempted(int64_t now, bool ok)
+{
+    if (!mStalled) {
+        mStalled = true;
+        mStallStart = now;
+        mStats.stalls++;
+    }
+    mStats.attempts++;
+    if (!ok)
+        mStats.failures++;
+
+    /* give the device a fresh window, longer each time it didn't help */
+    mLastEvent = now;
+    if (mBackoff < maxBackoff)
+        mBackoff *= 2;
+}
+
+void SensorWatchdog::getStats(struct sensors_watchdog_stats* stats) const
+{
+    *stats = mStats;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_WATCHDOG_H
+#define ANDROID_SENSOR_WATCHDOG_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "nusensors.h"
+
+/*****************************************************************************/
+
+/*
+ * Stall detection for one driver. The owner feeds it whenever the driver
+ * delivered events; once nothing arrived for `periods` sample periods
+ * (never less than minWindowNs) expired() asks for a recovery. Failed
+ * recoveries back off by doubling the window, up to maxBackoff times.
+ * All times are CLOCK_MONOTONIC so a suspend doesn't look like a stall.
+ */
+class SensorWatchdog {
+public:
+    static const int defaultPeriods = 10;
+
+            SensorWatchdog();
+
+    /* 0 disables the watchdog */
+    void setPeriods(int periods) { mPeriods = periods; }
+
+    /* period is the driver's expected sample period, 0 when it isn't streaming */
+    void feed(int64_t now, int64_t period);
+    bool expired(int64_t now, int64_t period);
+    /* ms until expired() can fire, -1 when not watching */
+    int timeoutMs(int64_t now, int64_t period) const;
+    void attempted(int64_t now, bool ok);
+
+    void getStats(struct sensors_watchdog_stats* stats) const;
+
+private:
+    static const int64_t minWindowNs = 200000000LL;
+    static const int maxBackoff = 8;
+
+    int64_t window(int64_t period) const;
+    void watch(int64_t now, int64_t period);
+
+    int mPeriods;
+    bool mWatching;
+    int64_t mLastEvent;
+    int mBackoff;
+
+    /* set from the first detection until data flows again */
+    bool mStalled;
+    int64_t mStallStart;
+
+    struct sensors_watchdog_stats mStats;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSOR_WATCHDOG_H
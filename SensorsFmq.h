@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSORS_FMQ_H
+#define ANDROID_SENSORS_FMQ_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <atomic>
+
+/*
+ * Shared-memory primitives modelled on the Sensors HAL 2.x delivery path:
+ * a single-producer/single-consumer message queue and a futex-backed event
+ * flag word. Everything lives in one mapping, so the reader can sit in
+ * another process that only received the fd.
+ */
+
+/*****************************************************************************/
+
+/* EventQueueFlagBits */
+#define EVENT_QUEUE_FLAG_READ_AND_PROCESS   (1 << 0)
+#define EVENT_QUEUE_FLAG_EVENTS_READ        (1 << 1)
+
+/* WakeLockQueueFlagBits */
+#define WAKE_LOCK_QUEUE_FLAG_DATA_WRITTEN   (1 << 0)
+
+struct FmqRingHeader {
+    std::atomic<uint64_t> write;
+    std::atomic<uint64_t> read;
+    uint32_t capacity;      // elements, power of 2
+    uint32_t elemSize;
+};
+
+template <typename T>
+class MessageQueue {
+    FmqRingHeader* mHeader;
+    T* mData;
+
+public:
+    MessageQueue() : mHeader(NULL), mData(NULL) {}
+
+    /* bind to a ring already laid out in shared memory */
+    void attach(FmqRingHeader* header, T* data) {
+        mHeader = header;
+        mData = data;
+    }
+
+    /* writer side, called once by whoever creates the mapping */
+    void init(FmqRingHeader* header, T* data, uint32_t capacity) {
+        header->write.store(0);
+        header->read.store(0);
+        header->capacity = capacity;
+        header->elemSize = sizeof(T);
+        attach(header, data);
+    }
+
+    bool isValid() const {
+        return mHeader && mHeader->elemSize == sizeof(T) &&
+                mHeader->capacity && !(mHeader->capacity & (mHeader->capacity - 1));
+    }
+
+    size_t getQuantumCount() const {
+        return mHeader->capacity;
+    }
+
+    size_t availableToRead() const {
+        return mHeader->write.load(std::memory_order_acquire) -
+                mHeader->read.load(std::memory_order_relaxed);
+    }
+
+    size_t availableToWrite() const {
+        return mHeader->capacity - (mHeader->write.load(std::memory_order_relaxed) -
+                mHeader->read.load(std::memory_order_acquire));
+    }
+
+    /* all-or-nothing, like android::hardware::MessageQueue::write() */
+    bool write(const T* items, size_t count) {
+        if (count > availableToWrite())
+            return false;
+        uint64_t w = mHeader->write.load(std::memory_order_relaxed);
+        copyIn(w, items, count);
+        mHeader->write.store(w + count, std::memory_order_release);
+        return true;
+    }
+
+    bool read(T* items, size_t count) {
+        if (count > availableToRead())
+            return false;
+        uint64_t r = mHeader->read.load(std::memory_order_relaxed);
+        copyOut(r, items, count);
+        mHeader->read.store(r + count, std::memory_order_release);
+        return true;
+    }
+
+private:
+    void copyIn(uint64_t pos, const T* items, size_t count) {
+        size_t start = pos & (mHeader->capacity - 1);
+        size_t first = count < mHeader->capacity - start ? count : mHeader->capacity - start;
+        memcpy(mData + start, items, first * sizeof(T));
+        memcpy(mData, items + first, (count - first) * sizeof(T));
+    }
+
+    void copyOut(uint64_t pos, T* items, size_t count) const {
+        size_t start = pos & (mHeader->capacity - 1);
+        size_t first = count < mHeader->capacity - start ? count : mHeader->capacity - start;
+        memcpy(items, mData + start, first * sizeof(T));
+        memcpy(items + first, mData, (count - first) * sizeof(T));
+    }
+};
+
+/*
+ * A 32-bit flag word in shared memory. wake() ORs bits in and wakes any
+ * waiter; wait() returns (and clears) the requested bits once any is set.
+ */
+class EventFlag {
+    std::atomic<uint32_t>* mWord;
+
+    static int futex(std::atomic<uint32_t>* word, int op, uint32_t val,
+            const struct timespec* timeout) {
+        return syscall(__NR_futex, reinterpret_cast<uint32_t*>(word), op, val, timeout, NULL, 0);
+    }
+
+public:
+    EventFlag() : mWord(NULL) {}
+
+    void attach(std::atomic<uint32_t>* word) {
+        mWord = word;
+    }
+
+    void wake(uint32_t bits) {
+        uint32_t old = mWord->fetch_or(bits);
+        if ((old & bits) != bits)
+            futex(mWord, FUTEX_WAKE, INT32_MAX, NULL);
+    }
+
+    /* timeoutNs <= 0 waits forever; returns -ETIMEDOUT when nothing arrived */
+    int wait(uint32_t bitmask, uint32_t* outBits, int64_t timeoutNs) {
+        struct timespec ts;
+        struct timespec* pts = NULL;
+        if (timeoutNs > 0) {
+            ts.tv_sec = timeoutNs / 1000000000LL;
+            ts.tv_nsec = timeoutNs % 1000000000LL;
+            pts = &ts;
+        }
+
+        for (;;) {
+            uint32_t cur = mWord->load();
+            if (cur & bitmask) {
+                uint32_t old = mWord->fetch_and(~bitmask);
+                *outBits = old & bitmask;
+                if (*outBits)
+                    return 0;
+                continue;
+            }
+            if (futex(mWord, FUTEX_WAIT, cur, pts) < 0) {
+                if (errno == ETIMEDOUT)
+                    return -ETIMEDOUT;
+                if (errno != EAGAIN && errno != EINTR)
+                    return -errno;
+            }
+        }
+    }
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSORS_FMQ_H
@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <new>
+#include <cutils/ashmem.h>
+
+#include "nusensors.h"
+#include "SensorsHal2.h"
+#include "SensorClock.h"
+
+/*****************************************************************************/
+
+#define WAKE_LOCK_NAME          "SensorsHAL_WAKEUP"
+#define WAKE_LOCK_TIMEOUT_NS    1000000000LL    // same 1 s limit as HAL 2.0
+#define WRITE_RETRY_TIMEOUT_NS  100000000LL
+#define POLL_BUFFER_EVENTS      128
+
+static size_t alignUp(size_t v)
+{
+    return (v + 63) & ~size_t(63);
+}
+
+static size_t roundUpPow2(size_t v)
+{
+    size_t p = 1;
+    while (p < v)
+        p <<= 1;
+    return p;
+}
+
+static void writeWakeLock(const char* path)
+{
+    static bool warned = false;
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE_IF(!warned, "couldn't open %s (%s)", path, strerror(errno));
+        warned = true;
+        return;
+    }
+    if (write(fd, WAKE_LOCK_NAME, strlen(WAKE_LOCK_NAME)) < 0)
+        LOGE("couldn't write %s (%s)", path, strerror(errno));
+    close(fd);
+}
+
+/*****************************************************************************/
+
+SensorsHal2Adapter::SensorsHal2Adapter(sensors_poll_device_1_t* device)
+    : mDevice(device),
+      mSensorList(NULL),
+      mSensorCount(0),
+      mFd(-1),
+      mSize(0),
+      mShared(NULL),
+      mRunning(false),
+      mOutstandingWakeEvents(0),
+      mLastWakeEventTime(0),
+      mWakeLockHeld(false)
+{
+    pthread_mutex_init(&mWakeLock, NULL);
+
+    sensors_module_t* module = (sensors_module_t*)device->common.module;
+    if (module && module->get_sensors_list)
+        mSensorCount = module->get_sensors_list(module, &mSensorList);
+}
+
+SensorsHal2Adapter::~SensorsHal2Adapter()
+{
+    stop();
+    pthread_mutex_destroy(&mWakeLock);
+}
+
+int SensorsHal2Adapter::start(size_t eventQueueSize, size_t wakeLockQueueSize)
+{
+    if (mRunning)
+        return -EBUSY;
+
+    eventQueueSize = roundUpPow2(eventQueueSize);
+    wakeLockQueueSize = roundUpPow2(wakeLockQueueSize);
+
+    size_t eventOffset = alignUp(sizeof(SensorsHal2Shared));
+    size_t wakeLockOffset = alignUp(eventOffset + sizeof(FmqRingHeader) +
+            eventQueueSize * sizeof(sensors_event_t));
+    mSize = alignUp(wakeLockOffset + sizeof(FmqRingHeader) +
+            wakeLockQueueSize * sizeof(uint32_t));
+
+    mFd = ashmem_create_region("sensors_hal2_fmq", mSize);
+    if (mFd < 0) {
+        LOGE("couldn't create fmq region (%s)", strerror(errno));
+        return -errno;
+    }
+
+    void* base = mmap(NULL, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (base == MAP_FAILED) {
+        LOGE("couldn't map fmq region (%s)", strerror(errno));
+        close(mFd);
+        mFd = -1;
+        return -errno;
+    }
+
+    mShared = new (base) SensorsHal2Shared();
+    mShared->magic = SENSORS_HAL2_MAGIC;
+    mShared->version = SENSORS_HAL2_VERSION;
+    mShared->size = mSize;
+    mShared->eventQueueOffset = eventOffset;
+    mShared->wakeLockQueueOffset = wakeLockOffset;
+    mShared->eventFlag.store(0);
+    mShared->wakeLockFlag.store(0);
+
+    char* p = (char*)base;
+    FmqRingHeader* eventHeader = new (p + eventOffset) FmqRingHeader();
+    FmqRingHeader* wakeLockHeader = new (p + wakeLockOffset) FmqRingHeader();
+    mEventQueue.init(eventHeader, (sensors_event_t*)(eventHeader + 1), eventQueueSize);
+    mWakeLockQueue.init(wakeLockHeader, (uint32_t*)(wakeLockHeader + 1), wakeLockQueueSize);
+    mEventFlag.attach(&mShared->eventFlag);
+    mWakeLockFlag.attach(&mShared->wakeLockFlag);
+
+    mRunning = true;
+    pthread_create(&mPollThread, NULL, pollThread, this);
+    pthread_create(&mWakeLockThread, NULL, wakeLockThread, this);
+
+    LOGI("hal2 adapter started: %zu events, %zu wake lock acks", eventQueueSize, wakeLockQueueSize);
+    return 0;
+}
+
+void SensorsHal2Adapter::stop()
+{
+    if (!mRunning)
+        return;
+
+    mRunning = false;
+    sensors_poll_wake(mDevice);
+    mEventFlag.wake(EVENT_QUEUE_FLAG_EVENTS_READ);
+    mWakeLockFlag.wake(WAKE_LOCK_QUEUE_FLAG_DATA_WRITTEN);
+    pthread_join(mPollThread, NULL);
+    pthread_join(mWakeLockThread, NULL);
+
+    if (mWakeLockHeld) {
+        writeWakeLock("/sys/power/wake_unlock");
+        mWakeLockHeld = false;
+    }
+    munmap(mShared, mSize);
+    mShared = NULL;
+    close(mFd);
+    mFd = -1;
+}
+
+void* SensorsHal2Adapter::pollThread(void* arg)
+{
+    ((SensorsHal2Adapter*)arg)->pollLoop();
+    return NULL;
+}
+
+void* SensorsHal2Adapter::wakeLockThread(void* arg)
+{
+    ((SensorsHal2Adapter*)arg)->wakeLockLoop();
+    return NULL;
+}
+
+int SensorsHal2Adapter::countWakeUpEvents(const sensors_event_t* data, int count) const
+{
+    int wakeUp = 0;
+    for (int i = 0; i < count; i++) {
+        int handle = data[i].type == SENSOR_TYPE_META_DATA ?
+                data[i].meta_data.sensor : data[i].sensor;
+        for (int j = 0; j < mSensorCount; j++) {
+            if (mSensorList[j].handle == handle) {
+                if (mSensorList[j].flags & SENSOR_FLAG_WAKE_UP)
+                    wakeUp++;
+                break;
+            }
+        }
+    }
+    return wakeUp;
+}
+
+void SensorsHal2Adapter::updateWakeLock(int delta)
+{
+    pthread_mutex_lock(&mWakeLock);
+    int64_t now = SensorClock::get()->boottime();
+
+    if (delta > 0) {
+        mOutstandingWakeEvents += delta;
+        mLastWakeEventTime = now;
+    } else {
+        mOutstandingWakeEvents += delta;
+        if (mOutstandingWakeEvents < 0 ||
+                now - mLastWakeEventTime >= WAKE_LOCK_TIMEOUT_NS)
+            mOutstandingWakeEvents = 0;
+    }
+
+    if (mOutstandingWakeEvents > 0 && !mWakeLockHeld) {
+        writeWakeLock("/sys/power/wake_lock");
+        mWakeLockHeld = true;
+    } else if (mOutstandingWakeEvents == 0 && mWakeLockHeld) {
+        writeWakeLock("/sys/power/wake_unlock");
+        mWakeLockHeld = false;
+    }
+    pthread_mutex_unlock(&mWakeLock);
+}
+
+void SensorsHal2Adapter::pollLoop()
+{
+    sensors_event_t buffer[POLL_BUFFER_EVENTS];
+
+    while (mRunning) {
+        int n = mDevice->poll(&mDevice->v0, buffer, POLL_BUFFER_EVENTS);
+        if (n <= 0)
+            continue;
+
+        int wakeUp = countWakeUpEvents(buffer, n);
+        if (wakeUp)
+            updateWakeLock(wakeUp);
+
+        size_t written = 0;
+        while (written < (size_t)n && mRunning) {
+            size_t chunk = mEventQueue.availableToWrite();
+            if (chunk > n - written)
+                chunk = n - written;
+            if (chunk) {
+                mEventQueue.write(buffer + written, chunk);
+                written += chunk;
+                mEventFlag.wake(EVENT_QUEUE_FLAG_READ_AND_PROCESS);
+            } else {
+                /* queue full: wait for the client to drain it */
+                uint32_t bits;
+                mEventFlag.wait(EVENT_QUEUE_FLAG_EVENTS_READ, &bits, WRITE_RETRY_TIMEOUT_NS);
+            }
+        }
+    }
+}
+
+void SensorsHal2Adapter::wakeLockLoop()
+{
+    while (mRunning) {
+        uint32_t bits;
+        mWakeLockFlag.wait(WAKE_LOCK_QUEUE_FLAG_DATA_WRITTEN, &bits, WAKE_LOCK_TIMEOUT_NS);
+
+        int64_t acked = 0;
+        uint32_t ack;
+        while (mWakeLockQueue.availableToRead() && mWakeLockQueue.read(&ack, 1))
+            acked += ack;
+        updateWakeLock(-(int)acked);
+    }
+}
+
+/*****************************************************************************/
+
+SensorsHal2Client::SensorsHal2Client()
+    : mBase(MAP_FAILED),
+      mSize(0)
+{
+}
+
+SensorsHal2Client::~SensorsHal2Client()
+{
+    if (mBase != MAP_FAILED)
+        munmap(mBase, mSize);
+}
+
+int SensorsHal2Client::attach(int fd)
+{
+    SensorsHal2Shared hdr;
+    void* base = mmap(NULL, sizeof(hdr), PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+        return -errno;
+    uint32_t magic = ((SensorsHal2Shared*)base)->magic;
+    uint32_t size = ((SensorsHal2Shared*)base)->size;
+    munmap(base, sizeof(hdr));
+    if (magic != SENSORS_HAL2_MAGIC)
+        return -EINVAL;
+
+    mBase = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mBase == MAP_FAILED)
+        return -errno;
+    mSize = size;
+
+    SensorsHal2Shared* shared = (SensorsHal2Shared*)mBase;
+    char* p = (char*)mBase;
+    FmqRingHeader* eventHeader = (FmqRingHeader*)(p + shared->eventQueueOffset);
+    FmqRingHeader* wakeLockHeader = (FmqRingHeader*)(p + shared->wakeLockQueueOffset);
+    mEventQueue.attach(eventHeader, (sensors_event_t*)(eventHeader + 1));
+    mWakeLockQueue.attach(wakeLockHeader, (uint32_t*)(wakeLockHeader + 1));
+    mEventFlag.attach(&shared->eventFlag);
+    mWakeLockFlag.attach(&shared->wakeLockFlag);
+
+    if (!mEventQueue.isValid() || !mWakeLockQueue.isValid())
+        return -EINVAL;
+    return 0;
+}
+
+int SensorsHal2Client::readEvents(sensors_event_t* data, int count, int64_t timeoutNs)
+{
+    size_t available = mEventQueue.availableToRead();
+    if (!available) {
+        uint32_t bits;
+        int err = mEventFlag.wait(EVENT_QUEUE_FLAG_READ_AND_PROCESS, &bits, timeoutNs);
+        if (err < 0)
+            return err == -ETIMEDOUT ? 0 : err;
+        available = mEventQueue.availableToRead();
+    }
+
+    if (available > (size_t)count)
+        available = count;
+    if (!available || !mEventQueue.read(data, available))
+        return 0;
+
+    mEventFlag.wake(EVENT_QUEUE_FLAG_EVENTS_READ);
+    return available;
+}
+
+int SensorsHal2Client::ackWakeUpEvents(uint32_t count)
+{
+    if (!mWakeLockQueue.write(&count, 1))
+        return -EAGAIN;
+    mWakeLockFlag.wake(WAKE_LOCK_QUEUE_FLAG_DATA_WRITTEN);
+    return 0;
+}
+
+/*****************************************************************************/
+
+void* sensors_hal2_start(struct sensors_poll_device_1* dev, size_t eventQueueSize, int* fd)
+{
+    SensorsHal2Adapter* adapter = new SensorsHal2Adapter(dev);
+    if (adapter->start(eventQueueSize, eventQueueSize) < 0) {
+        delete adapter;
+        return NULL;
+    }
+    *fd = adapter->getFd();
+    return adapter;
+}
+
+void sensors_hal2_stop(void* adapter)
+{
+    delete (SensorsHal2Adapter*)adapter;
+}
+
+void* sensors_hal2_client_attach(int fd)
+{
+    SensorsHal2Client* client = new SensorsHal2Client();
+    int err = client->attach(fd);
+    if (err < 0) {
+        LOGE("couldn't attach to the hal2 event queue (%s)", strerror(-err));
+        delete client;
+        return NULL;
+    }
+    return client;
+}
+
+int sensors_hal2_client_read(void* client, sensors_event_t* data, int count, int64_t timeoutNs)
+{
+    return ((SensorsHal2Client*)client)->readEvents(data, count, timeoutNs);
+}
+
+int sensors_hal2_client_ack(void* client, uint32_t count)
+{
+    return ((SensorsHal2Client*)client)->ackWakeUpEvents(count);
+}
+
+void sensors_hal2_client_detach(void* client)
+{
+    delete (SensorsHal2Client*)client;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSORS_HAL2_H
+#define ANDROID_SENSORS_HAL2_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <atomic>
+
+#include <hardware/sensors.h>
+
+#include "SensorsFmq.h"
+
+/*****************************************************************************/
+
+#define SENSORS_HAL2_MAGIC      0x32484d46  // "FMH2"
+#define SENSORS_HAL2_VERSION    1
+
+/*
+ * Layout of the shared region. The event queue and the wake lock queue
+ * each start with a FmqRingHeader followed by their element array.
+ */
+struct SensorsHal2Shared {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t eventQueueOffset;
+    uint32_t wakeLockQueueOffset;
+    uint32_t reserved;
+    std::atomic<uint32_t> eventFlag;
+    std::atomic<uint32_t> wakeLockFlag;
+};
+
+/*
+ * HAL side: drains the legacy poll() interface of a sensors_poll_device_1
+ * on its own thread into the event queue, and holds a wake lock while
+ * wake-up events are outstanding, i.e. until the client acknowledges them
+ * through the wake lock queue (or one second passes, as in HAL 2.0).
+ */
+class SensorsHal2Adapter {
+public:
+            SensorsHal2Adapter(sensors_poll_device_1_t* device);
+            ~SensorsHal2Adapter();
+
+    int start(size_t eventQueueSize, size_t wakeLockQueueSize);
+    void stop();
+    int getFd() const { return mFd; }
+
+private:
+    static void* pollThread(void* arg);
+    static void* wakeLockThread(void* arg);
+    void pollLoop();
+    void wakeLockLoop();
+    int countWakeUpEvents(const sensors_event_t* data, int count) const;
+    void updateWakeLock(int delta);
+
+    sensors_poll_device_1_t* mDevice;
+    const struct sensor_t* mSensorList;
+    int mSensorCount;
+
+    int mFd;
+    size_t mSize;
+    SensorsHal2Shared* mShared;
+    MessageQueue<sensors_event_t> mEventQueue;
+    MessageQueue<uint32_t> mWakeLockQueue;
+    EventFlag mEventFlag;
+    EventFlag mWakeLockFlag;
+
+    /* cleared by stop(), read by both threads */
+    std::atomic<bool> mRunning;
+    pthread_t mPollThread;
+    pthread_t mWakeLockThread;
+
+    pthread_mutex_t mWakeLock;
+    int64_t mOutstandingWakeEvents;
+    int64_t mLastWakeEventTime;
+    bool mWakeLockHeld;
+};
+
+/*
+ * Reader side, for a local client that got the fd from the adapter.
+ */
+class SensorsHal2Client {
+public:
+            SensorsHal2Client();
+            ~SensorsHal2Client();
+
+    int attach(int fd);
+    int readEvents(sensors_event_t* data, int count, int64_t timeoutNs);
+    int ackWakeUpEvents(uint32_t count);
+
+private:
+    void* mBase;
+    size_t mSize;
+    MessageQueue<sensors_event_t> mEventQueue;
+    MessageQueue<uint32_t> mWakeLockQueue;
+    EventFlag mEventFlag;
+    EventFlag mWakeLockFlag;
+};
+
+/*****************************************************************************/
+
+__BEGIN_DECLS
+
+/* start an adapter on an open device; *fd receives the shared memory fd */
+void* sensors_hal2_start(struct sensors_poll_device_1* dev, size_t eventQueueSize, int* fd);
+void sensors_hal2_stop(void* adapter);
+
+/* the reader side of that fd, e.g. for sensor_stream -q */
+void* sensors_hal2_client_attach(int fd);
+int sensors_hal2_client_read(void* client, sensors_event_t* data, int count, int64_t timeoutNs);
+int sensors_hal2_client_ack(void* client, uint32_t count);
+void sensors_hal2_client_detach(void* client);
+
+__END_DECLS
+
+#endif  // ANDROID_SENSORS_HAL2_H
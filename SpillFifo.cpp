@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "nusensors.h"
+#include "SpillFifo.h"
+#include "SensorClock.h"
+
+/*****************************************************************************/
+
+#define SPILL_MAGIC     0x4c505341      /* "ASPL" */
+#define SPILL_VERSION   1
+
+static inline int16_t clampAxis(int v)
+{
+    return v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v);
+}
+
+/* blocks from another boot carry timestamps of another clock */
+static void readBootId(char* id, size_t size)
+{
+    memset(id, 0, size);
+    int fd = ::open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    ssize_t n = read(fd, id, size - 1);
+    close(fd);
+    if (n > 0 && id[n - 1] == '\n')
+        id[n - 1] = '\0';
+}
+
+SpillFifo::SpillFifo()
+    : mPageSize(sysconf(_SC_PAGESIZE)),
+      mFd(-1),
+      mMap(NULL),
+      mLength(0),
+      mHeader(NULL),
+      mBlocks(0),
+      mHot(NULL),
+      mHotRead(0),
+      mSize(0),
+      mSyncInterval(0),
+      mLastSync(0),
+      mDirty(false)
+{
+    /* a block fills exactly one page, so appending one writes one page */
+    mBlockSamples = (mPageSize - sizeof(Block)) / sizeof(Record);
+    readBootId(mBootId, sizeof(mBootId));
+}
+
+SpillFifo::~SpillFifo()
+{
+    close();
+}
+
+int SpillFifo::open(const char* path, int samples, int64_t syncInterval)
+{
+    int err;
+
+    close();
+    if (samples <= 0)
+        return -EINVAL;
+
+    mBlocks = (samples + mBlockSamples - 1) / mBlockSamples;
+    if (mBlocks < 2)
+        mBlocks = 2;
+    mLength = mPageSize + (size_t)mBlocks * mPageSize;
+    mSyncInterval = syncInterval;
+
+    mFd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (mFd < 0) {
+        err = -errno;
+        LOGE("couldn't open spill file %s (%s)", path, strerror(errno));
+        return err;
+    }
+    /* claim the blocks now, so a full partition can't fail a batch later */
+    err = ftruncate(mFd, mLength) < 0 ? -errno : -posix_fallocate(mFd, 0, mLength);
+    if (err == -EOPNOTSUPP) {
+        LOGW("spill file %s can't be preallocated, left sparse", path);
+    } else if (err) {
+        LOGE("couldn't allocate %zu bytes for spill file %s (%s)", mLength, path, strerror(-err));
+        close();
+        return err;
+    }
+
+    void* map = mmap(NULL, mLength, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (map == MAP_FAILED) {
+        err = -errno;
+        LOGE("couldn't map spill file %s (%s)", path, strerror(errno));
+        close();
+        return err;
+    }
+    mMap = (uint8_t*)map;
+    /* delivery reads the blocks front to back */
+    madvise(mMap, mLength, MADV_SEQUENTIAL);
+    mHeader = (Header*)mMap;
+    mHot = (Block*)new uint8_t[mPageSize];
+    mHot->count = 0;
+    mHotRead = 0;
+    mLastSync = SensorClock::get()->uptime();
+
+    if (recover()) {
+        LOGI("spill file %s: %d samples kept from before a restart", path, mSize);
+    } else {
+        memset(mHeader, 0, sizeof(*mHeader));
+        mHeader->magic = SPILL_MAGIC;
+        mHeader->version = SPILL_VERSION;
+        mHeader->blockSamples = mBlockSamples;
+        mHeader->blocks = mBlocks;
+        memcpy(mHeader->bootId, mBootId, sizeof(mHeader->bootId));
+        mSize = 0;
+        mDirty = true;
+    }
+    return 0;
+}
+
+/* take over what a previous process of this boot wrote, if it all checks out */
+bool SpillFifo::recover()
+{
+    const Header* h = mHeader;
+
+    if (h->magic != SPILL_MAGIC || h->version != SPILL_VERSION ||
+            h->blockSamples != (uint32_t)mBlockSamples || h->blocks != mBlocks ||
+            !mBootId[0] || memcmp(h->bootId, mBootId, sizeof(h->bootId)) ||
+            h->head >= mBlocks || h->used > mBlocks)
+        return false;
+
+    int size = 0;
+    for (uint32_t i = 0; i < h->used; i++) {
+        const Block* b = block((h->head + i) % mBlocks);
+        if (b->count == 0 || b->count > (uint32_t)mBlockSamples)
+            return false;
+        size += b->count;
+    }
+    if (h->used && h->read >= block(h->head)->count)
+        return false;
+    mSize = size - (h->used ? h->read : 0);
+    return true;
+}
+
+void SpillFifo::close()
+{
+    if (mMap) {
+        sync(true);
+        munmap(mMap, mLength);
+    }
+    if (mFd >= 0)
+        ::close(mFd);
+    delete [] (uint8_t*)mHot;
+    mFd = -1;
+    mMap = NULL;
+    mHeader = NULL;
+    mHot = NULL;
+    mSize = 0;
+}
+
+void SpillFifo::clear()
+{
+    if (!isOpen())
+        return;
+    mHeader->head = mHeader->used = mHeader->read = 0;
+    mHot->count = 0;
+    mHotRead = 0;
+    mSize = 0;
+    mDirty = true;
+}
+
+/* append the hot block to the file, dropping the oldest block when it's full */
+bool SpillFifo::commit()
+{
+    Header* h = mHeader;
+    bool kept = true;
+
+    if (h->used == mBlocks) {
+        mSize -= block(h->head)->count - h->read;
+        h->head = (h->head + 1) % mBlocks;
+        h->used--;
+        h->read = 0;
+        kept = false;
+    }
+
+    Block* b = block((h->head + h->used) % mBlocks);
+    memcpy(b, mHot, sizeof(Block) + mHot->count * sizeof(Record));
+    if (!h->used)
+        h->read = mHotRead;
+    /* only counted once its records are in place */
+    h->used++;
+
+    mHot->count = 0;
+    mHotRead = 0;
+    mDirty = true;
+    sync(false);
+    return kept;
+}
+
+/* start writeback of the dirty pages, no more often than the sync interval */
+void SpillFifo::sync(bool force)
+{
+    if (!mDirty)
+        return;
+    int64_t now = SensorClock::get()->uptime();
+    if (!force && now - mLastSync < mSyncInterval)
+        return;
+    if (sync_file_range(mFd, 0, 0, SYNC_FILE_RANGE_WRITE) < 0)
+        LOGW("spill file writeback failed (%s)", strerror(errno));
+    mLastSync = now;
+    mDirty = false;
+}
+
+bool SpillFifo::push(int64_t timestamp, const int raw[3])
+{
+    if (!isOpen())
+        return false;
+
+    bool kept = true;
+    /* a new block when this one is full or the delta doesn't fit in 32 bits */
+    if (mHot->count && (mHot->count == (uint32_t)mBlockSamples || timestamp < mHot->base ||
+            timestamp - mHot->base > (int64_t)UINT32_MAX))
+        kept = commit();
+    if (!mHot->count)
+        mHot->base = timestamp;
+
+    Record* r = records(mHot) + mHot->count++;
+    r->axis[0] = clampAxis(raw[0]);
+    r->axis[1] = clampAxis(raw[1]);
+    r->axis[2] = clampAxis(raw[2]);
+    r->delta = (uint32_t)(timestamp - mHot->base);
+    mSize++;
+    return kept;
+}
+
+void SpillFifo::front(int64_t* timestamp, int raw[3]) const
+{
+    /* the file holds the older samples; the hot block is read once it's empty */
+    Block* b = mHeader->used ? block(mHeader->head) : mHot;
+    const Record* r = records(b) + (mHeader->used ? mHeader->read : mHotRead);
+    *timestamp = b->base + r->delta;
+    raw[0] = r->axis[0];
+    raw[1] = r->axis[1];
+    raw[2] = r->axis[2];
+}
+
+void SpillFifo::pop()
+{
+    if (!mSize)
+        return;
+
+    Header* h = mHeader;
+    mSize--;
+    if (!h->used) {
+        if (++mHotRead == mHot->count)
+            mHot->count = mHotRead = 0;
+        return;
+    }
+    if (++h->read == block(h->head)->count) {
+        h->head = (h->head + 1) % mBlocks;
+        h->used--;
+        h->read = 0;
+    }
+    mDirty = true;
+}
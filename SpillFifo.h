@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SPILL_FIFO_H
+#define ANDROID_SPILL_FIFO_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Batching storage for long latencies, kept in a preallocated file mapped
+ * into memory instead of the heap. Samples collect in one page-sized block
+ * in RAM, the hot window; a full block is appended to the file whole and
+ * read back from the mapping in order, so its pages are page cache the
+ * kernel can reclaim, and they outlive a restart of the process. Each
+ * page is written once per pass over the file, and writeback is started
+ * at most once per sync interval. A restart loses the hot window only;
+ * a reboot loses everything, since the timestamps no longer apply.
+ *
+ * Same records as CompactFifo, and the oldest block is dropped when full.
+ */
+class SpillFifo {
+public:
+            SpillFifo();
+            ~SpillFifo();
+
+    /* map path with room for at least samples; what this boot left there is kept */
+    int open(const char* path, int samples, int64_t syncInterval);
+    void close();
+    bool isOpen() const { return mMap != 0; }
+
+    int capacity() const { return isOpen() ? (mBlocks + 1) * mBlockSamples : 0; }
+    int size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+    /* within a block of dropping samples */
+    bool nearlyFull() const { return isOpen() && mSize > capacity() - mBlockSamples; }
+
+    /* false when the oldest samples had to be dropped to make room */
+    bool push(int64_t timestamp, const int raw[3]);
+    /* oldest sample; only valid when not empty */
+    void front(int64_t* timestamp, int raw[3]) const;
+    void pop();
+    void clear();
+
+private:
+    struct Record {
+        int16_t axis[3];
+        uint32_t delta;
+    } __attribute__((packed));
+
+    struct Block {
+        int64_t base;
+        uint32_t count;
+        uint32_t reserved;
+    };
+
+    /* first page of the file; blocks follow it */
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t blockSamples;
+        uint32_t blocks;
+        char bootId[40];
+        uint32_t head;          // oldest block
+        uint32_t used;          // blocks written
+        uint32_t read;          // records of the head block already popped
+    };
+
+    Block* block(uint32_t index) const {
+        return (Block*)(mMap + mPageSize + (size_t)index * mPageSize);
+    }
+    static Record* records(Block* b) { return (Record*)(b + 1); }
+
+    bool recover();
+    bool commit();
+    void sync(bool force);
+
+    size_t mPageSize;
+    int mBlockSamples;
+    int mFd;
+    uint8_t* mMap;
+    size_t mLength;
+    Header* mHeader;
+    uint32_t mBlocks;
+    Block* mHot;                // block being filled, in RAM
+    uint32_t mHotRead;          // records popped from it while the file is empty
+    int mSize;
+    char mBootId[40];
+    int64_t mSyncInterval;
+    int64_t mLastSync;
+    bool mDirty;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SPILL_FIFO_H
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "TimestampFilter.h"
+
+/*****************************************************************************/
+
+TimestampFilter::TimestampFilter()
+{
+    reset(0);
+}
+
+void TimestampFilter::reset(int64_t expectedPeriodNs)
+{
+    mCount = 0;
+    mNext = 0;
+    mSampleIndex = 0;
+    mLastRaw = 0;
+    mLastOut = 0;
+    mPeriod = expectedPeriodNs;
+    mSlope = expectedPeriodNs;
+    mIntercept = 0;
+    mBaseRaw = 0;
+    mBaseIndex = 0;
+}
+
+void TimestampFilter::restart(int64_t rawNs)
+{
+    mSampleIndex = 0;
+    mRaw[0] = rawNs;
+    mIndex[0] = 0;
+    mCount = 1;
+    mNext = 1;
+}
+
+void TimestampFilter::fit()
+{
+    int oldest = mCount < kWindow ? 0 : mNext;
+    mBaseRaw = mRaw[oldest];
+    mBaseIndex = mIndex[oldest];
+
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i = 0; i < mCount; i++) {
+        double x = mIndex[i] - mBaseIndex;
+        double y = mRaw[i] - mBaseRaw;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+
+    double n = mCount;
+    double den = n * sxx - sx * sx;
+    if (den <= 0)
+        return;
+    mSlope = (n * sxy - sx * sy) / den;
+    mIntercept = (sy - mSlope * sx) / n;
+
+    /*
+     * Interrupt latency only ever delays a sample, so slide the line down
+     * onto the earliest point in the window rather than the mean.
+     */
+    double minResidual = 0;
+    for (int i = 0; i < mCount; i++) {
+        double r = (mRaw[i] - mBaseRaw) - (mIntercept + mSlope * (mIndex[i] - mBaseIndex));
+        if (r < minResidual)
+            minResidual = r;
+    }
+    mIntercept += minResidual;
+}
+
+/*
+ * Median interval of the samples so far, to tell gaps from the rate before
+ * the line is locked; the requested period may be far from the real one.
+ */
+double TimestampFilter::warmupPeriod() const
+{
+    double intervals[kLockSamples];
+    int n = 0;
+
+    /* not locked yet, so the window hasn't wrapped */
+    for (int i = 1; i < mCount && n < kLockSamples; i++)
+        intervals[n++] = (double)(mRaw[i] - mRaw[i - 1]) / (mIndex[i] - mIndex[i - 1]);
+    if (!n)
+        return 0;
+    std::nth_element(intervals, intervals + n / 2, intervals + n);
+    return intervals[n / 2];
+}
+
+int64_t TimestampFilter::filter(int64_t rawNs)
+{
+    int64_t out = rawNs;
+
+    if (mCount == 0) {
+        restart(rawNs);
+    } else {
+        /* a gap (missed samples, stall) advances the index by the periods lost */
+        int64_t index = mSampleIndex + 1;
+        double period = isLocked() ? mSlope : warmupPeriod();
+        if (period > 0) {
+            int64_t step = llround((rawNs - mLastRaw) / period);
+            if (step > 1)
+                index = mSampleIndex + step;
+        }
+
+        double error = 0;
+        if (isLocked())
+            error = rawNs - (mBaseRaw + mIntercept + mSlope * (index - mBaseIndex));
+
+        if (error > 2 * mSlope || error < -2 * mSlope) {
+            /* the rate moved under us: re-lock from this sample */
+            restart(rawNs);
+        } else {
+            mSampleIndex = index;
+            mRaw[mNext] = rawNs;
+            mIndex[mNext] = index;
+            mNext = (mNext + 1) % kWindow;
+            if (mCount < kWindow)
+                mCount++;
+            if (mCount >= 2)
+                fit();
+
+            if (isLocked()) {
+                mPeriod = llround(mSlope);
+                out = llround(mBaseRaw + mIntercept + mSlope * (index - mBaseIndex));
+                if (out > rawNs)
+                    out = rawNs;
+            }
+        }
+    }
+
+    if (out <= mLastOut)
+        out = mLastOut + 1;
+    mLastRaw = rawNs;
+    mLastOut = out;
+    return out;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_TIMESTAMP_FILTER_H
+#define ANDROID_TIMESTAMP_FILTER_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Smooths the timestamps of a fixed-rate stream. A least-squares line is
+ * fitted through the last kWindow (sample index, raw timestamp) pairs; its
+ * slope is the measured output data rate, and each sample is stamped from
+ * the line instead of its jittery interrupt time. Output timestamps are
+ * strictly increasing and never later than the raw ones.
+ */
+class TimestampFilter {
+public:
+            TimestampFilter();
+
+    /* call on every rate change or (re)enable */
+    void reset(int64_t expectedPeriodNs);
+    int64_t filter(int64_t rawNs);
+
+    bool isLocked() const { return mCount >= kLockSamples; }
+    /* measured sampling period, or the requested one until locked */
+    int64_t getPeriod() const { return mPeriod; }
+
+private:
+    static const int kWindow = 32;
+    static const int kLockSamples = 8;
+
+    void restart(int64_t rawNs);
+    void fit();
+    double warmupPeriod() const;
+
+    int64_t mRaw[kWindow];
+    int64_t mIndex[kWindow];
+    int mCount;
+    int mNext;
+    int64_t mSampleIndex;
+    int64_t mLastRaw;
+    int64_t mLastOut;
+
+    int64_t mPeriod;
+    double mSlope;
+    double mIntercept;      // relative to mRaw/mIndex of the oldest entry
+    int64_t mBaseRaw;
+    int64_t mBaseIndex;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_TIMESTAMP_FILTER_H
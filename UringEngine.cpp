@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "nusensors.h"
+#include "UringEngine.h"
+
+/* the uapi header and the syscalls reached bionic with Android 11 */
+#if PLATFORM_SDK_VERSION >= 30 && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#else
+#define HAVE_IO_URING 0
+#endif
+
+/*****************************************************************************/
+
+static inline uint64_t userData(int index, int op)
+{
+    return ((uint64_t)index << 8) | op;
+}
+
+UringEngine::UringEngine(int nfds)
+    : mRingFd(-1),
+      mNumSlots(nfds),
+      mPending(0),
+      mSqRing(MAP_FAILED),
+      mCqRing(MAP_FAILED),
+      mSqes(MAP_FAILED)
+{
+    mSlots = new Slot[nfds];
+    for (int i = 0; i < nfds; i++) {
+        mSlots[i].state = idle;
+        mSlots[i].fd = -1;
+        mSlots[i].reading = false;
+    }
+
+    /* a poll and a linked read, or two cancels, per fd, and a timeout */
+    unsigned int entries = 1;
+    while (entries < (unsigned int)nfds * 2 + 1)
+        entries <<= 1;
+    if (!setup(entries) && mRingFd >= 0) {
+        close(mRingFd);
+        mRingFd = -1;
+    }
+}
+
+UringEngine::~UringEngine()
+{
+#if HAVE_IO_URING
+    /* reads in flight target driver buffers: get them all back before those go away */
+    if (mRingFd >= 0) {
+        for (int i = 0; i < mNumSlots; i++) {
+            if (mSlots[i].state == armed)
+                cancel(i);
+        }
+        for (int tries = 0; tries < 8 && (mPending || busy()); tries++) {
+            queueTimeout(100);
+            enter(mPending, 1);
+            reap(NULL, NULL, 0);
+        }
+    }
+    if (mSqes != MAP_FAILED)
+        munmap(mSqes, mSqesSize);
+    if (mCqRing != MAP_FAILED && mCqRing != mSqRing)
+        munmap(mCqRing, mCqRingSize);
+    if (mSqRing != MAP_FAILED)
+        munmap(mSqRing, mSqRingSize);
+#endif
+    if (mRingFd >= 0)
+        close(mRingFd);
+    delete [] mSlots;
+}
+
+#if HAVE_IO_URING
+
+bool UringEngine::setup(unsigned int entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    mRingFd = syscall(__NR_io_uring_setup, entries, &p);
+    if (mRingFd < 0) {
+        LOGI("io_uring unavailable (%s), using poll()", strerror(errno));
+        return false;
+    }
+
+    /* reads, polls, cancels and timeouts all have to be there, or none is used */
+    static const int needed[] = {
+        IORING_OP_READ, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL, IORING_OP_TIMEOUT,
+    };
+    size_t probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, probeSize);
+    bool supported = probe &&
+            syscall(__NR_io_uring_register, mRingFd, IORING_REGISTER_PROBE, probe, 256) >= 0;
+    for (size_t i = 0; supported && i < sizeof(needed) / sizeof(needed[0]); i++) {
+        supported = needed[i] <= probe->last_op &&
+                (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    if (!supported) {
+        LOGI("io_uring lacks read/poll/cancel/timeout, using poll()");
+        return false;
+    }
+
+    mSqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    mCqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (mCqRingSize > mSqRingSize)
+            mSqRingSize = mCqRingSize;
+        mCqRingSize = mSqRingSize;
+    }
+    mSqRing = mmap(NULL, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            mRingFd, IORING_OFF_SQ_RING);
+    if (mSqRing == MAP_FAILED)
+        goto error;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        mCqRing = mSqRing;
+    } else {
+        mCqRing = mmap(NULL, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                mRingFd, IORING_OFF_CQ_RING);
+        if (mCqRing == MAP_FAILED)
+            goto error;
+    }
+    mSqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    mSqes = mmap(NULL, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            mRingFd, IORING_OFF_SQES);
+    if (mSqes == MAP_FAILED)
+        goto error;
+
+    mSqHead = (unsigned int*)((char*)mSqRing + p.sq_off.head);
+    mSqTail = (unsigned int*)((char*)mSqRing + p.sq_off.tail);
+    mSqMask = *(unsigned int*)((char*)mSqRing + p.sq_off.ring_mask);
+    mSqEntries = p.sq_entries;
+    mSqArray = (unsigned int*)((char*)mSqRing + p.sq_off.array);
+    mCqHead = (unsigned int*)((char*)mCqRing + p.cq_off.head);
+    mCqTail = (unsigned int*)((char*)mCqRing + p.cq_off.tail);
+    mCqMask = *(unsigned int*)((char*)mCqRing + p.cq_off.ring_mask);
+    mCqes = (char*)mCqRing + p.cq_off.cqes;
+
+    LOGI("io_uring engine: %u entries for %d fds", p.sq_entries, mNumSlots);
+    return true;
+
+error:
+    LOGE("couldn't map io_uring rings (%s), using poll()", strerror(errno));
+    return false;
+}
+
+void* UringEngine::getSqe()
+{
+    unsigned int tail = *mSqTail;
+    if (tail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE) >= mSqEntries) {
+        /* full: hand what we have to the kernel first */
+        if (enter(mPending, 0) < 0)
+            return NULL;
+        if (tail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE) >= mSqEntries)
+            return NULL;
+    }
+
+    unsigned int index = tail & mSqMask;
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)mSqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    mSqArray[index] = index;
+    __atomic_store_n(mSqTail, tail + 1, __ATOMIC_RELEASE);
+    mPending++;
+    return sqe;
+}
+
+int UringEngine::enter(unsigned int submit, unsigned int minComplete)
+{
+    unsigned int flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+    int ret = syscall(__NR_io_uring_enter, mRingFd, submit, minComplete, flags, NULL, 0);
+    if (ret < 0)
+        return errno == EINTR || errno == ETIME ? 0 : -errno;
+    mPending -= ret < (int)submit ? ret : submit;
+    return ret;
+}
+
+/*
+ * One request per fd. Drivers that hand out a buffer get a poll linked
+ * to a read: the poll waits for data, the read then runs at once, even
+ * on O_NONBLOCK fds where a lone read would just fail with EAGAIN.
+ */
+void UringEngine::arm(int index, int fd, SensorBase* driver, struct pollfd* pfd, int* ready)
+{
+    Slot& slot = mSlots[index];
+
+    /* the driver replaced its fd (recovery, injection): retire the old request first */
+    if (slot.state == armed && slot.fd != fd)
+        cancel(index);
+    if (slot.state != idle || fd < 0)
+        return;
+
+    void* buffer = NULL;
+    ssize_t size = driver ? driver->prepareRead(&buffer) : -ENOSYS;
+    if (size == 0) {
+        /* its buffer is full: nothing to wait for until the driver has drained it */
+        pfd->revents |= POLLIN;
+        (*ready)++;
+        return;
+    }
+
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)getSqe();
+    if (!sqe) {
+        /* nothing queued this round: the driver reads for itself */
+        if (size > 0)
+            driver->cancelRead();
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll_events = POLLIN;
+    sqe->user_data = userData(index, size > 0 ? opLinkedPoll : opPoll);
+
+    if (size > 0) {
+        struct io_uring_sqe* read = (struct io_uring_sqe*)getSqe();
+        if (!read) {
+            /* the poll alone still reports readiness, the driver reads for itself */
+            slot.reading = false;
+            driver->cancelRead();
+        } else {
+            sqe->flags |= IOSQE_IO_LINK;
+            read->opcode = IORING_OP_READ;
+            read->fd = fd;
+            read->addr = (uintptr_t)buffer;
+            read->len = size;
+            read->user_data = userData(index, opRead);
+            slot.reading = true;
+        }
+        if (!slot.reading)
+            sqe->user_data = userData(index, opPoll);
+    } else {
+        slot.reading = false;
+    }
+    slot.state = armed;
+    slot.fd = fd;
+}
+
+bool UringEngine::busy() const
+{
+    for (int i = 0; i < mNumSlots; i++) {
+        if (mSlots[i].state != idle)
+            return true;
+    }
+    return false;
+}
+
+/* ends after timeoutMs, or as soon as anything else completes */
+void UringEngine::queueTimeout(int timeoutMs)
+{
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)getSqe();
+    if (!sqe)
+        return;
+    mTimeout.tv_sec = timeoutMs / 1000;
+    mTimeout.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uintptr_t)&mTimeout;
+    sqe->len = 1;
+    sqe->off = 1;
+    sqe->user_data = userData(0, opTimeout);
+}
+
+void UringEngine::cancel(int index)
+{
+    Slot& slot = mSlots[index];
+    const int ops[] = { slot.reading ? opLinkedPoll : opPoll, opRead };
+
+    for (int i = 0; i < (slot.reading ? 2 : 1); i++) {
+        struct io_uring_sqe* sqe = (struct io_uring_sqe*)getSqe();
+        if (!sqe)
+            return;
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = userData(index, ops[i]);
+        sqe->user_data = userData(index, opCancel);
+    }
+    slot.state = cancelling;
+}
+
+int UringEngine::reap(struct pollfd* fds, SensorBase* const* drivers, int nfds)
+{
+    int ready = 0;
+    unsigned int head = *mCqHead;
+    unsigned int tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        const struct io_uring_cqe* cqe = (const struct io_uring_cqe*)mCqes + (head & mCqMask);
+        int index = cqe->user_data >> 8;
+        int op = cqe->user_data & 0xff;
+        int res = cqe->res;
+
+        /* a linked poll is followed by its read, which settles the slot */
+        if (op != opPoll && op != opRead)
+            continue;
+        if (index >= mNumSlots)
+            continue;
+
+        Slot& slot = mSlots[index];
+        bool current = slot.state == armed && index < nfds && fds[index].fd == slot.fd;
+        slot.state = idle;
+
+        if (op == opRead) {
+            /* a read that made it past a cancel still filled the buffer */
+            if (drivers && drivers[index])
+                drivers[index]->completeRead(res);
+            if (res > 0 && current) {
+                fds[index].revents |= POLLIN;
+                ready++;
+            }
+        } else if (res > 0 && current) {
+            fds[index].revents |= res;
+            ready++;
+        } else if (res < 0 && res != -ECANCELED) {
+            LOGE_IF(current, "io_uring poll of fd %d failed (%s)", slot.fd, strerror(-res));
+        }
+    }
+    __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+    return ready;
+}
+
+int UringEngine::wait(struct pollfd* fds, SensorBase* const* drivers, int nfds, int timeoutMs)
+{
+    int ready = 0;
+
+    for (int i = 0; i < nfds && i < mNumSlots; i++) {
+        fds[i].revents = 0;
+        arm(i, fds[i].fd, drivers ? drivers[i] : NULL, &fds[i], &ready);
+    }
+
+    /* completions reaped late in the last round are ready now */
+    bool completed = *mCqHead != __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+    bool block = timeoutMs != 0 && !ready && !completed;
+
+    if (block && timeoutMs > 0)
+        queueTimeout(timeoutMs);
+
+    if (mPending || block) {
+        int err = enter(mPending, block ? 1 : 0);
+        if (err < 0)
+            return err;
+    }
+
+    return ready + reap(fds, drivers, nfds);
+}
+
+#else  // !HAVE_IO_URING
+
+bool UringEngine::setup(unsigned int entries)
+{
+    LOGI("built without io_uring, using poll()");
+    return false;
+}
+
+void* UringEngine::getSqe() { return NULL; }
+int UringEngine::enter(unsigned int submit, unsigned int minComplete) { return -ENOSYS; }
+void UringEngine::arm(int index, int fd, SensorBase* driver, struct pollfd* pfd, int* ready) {}
+void UringEngine::cancel(int index) {}
+bool UringEngine::busy() const { return false; }
+void UringEngine::queueTimeout(int timeoutMs) {}
+int UringEngine::reap(struct pollfd* fds, SensorBase* const* drivers, int nfds) { return 0; }
+
+int UringEngine::wait(struct pollfd* fds, SensorBase* const* drivers, int nfds, int timeoutMs)
+{
+    return poll(fds, nfds, timeoutMs);
+}
+
+#endif  // HAVE_IO_URING
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_URING_ENGINE_H
+#define ANDROID_URING_ENGINE_H
+
+#include <poll.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "SensorBase.h"
+
+/*****************************************************************************/
+
+/*
+ * poll() replacement on io_uring. Every fd keeps one request outstanding
+ * between calls: a read straight into the driver's buffer when the driver
+ * offers one (prepareRead()), a poll otherwise. wait() re-arms only what
+ * completed, submits and waits in a single io_uring_enter(), and reports
+ * completions as POLLIN in revents, so pollEvents() works as with poll().
+ * isValid() is false when the kernel or the platform doesn't provide the
+ * needed io_uring operations; the caller then keeps using poll().
+ */
+class UringEngine {
+public:
+            UringEngine(int nfds);
+            ~UringEngine();
+
+    bool isValid() const { return mRingFd >= 0; }
+
+    /*
+     * Same contract as poll(fds, nfds, timeoutMs). drivers[i] is the
+     * driver behind fds[i], or NULL for plain fds.
+     */
+    int wait(struct pollfd* fds, SensorBase* const* drivers, int nfds, int timeoutMs);
+
+private:
+    enum { idle, armed, cancelling };
+    enum { opPoll = 1, opLinkedPoll, opRead, opTimeout, opCancel };
+
+    struct Slot {
+        int state;
+        int fd;
+        bool reading;
+    };
+
+    bool setup(unsigned int entries);
+    void* getSqe();
+    int enter(unsigned int submit, unsigned int minComplete);
+    void arm(int index, int fd, SensorBase* driver, struct pollfd* pfd, int* ready);
+    void cancel(int index);
+    bool busy() const;
+    void queueTimeout(int timeoutMs);
+    int reap(struct pollfd* fds, SensorBase* const* drivers, int nfds);
+
+    int mRingFd;
+    int mNumSlots;
+    Slot* mSlots;
+    unsigned int mPending;
+
+    void* mSqRing;
+    size_t mSqRingSize;
+    void* mCqRing;
+    size_t mCqRingSize;
+    void* mSqes;
+    size_t mSqesSize;
+
+    unsigned int* mSqHead;
+    unsigned int* mSqTail;
+    unsigned int mSqMask;
+    unsigned int mSqEntries;
+    unsigned int* mSqArray;
+    unsigned int* mCqHead;
+    unsigned int* mCqTail;
+    unsigned int mCqMask;
+    void* mCqes;
+
+    /* layout of __kernel_timespec, read by the kernel at submission */
+    struct {
+        int64_t tv_sec;
+        int64_t tv_nsec;
+    } mTimeout;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_URING_ENGINE_H
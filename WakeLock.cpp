@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nusensors.h"
+#include "WakeLock.h"
+
+/*****************************************************************************/
+
+WakeLock::WakeLock(const char* name)
+    : mName(name),
+      mHeld(false)
+{
+    mLockFd = open("/sys/power/wake_lock", O_WRONLY | O_CLOEXEC);
+    mUnlockFd = open("/sys/power/wake_unlock", O_WRONLY | O_CLOEXEC);
+    if (mLockFd < 0 || mUnlockFd < 0)
+        LOGW("no wake lock access (%s), wake-up events may wait for the next resume",
+                strerror(errno));
+}
+
+WakeLock::~WakeLock()
+{
+    release();
+    if (mLockFd >= 0)
+        close(mLockFd);
+    if (mUnlockFd >= 0)
+        close(mUnlockFd);
+}
+
+void WakeLock::acquire()
+{
+    if (mHeld || mLockFd < 0)
+        return;
+    if (write(mLockFd, mName, strlen(mName)) < 0) {
+        LOGE("couldn't take wake lock %s (%s)", mName, strerror(errno));
+        return;
+    }
+    mHeld = true;
+}
+
+void WakeLock::release()
+{
+    if (!mHeld)
+        return;
+    if (write(mUnlockFd, mName, strlen(mName)) < 0)
+        LOGE("couldn't release wake lock %s (%s)", mName, strerror(errno));
+    mHeld = false;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_WAKE_LOCK_H
+#define ANDROID_WAKE_LOCK_H
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Partial wake lock through /sys/power/wake_lock, taken while wake-up
+ * events are on their way to the framework. Without the sysfs files (no
+ * permission, or a host build) acquire() and release() do nothing.
+ */
+class WakeLock {
+public:
+            WakeLock(const char* name);
+            ~WakeLock();
+
+    void acquire();
+    void release();
+    bool isHeld() const { return mHeld; }
+
+private:
+    const char* mName;
+    int mLockFd;
+    int mUnlockFd;
+    bool mHeld;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_WAKE_LOCK_H
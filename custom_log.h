@@ -56,16 +56,63 @@ extern "C" {
 
 /*-----------------------------------*/
 
+/**
+ * Compile-time log threshold. Every LOGx / D / I / W / E below CUSTOM_LOG_LEVEL
+ * expands to ((void)0), so its format string and arguments are never evaluated.
+ * Override from Android.mk, e.g. "-DCUSTOM_LOG_LEVEL=CUSTOM_LOG_LEVEL_WARN".
+ */
+#define CUSTOM_LOG_LEVEL_VERBOSE    2
+#define CUSTOM_LOG_LEVEL_DEBUG      3
+#define CUSTOM_LOG_LEVEL_INFO       4
+#define CUSTOM_LOG_LEVEL_WARN       5
+#define CUSTOM_LOG_LEVEL_ERROR      6
+#define CUSTOM_LOG_LEVEL_SILENT     7
+
+#ifndef CUSTOM_LOG_LEVEL
+#define CUSTOM_LOG_LEVEL            CUSTOM_LOG_LEVEL_VERBOSE
+#endif
+
+#define CUSTOM_LOG_ON(level)        (CUSTOM_LOG_LEVEL_##level >= CUSTOM_LOG_LEVEL)
+
+/*-----------------------------------*/
+
 #if  PLATFORM_SDK_VERSION >= 16
+
+#if CUSTOM_LOG_ON(VERBOSE)
 #define LOGV(fmt,args...) ALOGV(fmt,##args)
+#else
+#define LOGV(...)  ((void)0)
+#endif
+
+#if CUSTOM_LOG_ON(DEBUG)
 #define LOGD(fmt,args...) ALOGD(fmt,##args)
+#else
+#define LOGD(...)  ((void)0)
+#endif
+
+#if CUSTOM_LOG_ON(INFO)
 #define LOGI(fmt,args...) ALOGI(fmt,##args)
+#else
+#define LOGI(...)  ((void)0)
+#endif
+
+#if CUSTOM_LOG_ON(WARN)
 #define LOGW(fmt,args...) ALOGW(fmt,##args)
+#else
+#define LOGW(...)  ((void)0)
+#endif
+
+#if CUSTOM_LOG_ON(ERROR)
 #define LOGE(fmt,args...) ALOGE(fmt,##args)
 #define LOGE_IF(cond,fmt,args...)	  ALOGE_IF(cond,fmt,##args)
+#else
+#define LOGE(...)  ((void)0)
+#define LOGE_IF(...)  ((void)0)
+#endif
+
 #endif
 
-#ifdef ENABLE_DEBUG_LOG
+#if defined(ENABLE_DEBUG_LOG) && CUSTOM_LOG_ON(DEBUG)
 
 #ifdef LOG_FILE_PATH
 #define D(fmt, args...) \
@@ -82,7 +129,7 @@ extern "C" {
 
 /*-----------------------------------*/
 
-#ifdef ENABLE_DEBUG_LOG
+#if defined(ENABLE_DEBUG_LOG) && CUSTOM_LOG_ON(INFO)
 
 #ifdef LOG_FILE_PATH
 #define I(fmt, args...) \
@@ -96,7 +143,7 @@ extern "C" {
 #endif
 
 /*-----------------------------------*/
-#ifdef ENABLE_DEBUG_LOG
+#if defined(ENABLE_DEBUG_LOG) && CUSTOM_LOG_ON(WARN)
 #ifdef LOG_FILE_PATH
 #define W(fmt, args...) \
     { LOGW("[File] : %s; [Line] : %d; [Func] : %s() ; !! Warning : " fmt, __FILE__, __LINE__, __FUNCTION__, ## args); }
@@ -109,7 +156,7 @@ extern "C" {
 #endif
 
 /*-----------------------------------*/
-#ifdef ENABLE_DEBUG_LOG
+#if defined(ENABLE_DEBUG_LOG) && CUSTOM_LOG_ON(ERROR)
 #ifdef LOG_FILE_PATH
 #define E(fmt, args...) \
     { LOGE("[File] : %s; [Line] : %d; [Func] : %s() ; !!! Error : " fmt, __FILE__, __LINE__, __FUNCTION__, ## args); }
@@ -125,7 +172,7 @@ extern "C" {
 /** 
  * ظеǰλõĴ threshold ߵһε, ӡָ log Ϣ. 
  */
-#ifdef ENABLE_DEBUG_LOG
+#if defined(ENABLE_DEBUG_LOG) && CUSTOM_LOG_ON(DEBUG)
 #define D_WHEN_REPEAT(threshold, fmt, args...) \
     do { \
         static int count = 0; \
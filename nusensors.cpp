@@ -23,18 +23,55 @@
 #include <poll.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <sys/timerfd.h>
+
+#include <algorithm>
 
 #include <linux/input.h>
 
 #include <cutils/atomic.h>
+#include <cutils/properties.h>
 #include <math.h>
 
 #include "nusensors.h"
 #include "Kxtj3Sensor.h"
+#include "IioAccelSensor.h"
+#include "Kxtj3PolledSensor.h"
+#include "Kxtj3I2cSensor.h"
+#include "SensorPipeline.h"
+#include "SensorWatchdog.h"
+#include "BusyPoll.h"
+#include "WakeLock.h"
+#include "MultiHalSensor.h"
+#include "UringEngine.h"
+#include "DriverRegistry.h"
+#include "BoardConfig.h"
 #include "Gsensor.h"
+#include "SensorTrace.h"
+#include "SensorClock.h"
 
 /*****************************************************************************/
 
+/*
+ * The drivers of the poll context: the accel pipeline, whichever backend
+ * it wraps, and the sub-HAL aggregate.
+ */
+typedef DriverRegistry<PipelineSensor, MultiHalSensor> SensorDrivers;
+
+#define SENSOR_ROUTE(handle, type, string_type, name, reserved, flags, driver) \
+    { handle, SensorDrivers::indexOf<driver>(), ((flags) & SENSOR_FLAG_WAKE_UP) != 0, \
+      ((flags) & SENSOR_FLAG_MASK_REPORTING_MODE) != SENSOR_FLAG_CONTINUOUS_MODE },
+static constexpr SensorRoute sSensorRoutes[] = {
+    NUSENSORS_SENSORS(SENSOR_ROUTE)
+};
+#undef SENSOR_ROUTE
+
+static_assert(routesHaveUniqueHandles(sSensorRoutes), "two sensors share a handle");
+static_assert(routesBelow(sSensorRoutes, 1 << SUBHAL_HANDLE_SHIFT),
+        "sensor handle inside the sub-HAL range");
+static_assert(routesServe(sSensorRoutes, SensorDrivers::indexOf<PipelineSensor>()),
+        "no sensor served by the accel pipeline");
+
 struct sensors_poll_context_t {
     sensors_poll_device_1_t device; // must be first
 
@@ -45,64 +82,266 @@ struct sensors_poll_context_t {
     int pollEvents(sensors_event_t* data, int count);
     int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
     int flush(int handle);
+    int setOperationMode(unsigned int mode);
+    int injectSensorData(const sensors_event_t* data);
     bool getInitialized() { return mInitialized; };
+    void wake();
+    void setWatchdogPeriods(int periods);
+    int getWatchdogStats(int handle, struct sensors_watchdog_stats* stats);
+    int setBusyPollWindow(int handle, int64_t ns);
+    void setBusyPollBudget(int percent);
+    int getBusyPollStats(int handle, struct sensors_busy_poll_stats* stats);
+    void setDrainBound(int64_t ns);
+    void getDrainStats(struct sensors_drain_stats* stats);
+    int getRateStats(int handle, struct sensors_rate_stats* stats);
+    int getLaneStats(int lane, struct sensors_lane_stats* stats);
 
 private:
     bool mInitialized;
+    /* read by injectSensorData() on the caller's thread */
+    std::atomic<bool> mInjecting;
+
+    /*
+     * Operation mode switches rewrite the poll fds and the drivers' read
+     * side, so while a thread is in pollEvents() they are handed to it
+     * and applied on its way out; the caller waits for the result.
+     */
+    pthread_mutex_t mModeLock;
+    pthread_cond_t mModeCond;
+    bool mPolling;
+    int mModeRequest;           /* injecting or not, -1 for none */
+    int mModeResult;
 
     enum {
-        light           = 0,
-        proximity       = 1,
-        mma             = 2,
-        akm             = 3,
-        gyro            = 4,
-        pressure        = 5,
-        temperature		= 6,
-        numSensorDrivers,
+        mma             = SensorDrivers::indexOf<PipelineSensor>(),
+        subhal          = SensorDrivers::indexOf<MultiHalSensor>(),
+        numSensorDrivers = SensorDrivers::size,
+        flushPipe       = numSensorDrivers,
+        wakePipe,
+        wakeAlarm,
         numFds,
     };
 
-    static const size_t flushPipe = numFds - 1;
+    /*
+     * Events read from a driver but not yet returned. pollEvents() merges
+     * the heads of these buffers by timestamp, so a busy driver neither
+     * reorders nor starves the others.
+     */
+    static const int driverBufferEvents = 64;
+    /* room past a full buffer for flush completions queued behind it */
+    static const int driverBufferFlushes = 8;
+    struct DriverBuffer {
+        sensors_event_t events[driverBufferEvents + driverBufferFlushes];
+        int head;
+        int tail;
+    };
+
     struct pollfd mPollFds[numFds];
     int mFlushWritePipeFd;
-    SensorBase* mSensors[numSensorDrivers];
+    int mWakeWritePipeFd;
+    SensorDrivers mDrivers;
+    DriverBuffer mBuffers[numSensorDrivers];
+    SensorWatchdog mWatchdogs[numSensorDrivers];
+    /* getSampleCount() of each driver at its last fillBuffer() */
+    uint64_t mSampleCounts[numSensorDrivers];
+    /* replaces poll() when vendor.sensor.io_uring is set and the kernel allows it */
+    UringEngine* mUring;
+    BusyPoll mBusyPolls[numSensorDrivers];
+    /*
+     * Spin window asked for each handle; a driver spins for the longest
+     * among its enabled handles. Only touched on the activate() side.
+     */
+    struct BusyPollWindow {
+        int handle;
+        int64_t ns;
+    };
+    static const int maxBusyPollHandles = 32;
+    BusyPollWindow mBusyPollWindows[maxBusyPollHandles];
+    int mNumBusyPollWindows;
+    SpinBudget mSpinBudget;
+    /* drain-to-fill: keep collecting ready events for up to this long, 0 is off */
+    std::atomic<int64_t> mDrainBound;
+    struct sensors_drain_stats mDrainStats;
+    /* wakes the AP when a wake-up batch is due, held from its read to hand-off */
+    int64_t mAlarmDeadline;
+    WakeLock mWakeLock;
+    /*
+     * Priority lanes: events of these handles, sorted, skip the timestamp
+     * merge and any drain and go out first; mUrgentDrivers has a bit for
+     * each driver serving one.
+     */
+    static const int maxUrgentHandles = 32;
+    int mUrgentHandles[maxUrgentHandles];
+    int mNumUrgentHandles;
+    uint32_t mUrgentDrivers;
+    struct sensors_lane_stats mLaneStats[SENSORS_NUM_LANES];
+
+    int applyOperationMode(bool injecting);
+    void setPolling(bool polling);
+    int pollOnce(sensors_event_t* data, int count);
+    bool hasBufferedEvents() const;
+    static void compactBuffer(DriverBuffer& buf);
+    template <typename Driver>
+    bool fillBuffer(int index, Driver* sensor);
+    int queueFlushCompletions();
+    int mergeEvents(sensors_event_t* data, int count);
+    int takeUrgentEvents(sensors_event_t* data, int count);
+    void addUrgentHandle(int handle);
+    int laneOf(const sensors_event_t& event) const;
+    void countLanes(const sensors_event_t* data, int count);
+    int watchdogTimeout(int64_t now) const;
+    int waitEvents(int64_t timeoutNs);
+    int busyWait(int64_t now, int timeoutMs);
+    int drainEvents(sensors_event_t* data, int count, int64_t start);
+    void checkWatchdogs(int64_t now, const bool fed[]);
+    void armWakeAlarm();
+    bool hasBufferedWakeupEvents() const;
+    void updateBusyPollWindow(int index);
 
     int handleToDriver(int handle) const {
-        switch (handle) {
-            case ID_A:
-                return mma;
-            case ID_M:
-                return akm;	
-            case ID_P:
-                return proximity;
-            case ID_L:
-                return light;	
-            case ID_GY:
-                return gyro;
-            case ID_PR:
-                return pressure;
-            case ID_TMP:
-                return temperature;
+        if (handle >> SUBHAL_HANDLE_SHIFT)
+            return subhal;
+        for (const SensorRoute& route : sSensorRoutes) {
+            if (route.handle == handle)
+                return route.driver;
         }
         return -EINVAL;
     }
+
+    static bool isWakeupEvent(const sensors_event_t& event) {
+        int handle = event.type == SENSOR_TYPE_META_DATA ?
+                event.meta_data.sensor : event.sensor;
+        for (const SensorRoute& route : sSensorRoutes) {
+            if (route.handle == handle)
+                return route.wakeUp;
+        }
+        return false;
+    }
 };
 
 /*****************************************************************************/
 
+/*
+ * Gravity and linear acceleration share the median-filtered accel stream;
+ * each branch is decimated to the rate its own client asked for.
+ */
+static PipelineSensor* createAccelPipeline(SensorBase* accel)
+{
+    PipelineSensor* pipeline = new PipelineSensor(accel, ID_A);
+    int median = pipeline->addStage(PipelineSensor::source, new MedianStage());
+
+    int gravity = pipeline->addStage(median, new LowPassStage(0.2f));
+    gravity = pipeline->addStage(gravity, new DecimateStage());
+    pipeline->addOutput(gravity, ID_GRAV, SENSOR_TYPE_GRAVITY);
+
+    int linear = pipeline->addStage(median, new HighPassStage(0.2f));
+    linear = pipeline->addStage(linear, new DecimateStage());
+    pipeline->addOutput(linear, ID_LA, SENSOR_TYPE_LINEAR_ACCELERATION);
+
+    /* the wake-up accelerometer: same samples, held in a FIFO of its own */
+    int wakeup = pipeline->addStage(PipelineSensor::source, new DecimateStage());
+    pipeline->addWakeupOutput(wakeup, ID_A_WAKE, SENSOR_TYPE_ACCELEROMETER,
+            KXTJ3_WAKE_FIFO_EVENTS);
+
+    return pipeline;
+}
+
 sensors_poll_context_t::sensors_poll_context_t()
+    : mWakeLock("sensors_hal_wakeup")
 {
     mInitialized = false;
-    /* Must clean this up early or else the destructor will make a mess */
-    memset(mSensors, 0, sizeof(mSensors));
+    mInjecting = false;
+    pthread_mutex_init(&mModeLock, NULL);
+    pthread_cond_init(&mModeCond, NULL);
+    mPolling = false;
+    mModeRequest = -1;
+    mModeResult = 0;
+    mUring = NULL;
+    mDrainBound = 0;
+    mAlarmDeadline = 0;
+    memset(&mDrainStats, 0, sizeof(mDrainStats));
+    mNumUrgentHandles = 0;
+    mNumBusyPollWindows = 0;
+    mUrgentDrivers = 0;
+    memset(mLaneStats, 0, sizeof(mLaneStats));
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        /* poll() skips negative fds, so absent drivers cost nothing */
+        mPollFds[i].fd = -1;
+        mPollFds[i].events = POLLIN;
+        mPollFds[i].revents = 0;
+        mBuffers[i].head = mBuffers[i].tail = 0;
+        mSampleCounts[i] = 0;
+    }
 
 
 
-    mSensors[mma] = new Kxtj3Sensor();
-    mPollFds[mma].fd = mSensors[mma]->getFd();
+    /*
+     * the chip itself over i2c when the board leaves it to the HAL, else
+     * prefer a buffered IIO accelerometer, then the gsensor input device,
+     * then sampling /dev/gsensor with GSENSOR_IOCTL_GETDATA
+     */
+    SensorBase* accel = NULL;
+    if (board_config_get()->accel_i2c_bus[0]) {
+        Kxtj3I2cSensor* i2c = new Kxtj3I2cSensor();
+        if (i2c->isValid())
+            accel = i2c;
+        else
+            delete i2c;
+    }
+    if (!accel) {
+        IioAccelSensor* iio = new IioAccelSensor();
+        if (iio->isValid()) {
+            accel = iio;
+        } else {
+            delete iio;
+            accel = new Kxtj3Sensor();
+            if (accel->getFd() < 0) {
+                delete accel;
+                accel = new Kxtj3PolledSensor();
+            }
+        }
+    }
+    mDrivers.get<PipelineSensor>() = createAccelPipeline(accel);
+    mPollFds[mma].fd = mDrivers.get<PipelineSensor>()->getFd();
     mPollFds[mma].events = POLLIN;
     mPollFds[mma].revents = 0;
 
+    /* other vendors' modules from the board config, if any */
+    if (board_config_get()->subhal_count) {
+        MultiHalSensor* multi = new MultiHalSensor();
+        if (multi->isValid()) {
+            mDrivers.get<MultiHalSensor>() = multi;
+            mPollFds[subhal].fd = multi->getFd();
+        } else {
+            delete multi;
+        }
+    }
+
+    /* on-change, one-shot and special sensors take the priority lane */
+    for (const SensorRoute& route : sSensorRoutes) {
+        if (route.urgent)
+            addUrgentHandle(route.handle);
+    }
+    if (mDrivers.get<MultiHalSensor>()) {
+        const struct sensor_t* list;
+        int n = multihal_get_sensors_list(&list);
+        for (int i = 0; i < n; i++) {
+            if ((list[i].flags & SENSOR_FLAG_MASK_REPORTING_MODE) != SENSOR_FLAG_CONTINUOUS_MODE)
+                addUrgentHandle(list[i].handle);
+        }
+    }
+    /* and any handle listed here, e.g. "0,65539" */
+    char lanebuf[PROPERTY_VALUE_MAX];
+    property_get("vendor.sensor.lane.urgent", lanebuf, "");
+    for (char* s = lanebuf; *s; ) {
+        char* end;
+        long handle = strtol(s, &end, 0);
+        if (end == s)
+            break;
+        addUrgentHandle(handle);
+        s = end + strspn(end, ", ");
+    }
+
 
     int flushFds[2];
     int result = pipe(flushFds);
@@ -117,15 +356,52 @@ sensors_poll_context_t::sensors_poll_context_t()
     mPollFds[flushPipe].events = POLLIN;
     mPollFds[flushPipe].revents = 0;
 
+    int wakeFds[2];
+    result = pipe(wakeFds);
+    LOGE_IF(result<0, "error creating wake pipe (%s)", strerror(errno));
+    fcntl(wakeFds[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakeFds[1], F_SETFL, O_NONBLOCK);
+    mWakeWritePipeFd = wakeFds[1];
+
+    mPollFds[wakePipe].fd = wakeFds[0];
+    mPollFds[wakePipe].events = POLLIN;
+    mPollFds[wakePipe].revents = 0;
+
+    /* an alarm clock wakes the AP from suspend; it needs CAP_WAKE_ALARM */
+    int alarmFd = timerfd_create(CLOCK_BOOTTIME_ALARM, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (alarmFd < 0) {
+        LOGW("no wake alarm (%s), wake-up batches wait for the AP to resume", strerror(errno));
+        alarmFd = timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    }
+    mPollFds[wakeAlarm].fd = alarmFd;
+    mPollFds[wakeAlarm].events = POLLIN;
+    mPollFds[wakeAlarm].revents = 0;
+
+    char propbuf[PROPERTY_VALUE_MAX];
+    property_get("vendor.sensor.io_uring", propbuf, "0");
+    if (atoi(propbuf)) {
+        mUring = new UringEngine(numFds);
+        if (!mUring->isValid()) {
+            delete mUring;
+            mUring = NULL;
+        }
+    }
+
     mInitialized = true;
 }
 
 sensors_poll_context_t::~sensors_poll_context_t() {
-    for (int i=0 ; i<numSensorDrivers ; i++) {
-        delete mSensors[i];
-    }
+    /* reads in flight complete into driver buffers */
+    delete mUring;
+    mDrivers.forEach([](int, auto* sensor) { delete sensor; });
     close(mPollFds[flushPipe].fd);
     close(mFlushWritePipeFd);
+    close(mPollFds[wakePipe].fd);
+    close(mWakeWritePipeFd);
+    if (mPollFds[wakeAlarm].fd >= 0)
+        close(mPollFds[wakeAlarm].fd);
+    pthread_cond_destroy(&mModeCond);
+    pthread_mutex_destroy(&mModeLock);
     mInitialized = false;
 }
 
@@ -133,14 +409,29 @@ int sensors_poll_context_t::activate(int handle, int enabled) {
     if (!mInitialized) return -EINVAL;
     int index = handleToDriver(handle);
     if (index < 0) return index;
-    return mSensors[index]->enable(handle, enabled);
+    int err = mDrivers.visit(index, [&](auto* sensor) {
+        return sensor->enable(handle, enabled);
+    });
+    updateBusyPollWindow(index);
+    return err;
 }
 
 int sensors_poll_context_t::setDelay(int handle, int64_t ns) {
 
     int index = handleToDriver(handle);
     if (index < 0) return index;
-    return mSensors[index]->setDelay(handle, ns);
+    return mDrivers.visit(index, [&](auto* sensor) {
+        return sensor->setDelay(handle, ns);
+    });
+}
+
+int sensors_poll_context_t::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
+{
+    int index = handleToDriver(handle);
+    if (index < 0) return index;
+    return mDrivers.visit(index, [&](auto* sensor) {
+        return sensor->batch(handle, flags, period_ns, timeout);
+    });
 }
 
 int sensors_poll_context_t::flush(int handle)
@@ -151,9 +442,18 @@ int sensors_poll_context_t::flush(int handle)
     int index = handleToDriver(handle);
     if (index < 0) return index;
 
-    result = mSensors[index]->isActivated(handle);
-    if (!result)
-        return -EINVAL;
+    result = mDrivers.visit(index, [&](auto* sensor) {
+        if (!sensor->isActivated(handle))
+            return -EINVAL;
+        /* drivers holding batched samples report completion after delivering them */
+        return sensor->flush(handle);
+    });
+    if (result != -ENOSYS) {
+        /* a driver idling with held samples sends them once the poll loop looks again */
+        if (!result)
+            wake();
+        return result;
+    }
 
     flush_event_data.sensor = 0;
     flush_event_data.timestamp = 0;
@@ -162,12 +462,94 @@ int sensors_poll_context_t::flush(int handle)
     flush_event_data.type = SENSOR_TYPE_META_DATA;
     flush_event_data.version = META_DATA_VERSION;
 
+    SENSOR_TRACE(FLUSH_REQUEST, handle, 0);
     result = write(mFlushWritePipeFd, &flush_event_data, sizeof(sensors_event_t));
     ALOGE_IF(result<0, "error sending flush event data (%s)", strerror(errno));
 
     return (result >= 0 ? 0 : result);
 }
 
+/*
+ * Data injection switches every driver that supports it over to injected
+ * samples at once; drivers without support keep streaming. A poll thread
+ * blocked in poll() is woken to make the switch, and waits on the
+ * drivers' new fds from its next call on.
+ */
+int sensors_poll_context_t::setOperationMode(unsigned int mode)
+{
+    if (mode != SENSOR_HAL_NORMAL_MODE && mode != SENSOR_HAL_DATA_INJECTION_MODE)
+        return -EINVAL;
+
+    bool injecting = mode == SENSOR_HAL_DATA_INJECTION_MODE;
+    int err;
+
+    pthread_mutex_lock(&mModeLock);
+    while (mModeRequest >= 0)
+        pthread_cond_wait(&mModeCond, &mModeLock);
+    if (!mPolling) {
+        err = applyOperationMode(injecting);
+    } else {
+        mModeRequest = injecting;
+        wake();
+        while (mModeRequest >= 0)
+            pthread_cond_wait(&mModeCond, &mModeLock);
+        err = mModeResult;
+    }
+    pthread_mutex_unlock(&mModeLock);
+    return err;
+}
+
+/* on the poll thread, or with none in pollEvents() */
+int sensors_poll_context_t::applyOperationMode(bool injecting)
+{
+    if (injecting == mInjecting)
+        return 0;
+
+    int supported = 0;
+    int err = 0;
+    mDrivers.forEach([&](int i, auto* sensor) {
+        int result = sensor->setInjectionMode(injecting);
+        if (result == -ENOSYS)
+            return;
+        if (result < 0) {
+            LOGE("driver %d: couldn't switch data injection (%s)", i, strerror(-result));
+            if (!err)
+                err = result;
+        } else {
+            supported++;
+        }
+        mPollFds[i].fd = sensor->getFd();
+        mPollFds[i].revents = 0;
+    });
+    if (injecting && !supported)
+        return err ? err : -EINVAL;
+
+    mInjecting = injecting;
+    wake();
+    return err;
+}
+
+int sensors_poll_context_t::injectSensorData(const sensors_event_t* data)
+{
+    /* no operating environment data is consumed in normal mode */
+    if (!mInjecting)
+        return -EINVAL;
+
+    int index = handleToDriver(data->sensor);
+    if (index < 0) return index;
+    int err = mDrivers.visit(index, [&](auto* sensor) {
+        return sensor->inject(data);
+    });
+    return err == -ENOSYS ? -EINVAL : err;
+}
+
+void sensors_poll_context_t::wake()
+{
+    char c = 'w';
+    int result = write(mWakeWritePipeFd, &c, 1);
+    ALOGE_IF(result<0, "error writing wake pipe (%s)", strerror(errno));
+}
+
 static int64_t tm_min=0;
 static int64_t tm_max=0;
 static int64_t tm_sum=0;
@@ -176,97 +558,716 @@ static int64_t tm_count=0;
 
 static int debug_time = 0;
 static int debug_lvl = 0;
+static int debug_trace = 0;
 
 #define NSEC_PER_SEC            1000000000
-#include <cutils/properties.h>
 
 static inline int64_t timespec_to_ns(const struct timespec *ts)
 {
 	return ((int64_t) ts->tv_sec * NSEC_PER_SEC) + ts->tv_nsec;
 }
 
+/* CLOCK_MONOTONIC, or simulated time */
 static int64_t get_time_ns(void)
+{
+	return SensorClock::get()->uptime();
+}
+
+static int64_t get_thread_cpu_ns(void)
 {
 	struct timespec ts;
-	clock_gettime(CLOCK_MONOTONIC, &ts);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
 	return timespec_to_ns(&ts);
 }
 
+/* events waiting here, or in a driver whose fd won't signal them (batched, flush) */
+bool sensors_poll_context_t::hasBufferedEvents() const
+{
+    bool pending = false;
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        if (mBuffers[i].head < mBuffers[i].tail)
+            return true;
+    }
+    mDrivers.forEach([&](int, auto* sensor) {
+        pending = pending || sensor->hasPendingEvents();
+    });
+    return pending;
+}
+
+/* back to the start of the buffer once it is empty or has run into the end */
+void sensors_poll_context_t::compactBuffer(DriverBuffer& buf)
+{
+    if (buf.head == buf.tail) {
+        buf.head = buf.tail = 0;
+    } else if (buf.tail >= driverBufferEvents && buf.head > 0) {
+        memmove(buf.events, buf.events + buf.head,
+                (buf.tail - buf.head) * sizeof(sensors_event_t));
+        buf.tail -= buf.head;
+        buf.head = 0;
+    }
+}
+
+/* returns true when the driver had data or held some back, i.e. it isn't stalled */
+template <typename Driver>
+bool sensors_poll_context_t::fillBuffer(int index, Driver* sensor)
+{
+    DriverBuffer& buf = mBuffers[index];
+
+    compactBuffer(buf);
+    if (buf.tail >= driverBufferEvents)
+        return true;
+
+    int nb = sensor->readEvents(buf.events + buf.tail, driverBufferEvents - buf.tail);
+    /* a batching driver returns nothing for a while, yet keeps sampling */
+    uint64_t samples = sensor->getSampleCount();
+    bool progress = samples != mSampleCounts[index];
+    mSampleCounts[index] = samples;
+    if (nb <= 0)
+        return progress;
+    /* wake-up events keep the AP up until the framework has them */
+    for (int i = buf.tail; i < buf.tail + nb && !mWakeLock.isHeld(); i++) {
+        if (isWakeupEvent(buf.events[i]))
+            mWakeLock.acquire();
+    }
+    buf.tail += nb;
+    return true;
+}
+
+/*
+ * Completions of the generic flush path go in line behind the events
+ * their driver has staged, including what this call just read, so none
+ * overtakes a sample from before its flush(). Anything left in the pipe
+ * while a buffer is full is for the next call.
+ */
+int sensors_poll_context_t::queueFlushCompletions()
+{
+    int queued = 0;
+
+    for (;;) {
+        for (int i=0 ; i<numSensorDrivers ; i++) {
+            compactBuffer(mBuffers[i]);
+            if (mBuffers[i].tail == driverBufferEvents + driverBufferFlushes)
+                return queued;
+        }
+
+        sensors_event_t event;
+        int n = read(mPollFds[flushPipe].fd, &event, sizeof(event));
+        if (n != sizeof(event)) {
+            LOGE_IF(n < 0 && errno != EAGAIN, "error reading from flush pipe (%s)", strerror(errno));
+            return queued;
+        }
+        int index = handleToDriver(event.meta_data.sensor);
+        if (index < 0)
+            continue;
+        DriverBuffer& buf = mBuffers[index];
+        buf.events[buf.tail++] = event;
+        queued++;
+    }
+}
+
+bool sensors_poll_context_t::hasBufferedWakeupEvents() const
+{
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        for (int j = mBuffers[i].head; j < mBuffers[i].tail; j++) {
+            if (isWakeupEvent(mBuffers[i].events[j]))
+                return true;
+        }
+    }
+    return false;
+}
+
+/* program the alarm for the earliest wake-up batch any driver holds */
+void sensors_poll_context_t::armWakeAlarm()
+{
+    int64_t deadline = 0;
+    mDrivers.forEach([&](int, auto* sensor) {
+        int64_t t = sensor->getWakeupDeadline();
+        if (t && (!deadline || t < deadline))
+            deadline = t;
+    });
+    if (deadline == mAlarmDeadline)
+        return;
+    /* simulated time never reaches the timerfd, pollEvents() times out for it */
+    if (SensorClock::get()->isVirtual()) {
+        mAlarmDeadline = deadline;
+        return;
+    }
+    if (mPollFds[wakeAlarm].fd < 0)
+        return;
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = deadline / NSEC_PER_SEC;
+    spec.it_value.tv_nsec = deadline % NSEC_PER_SEC;
+    if (timerfd_settime(mPollFds[wakeAlarm].fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+        LOGE("error arming wake alarm (%s)", strerror(errno));
+        return;
+    }
+    mAlarmDeadline = deadline;
+}
+
+/*
+ * k-way merge of the driver buffers by timestamp. Each driver's share is
+ * settled first, an even split of count with whatever a driver can't use
+ * handed on to those that still have events; one merge over those
+ * prefixes then keeps the whole call in timestamp order.
+ */
+int sensors_poll_context_t::mergeEvents(sensors_event_t* data, int count)
+{
+    int heap[numSensorDrivers];
+    int share[numSensorDrivers];
+    int size = 0;
+    int nbEvents = 0;
+
+    int want = 0;
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        share[i] = 0;
+        want += mBuffers[i].tail - mBuffers[i].head;
+    }
+    int room = std::min(count, want);
+    while (room > 0) {
+        int hungry = 0;
+        for (int i=0 ; i<numSensorDrivers ; i++) {
+            if (share[i] < mBuffers[i].tail - mBuffers[i].head)
+                hungry++;
+        }
+        int quota = (room + hungry - 1) / hungry;
+        for (int i=0 ; i<numSensorDrivers && room > 0 ; i++) {
+            int n = std::min(std::min(quota, room),
+                    mBuffers[i].tail - mBuffers[i].head - share[i]);
+            share[i] += n;
+            room -= n;
+        }
+    }
+
+    const DriverBuffer* const buffers = mBuffers;
+    auto later = [buffers](int a, int b) {
+        return buffers[a].events[buffers[a].head].timestamp >
+               buffers[b].events[buffers[b].head].timestamp;
+    };
+
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        if (share[i])
+            heap[size++] = i;
+    }
+    std::make_heap(heap, heap + size, later);
+    while (size) {
+        std::pop_heap(heap, heap + size, later);
+        int i = heap[--size];
+        DriverBuffer& buf = mBuffers[i];
+        data[nbEvents++] = buf.events[buf.head++];
+        if (--share[i]) {
+            heap[size++] = i;
+            std::push_heap(heap, heap + size, later);
+        }
+    }
+
+    return nbEvents;
+}
+
+void sensors_poll_context_t::addUrgentHandle(int handle)
+{
+    int driver = handleToDriver(handle);
+    if (driver < 0) {
+        LOGW("priority lane: no sensor with handle %d", handle);
+        return;
+    }
+    int* end = mUrgentHandles + mNumUrgentHandles;
+    int* pos = std::lower_bound(mUrgentHandles, end, handle);
+    if (pos != end && *pos == handle)
+        return;
+    if (mNumUrgentHandles == maxUrgentHandles) {
+        LOGW("priority lane full, handle %d stays with the bulk traffic", handle);
+        return;
+    }
+    memmove(pos + 1, pos, (end - pos) * sizeof(int));
+    *pos = handle;
+    mNumUrgentHandles++;
+    mUrgentDrivers |= 1u << driver;
+}
+
+int sensors_poll_context_t::laneOf(const sensors_event_t& event) const
+{
+    int handle = event.type == SENSOR_TYPE_META_DATA ?
+            event.meta_data.sensor : event.sensor;
+    return std::binary_search(mUrgentHandles, mUrgentHandles + mNumUrgentHandles, handle) ?
+            SENSORS_LANE_URGENT : SENSORS_LANE_BULK;
+}
+
+/*
+ * Move the events of urgent sensors out of the driver buffers, driver by
+ * driver. What stays behind keeps its order, and a flush completion goes
+ * in the lane of its sensor, so no sensor's events get reordered.
+ */
+int sensors_poll_context_t::takeUrgentEvents(sensors_event_t* data, int count)
+{
+    int nbEvents = 0;
+
+    for (int i=0 ; i<numSensorDrivers && nbEvents < count ; i++) {
+        if (!(mUrgentDrivers & (1u << i)))
+            continue;
+        DriverBuffer& buf = mBuffers[i];
+        int kept = buf.head;
+        for (int j = buf.head; j < buf.tail; j++) {
+            if (nbEvents < count && laneOf(buf.events[j]) == SENSORS_LANE_URGENT)
+                data[nbEvents++] = buf.events[j];
+            else if (kept == j)
+                kept++;
+            else
+                buf.events[kept++] = buf.events[j];
+        }
+        buf.tail = kept;
+    }
+    return nbEvents;
+}
+
+/* per-lane counters of the events a poll() call returns */
+void sensors_poll_context_t::countLanes(const sensors_event_t* data, int count)
+{
+    int64_t now = SensorClock::get()->boottime();
+    bool seen[SENSORS_NUM_LANES] = {};
+
+    for (int i = 0; i < count; i++) {
+        int lane = laneOf(data[i]);
+        struct sensors_lane_stats& stats = mLaneStats[lane];
+        seen[lane] = true;
+        stats.events++;
+        if (data[i].type == SENSOR_TYPE_META_DATA) {
+            stats.flushes++;
+            continue;
+        }
+        int64_t latency = now - data[i].timestamp;
+        stats.last_latency_ns = latency;
+        if (latency > stats.max_latency_ns)
+            stats.max_latency_ns = latency;
+        stats.total_latency_ns += latency;
+    }
+    for (int lane = 0; lane < SENSORS_NUM_LANES; lane++) {
+        if (seen[lane])
+            mLaneStats[lane].calls++;
+    }
+}
+
+int sensors_poll_context_t::getLaneStats(int lane, struct sensors_lane_stats* stats)
+{
+    if (lane < 0 || lane >= SENSORS_NUM_LANES)
+        return -EINVAL;
+    *stats = mLaneStats[lane];
+    return 0;
+}
+
+/* how long poll() may block before some streaming driver is due for a stall check */
+int sensors_poll_context_t::watchdogTimeout(int64_t now) const
+{
+    int timeout = -1;
+    mDrivers.forEach([&](int i, auto* sensor) {
+        int t = mWatchdogs[i].timeoutMs(now, sensor->getStreamPeriod());
+        if (t >= 0 && (timeout < 0 || t < timeout))
+            timeout = t;
+    });
+    return timeout;
+}
+
+void sensors_poll_context_t::checkWatchdogs(int64_t now, const bool fed[])
+{
+    mDrivers.forEach([&](int i, auto* sensor) {
+        int64_t period = sensor->getStreamPeriod();
+        if (fed[i]) {
+            mWatchdogs[i].feed(now, period);
+        } else if (mWatchdogs[i].expired(now, period)) {
+            int err = sensor->recover();
+            mWatchdogs[i].attempted(now, err >= 0);
+            /* recovery may have reopened the device */
+            mPollFds[i].fd = sensor->getFd();
+            mPollFds[i].revents = 0;
+        }
+    });
+}
+
+void sensors_poll_context_t::setWatchdogPeriods(int periods)
+{
+    for (int i=0 ; i<numSensorDrivers ; i++)
+        mWatchdogs[i].setPeriods(periods);
+}
+
+int sensors_poll_context_t::getWatchdogStats(int handle, struct sensors_watchdog_stats* stats)
+{
+    int index = handleToDriver(handle);
+    if (index < 0) return index;
+    int err = mDrivers.visit(index, [&](auto*) {
+        mWatchdogs[index].getStats(stats);
+        return 0;
+    });
+    return err == -EINVAL ? -ENODEV : err;
+}
+
+int sensors_poll_context_t::setBusyPollWindow(int handle, int64_t ns)
+{
+    int index = handleToDriver(handle);
+    if (index < 0) return index;
+
+    int i = 0;
+    while (i < mNumBusyPollWindows && mBusyPollWindows[i].handle != handle)
+        i++;
+    if (i == mNumBusyPollWindows) {
+        if (!ns)
+            return 0;
+        if (mNumBusyPollWindows == maxBusyPollHandles) {
+            LOGW("busy-poll: no room for handle %d", handle);
+            return -ENOMEM;
+        }
+        mNumBusyPollWindows++;
+        mBusyPollWindows[i].handle = handle;
+    }
+    mBusyPollWindows[i].ns = ns;
+    updateBusyPollWindow(index);
+    return 0;
+}
+
+/* handles served by one driver share its poll fd, so it spins for the longest window */
+void sensors_poll_context_t::updateBusyPollWindow(int index)
+{
+    int64_t window = 0;
+    for (int i = 0; i < mNumBusyPollWindows; i++) {
+        const BusyPollWindow& w = mBusyPollWindows[i];
+        if (w.ns <= window || handleToDriver(w.handle) != index)
+            continue;
+        bool enabled = mDrivers.visit(index, [&](auto* sensor) {
+            return sensor->isActivated(w.handle);
+        }) > 0;
+        if (enabled)
+            window = w.ns;
+    }
+    mBusyPolls[index].setWindow(window);
+}
+
+void sensors_poll_context_t::setBusyPollBudget(int percent)
+{
+    mSpinBudget.setPercent(percent);
+}
+
+int sensors_poll_context_t::getBusyPollStats(int handle, struct sensors_busy_poll_stats* stats)
+{
+    int index = handleToDriver(handle);
+    if (index < 0) return index;
+    mBusyPolls[index].getStats(stats);
+    return 0;
+}
+
+void sensors_poll_context_t::setDrainBound(int64_t ns)
+{
+    /* set from activate(), read by the poll thread */
+    int64_t old = mDrainBound.exchange(ns);
+    if ((ns > 0) != (old > 0)) {
+        mDrivers.forEach([&](int, auto* sensor) {
+            sensor->setDrain(ns > 0);
+        });
+    }
+}
+
+void sensors_poll_context_t::getDrainStats(struct sensors_drain_stats* stats)
+{
+    *stats = mDrainStats;
+    stats->bound_ns = mDrainBound;
+}
+
+int sensors_poll_context_t::getRateStats(int handle, struct sensors_rate_stats* stats)
+{
+    int index = handleToDriver(handle);
+    if (index < 0) return index;
+    int err = mDrivers.visit(index, [&](auto* sensor) {
+        stats->period_ns = sensor->getStreamPeriod();
+        stats->measured_ns = sensor->getMeasuredPeriod();
+        return 0;
+    });
+    return err == -EINVAL ? -ENODEV : err;
+}
+
+/*
+ * poll() with a ns timeout, -1 waits for good. The timeout is on the
+ * sensor clock; a simulated one decides how long to really block and
+ * hears about timeouts that passed with nothing to do.
+ */
+int sensors_poll_context_t::waitEvents(int64_t timeoutNs)
+{
+    SensorClock* clock = SensorClock::get();
+    int64_t waitNs = clock->realWait(timeoutNs);
+    int nb;
+
+    if (mUring) {
+        SensorBase* drivers[numFds] = {};
+        mDrivers.forEach([&](int i, auto* sensor) { drivers[i] = sensor; });
+        int ms = waitNs < 0 ? -1 : (int)((waitNs + 999999) / 1000000);
+        nb = mUring->wait(mPollFds, drivers, numFds, ms);
+    } else if (waitNs < 0) {
+        nb = poll(mPollFds, numFds, -1);
+    } else {
+        struct timespec ts;
+        ts.tv_sec = waitNs / NSEC_PER_SEC;
+        ts.tv_nsec = waitNs % NSEC_PER_SEC;
+        nb = ppoll(mPollFds, numFds, &ts, NULL);
+    }
+
+    if (nb == 0 && timeoutNs > 0)
+        clock->waited(timeoutNs);
+    return nb;
+}
+
+/*
+ * Sleep as poll() would, except around the next sample of a driver in
+ * low-latency mode: wake up half a spin window before it is due, then
+ * poll without sleeping until something arrives or the window is over.
+ */
+int sensors_poll_context_t::busyWait(int64_t now, int timeoutMs)
+{
+    int64_t deadline = timeoutMs < 0 ? -1 : now + timeoutMs * 1000000LL;
+    int64_t start = -1;
+    int spinner = -1;
+
+    /* simulated time doesn't move while spinning */
+    if (timeoutMs != 0 && !SensorClock::get()->isVirtual()) {
+        mDrivers.forEach([&](int i, auto* sensor) {
+            int64_t t = mBusyPolls[i].spinStart(sensor->getStreamPeriod());
+            /* a window already over means the sample is late, not due */
+            if (t < 0 || t + mBusyPolls[i].getWindow() <= now)
+                return;
+            if (start < 0 || t < start) {
+                start = t;
+                spinner = i;
+            }
+        });
+    }
+    if (spinner < 0 || (deadline >= 0 && start >= deadline))
+        return waitEvents(deadline < 0 ? -1 : deadline - now);
+
+    if (start > now) {
+        int nb = waitEvents(start - now);
+        if (nb != 0)
+            return nb;
+        now = get_time_ns();
+    }
+
+    if (!mSpinBudget.allows(now)) {
+        mBusyPolls[spinner].skipped();
+        return waitEvents(deadline < 0 ? -1 : std::max<int64_t>(deadline - now, 0));
+    }
+
+    int64_t end = start + mBusyPolls[spinner].getWindow();
+    int64_t cpu = get_thread_cpu_ns();
+    int nb;
+    do {
+        nb = waitEvents(0);
+    } while (nb == 0 && (now = get_time_ns()) < end);
+    cpu = get_thread_cpu_ns() - cpu;
+
+    mSpinBudget.spend(cpu);
+    mBusyPolls[spinner].spun(nb > 0 && (mPollFds[spinner].revents & POLLIN), cpu);
+    SENSOR_TRACE(SPIN, spinner, cpu);
+
+    if (nb != 0)
+        return nb;
+    return waitEvents(deadline < 0 ? -1 : std::max<int64_t>(deadline - now, 0));
+}
+
+/*
+ * Drain-to-fill: after the first events of a call are in, go over the
+ * drivers again without blocking and hand back whatever else is ready,
+ * so a busy stream costs fewer poll() round trips. Stops when data is
+ * full, every source is empty, the poll loop is woken, or bound_ns has
+ * passed since the first wakeup, which keeps the first event from being
+ * held back.
+ */
+int sensors_poll_context_t::drainEvents(sensors_event_t* data, int count, int64_t start)
+{
+    int nbEvents = 0;
+
+    while (count > 0) {
+        int64_t now = get_time_ns();
+        if (now - start >= mDrainBound) {
+            mDrainStats.expired++;
+            return nbEvents;
+        }
+
+        int nb = waitEvents(0);
+        if (nb < 0)
+            break;
+        /* flushes and wakeups are for the next call */
+        if ((mPollFds[flushPipe].revents | mPollFds[wakePipe].revents) & POLLIN)
+            break;
+
+        mDrivers.forEach([&](int i, auto* sensor) {
+            if ((mPollFds[i].revents & POLLIN) || sensor->hasPendingEvents()) {
+                if (fillBuffer(i, sensor))
+                    mBusyPolls[i].fed(now);
+                mPollFds[i].revents = 0;
+            }
+        });
+
+        int urgent = takeUrgentEvents(data, count);
+        nb = urgent + mergeEvents(data + urgent, count - urgent);
+        if (!nb)
+            break;
+        mDrainStats.refills++;
+        data += nb;
+        count -= nb;
+        nbEvents += nb;
+        /* urgent events go out with what is already collected, right away */
+        if (urgent) {
+            mLaneStats[SENSORS_LANE_URGENT].preempted_drains++;
+            break;
+        }
+    }
+
+    if (count > 0)
+        mDrainStats.empty++;
+    else
+        mDrainStats.full++;
+    return nbEvents;
+}
+
+/* entering and leaving pollEvents(); a pending mode switch is made on the way */
+void sensors_poll_context_t::setPolling(bool polling)
+{
+    pthread_mutex_lock(&mModeLock);
+    mPolling = polling;
+    if (mModeRequest >= 0) {
+        mModeResult = applyOperationMode(mModeRequest);
+        mModeRequest = -1;
+        pthread_cond_broadcast(&mModeCond);
+    }
+    pthread_mutex_unlock(&mModeLock);
+}
+
 int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
+{
+    setPolling(true);
+    int nb = pollOnce(data, count);
+    setPolling(false);
+    return nb;
+}
+
+int sensors_poll_context_t::pollOnce(sensors_event_t* data, int count)
 {
     int nbEvents = 0;
     int nb, polltime = -1;
 
+    /* the previous call handed its wake-up events over */
+    if (mWakeLock.isHeld() && !hasBufferedWakeupEvents())
+        mWakeLock.release();
+    armWakeAlarm();
+
+    // buffered events are ready now, only pick up whatever else is ready too
+    int64_t now = get_time_ns();
+    if (hasBufferedEvents())
+        polltime = 0;
+    else
+        polltime = watchdogTimeout(now);
+    if (polltime != 0 && mAlarmDeadline && SensorClock::get()->isVirtual()) {
+        int64_t ms = std::max<int64_t>(mAlarmDeadline - SensorClock::get()->boottime(), 0);
+        ms = (ms + 999999) / 1000000;
+        if (polltime < 0 || ms < polltime)
+            polltime = ms;
+    }
+
     // look for new events
-    nb = poll(mPollFds, numFds, polltime);
-
-    /* flush event data */
-    if ((count > 0) && (nb > 0)) {
-        if (mPollFds[flushPipe].revents & POLLIN) {
-            int n = read(mPollFds[flushPipe].fd, data, count * sizeof(sensors_event_t));
-            if (n < 0) {
-                LOGE("error reading from flush pipe (%s)", strerror(errno));
-                return 0;
+    nb = busyWait(now, polltime);
+    int64_t woke = get_time_ns();
+    SENSOR_TRACE(POLL_WAKEUP, nb, 0);
+
+    /* woken by sensors_poll_wake(): drain the pipe and let the caller re-check its state */
+    if ((nb > 0) && (mPollFds[wakePipe].revents & POLLIN)) {
+        char buf[16];
+        while (read(mPollFds[wakePipe].fd, buf, sizeof(buf)) > 0)
+            ;
+        mPollFds[wakePipe].revents = 0;
+        return 0;
+    }
+
+    /* a wake-up batch is due: stay up from reading it until it's handed over */
+    if ((nb > 0) && (mPollFds[wakeAlarm].revents & POLLIN)) {
+        uint64_t expirations;
+        mWakeLock.acquire();
+        if (read(mPollFds[wakeAlarm].fd, &expirations, sizeof(expirations)) < 0)
+            LOGE("error reading wake alarm (%s)", strerror(errno));
+        mPollFds[wakeAlarm].revents = 0;
+        mAlarmDeadline = 0;
+    }
+
+    bool flushed = (nb > 0) && (mPollFds[flushPipe].revents & POLLIN);
+    mPollFds[flushPipe].revents = 0;
+
+    bool fed[numSensorDrivers] = {};
+    if (nb >= 0) {
+        mDrivers.forEach([&](int i, auto* sensor) {
+            if ((mPollFds[i].revents & POLLIN) || sensor->hasPendingEvents()) {
+                fed[i] = fillBuffer(i, sensor);
+                mPollFds[i].revents = 0;
+                if (fed[i])
+                    mBusyPolls[i].fed(woke);
             }
-            nb = n / sizeof(sensors_event_t);
-            mPollFds[flushPipe].revents = 0;
-            count -= nb;
-            nbEvents += nb;
-            data += nb;
-            LOGI("report %d flush event\n", nbEvents);
-            return nbEvents;
-        }
+        });
     }
+    checkWatchdogs(get_time_ns(), fed);
 
+    /* flush event data, in line behind the samples staged before it */
+    if (flushed) {
+        int queued = queueFlushCompletions();
+        SENSOR_TRACE(FLUSH_DELIVERED, 0, queued);
+        LOGI("report %d flush event\n", queued);
+    }
+
+    /* the priority lane first, and a drain never holds it back */
+    int urgent = (count > 0) ? takeUrgentEvents(data, count) : 0;
+    nb = urgent + ((count > urgent) ? mergeEvents(data + urgent, count - urgent) : 0);
+    if (nb > 0 && mDrainBound > 0 && !urgent)
+        nb += drainEvents(data + nb, count - nb, woke);
+
+    //LOGI("count = %d, nbEvents = %d, nb = %d\n", count, nbEvents, nb);
     if (nb > 0) {
-        for (int i=0 ; count && i < numSensorDrivers ; i++) {
-            SensorBase* const sensor(mSensors[i]);
-            if (mPollFds[i].revents & POLLIN) {
-                nb = 0;
-                nb = sensor->readEvents(data, count);
-                mPollFds[i].revents = 0;
+        if (debug_time) {
+            /* same clock as the sample timestamps */
+            int64_t tm_cur = SensorClock::get()->boottime();
+            int64_t tm_delta = tm_cur - data->timestamp;
+            if (tm_min==0 && tm_max==0)
+                tm_min = tm_max = tm_delta;
+            else if (tm_delta < tm_min)
+                tm_min = tm_delta;
+            else if (tm_delta > tm_max)
+                tm_max = tm_delta;
+            tm_sum += tm_delta;
+            tm_count++;
+            //LOGI("tm_count = %d\n", tm_count);
+            if ((tm_cur-tm_last_print) > 1000000000) {
+                LOGD("ST HAL report rate[%4lld]: %8lld, %8lld, %8lld\n", (long long)tm_count, (long long)tm_min, (long long)(tm_sum/tm_count), (long long)tm_max);
+                tm_last_print = tm_cur;
+                tm_min = tm_max = tm_count = tm_sum = 0;
+            }
+        }
 
-                //LOGI("count = %d, nbEvents = %d, nb = %d\n", count, nbEvents, nb);
-                if (nb > 0) {
-                    if (debug_time) {
-                        int64_t tm_cur = get_time_ns();
-                        int64_t tm_delta = tm_cur - data->timestamp;
-                        if (tm_min==0 && tm_max==0)
-                            tm_min = tm_max = tm_delta;
-                        else if (tm_delta < tm_min)
-                            tm_min = tm_delta;
-                        else if (tm_delta > tm_max)
-                            tm_max = tm_delta;
-                        tm_sum += tm_delta;
-                        tm_count++;
-                        //LOGI("tm_count = %d\n", tm_count);
-                        if ((tm_cur-tm_last_print) > 1000000000) {
-                            LOGD("ST HAL report rate[%4lld]: %8lld, %8lld, %8lld\n", (long long)tm_count, (long long)tm_min, (long long)(tm_sum/tm_count), (long long)tm_max);
-                            tm_last_print = tm_cur;
-                            tm_min = tm_max = tm_count = tm_sum = 0;
-                        }
-                    }
-    
-                    if (debug_lvl > 0) {
-                        for (int j=0; j<nb; j++) {
-                            if ((debug_lvl&1) && data[j].sensor==ID_GY) {
-                                LOGD("GYRO: %+f %+f %+f - %lld", data[j].gyro.x, data[j].gyro.y, data[j].gyro.z, (long long)data[j].timestamp);
-                            }
-                            if ((debug_lvl&2) && data[j].sensor==ID_A) {
-                                LOGD("ACCL: %+f %+f %+f - %lld", data[j].acceleration.x, data[j].acceleration.y, data[j].acceleration.z, (long long)data[j].timestamp);
-                            }
-                            if ((debug_lvl&4) && (data[j].sensor==ID_M)) {
-                                LOGD("MAG: %+f %+f %+f - %lld", data[j].magnetic.x, data[j].magnetic.y, data[j].magnetic.z, (long long)data[j].timestamp);
-                            }
-                        }
-                    }
-    
-                    count -= nb;
-                    nbEvents += nb;
-                    data += nb;
+        if (debug_lvl > 0) {
+            for (int j=0; j<nb; j++) {
+                if ((debug_lvl&1) && data[j].sensor==ID_GY) {
+                    LOGD("GYRO: %+f %+f %+f - %lld", data[j].gyro.x, data[j].gyro.y, data[j].gyro.z, (long long)data[j].timestamp);
+                }
+                if ((debug_lvl&2) && data[j].sensor==ID_A) {
+                    LOGD("ACCL: %+f %+f %+f - %lld", data[j].acceleration.x, data[j].acceleration.y, data[j].acceleration.z, (long long)data[j].timestamp);
+                }
+                if ((debug_lvl&4) && (data[j].sensor==ID_M)) {
+                    LOGD("MAG: %+f %+f %+f - %lld", data[j].magnetic.x, data[j].magnetic.y, data[j].magnetic.z, (long long)data[j].timestamp);
                 }
             }
         }
+
+        countLanes(data, nb);
+
+        count -= nb;
+        nbEvents += nb;
+        data += nb;
+
+        mDrainStats.calls++;
+        mDrainStats.events += nb;
+        if ((uint32_t)nb > mDrainStats.max_events)
+            mDrainStats.max_events = nb;
     }
 
     return nbEvents;
@@ -274,10 +1275,15 @@ int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
 
 /*****************************************************************************/
 
+/* the open device, for the module level set_operation_mode() */
+static sensors_poll_context_t* sContext;
+
 static int poll__close(struct hw_device_t *dev)
 {
     sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
     if (ctx) {
+        if (sContext == ctx)
+            sContext = NULL;
         delete ctx;
     }
     return 0;
@@ -297,6 +1303,37 @@ static int poll__activate(struct sensors_poll_device_t *dev,
     property_get("vendor.sensor.debug.time", propbuf, "0");
     debug_time = atoi(propbuf);
 
+    /* 0: off, 1: binary ring, 2: ring + trace_marker; dropping back to 0 dumps the rings */
+    memset(propbuf, 0, sizeof(propbuf));
+    property_get("vendor.sensor.debug.trace", propbuf, "0");
+    int trace = atoi(propbuf);
+    if (trace != debug_trace) {
+        SensorTrace::setMode(trace);
+        if (!trace)
+            SensorTrace::dump(-1);
+        debug_trace = trace;
+    }
+
+    /* stall watchdog window in sample periods, 0 turns it off */
+    memset(propbuf, 0, sizeof(propbuf));
+    property_get("vendor.sensor.watchdog.periods", propbuf, "10");
+    ctx->setWatchdogPeriods(atoi(propbuf));
+
+    /* low-latency spin window of this sensor in us (0: sleep as usual), and the CPU cap */
+    char propname[PROPERTY_KEY_MAX];
+    snprintf(propname, sizeof(propname), "vendor.sensor.busypoll.%d", handle);
+    memset(propbuf, 0, sizeof(propbuf));
+    property_get(propname, propbuf, "0");
+    ctx->setBusyPollWindow(handle, atoi(propbuf) * 1000LL);
+    memset(propbuf, 0, sizeof(propbuf));
+    property_get("vendor.sensor.busypoll.budget", propbuf, "10");
+    ctx->setBusyPollBudget(atoi(propbuf));
+
+    /* drain-to-fill bound in us: how long poll() may keep collecting ready events */
+    memset(propbuf, 0, sizeof(propbuf));
+    property_get("vendor.sensor.drain", propbuf, "0");
+    ctx->setDrainBound(atoi(propbuf) * 1000LL);
+
     return ctx->activate(handle, enabled);
 }
 
@@ -321,7 +1358,7 @@ static int poll__batch(struct sensors_poll_device_1 *dev,
     LOGI("set batch: handle = %d, period_ns = %dns, timeout = %dns\n", handle, (int)period_ns, (int)timeout);
 
     sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
-    return ctx->setDelay(handle, period_ns);
+    return ctx->batch(handle, flags, period_ns, timeout);
 }
 
 static int poll__flush(struct sensors_poll_device_1 *dev,
@@ -332,8 +1369,108 @@ static int poll__flush(struct sensors_poll_device_1 *dev,
     return ctx->flush(handle);
 }
 
+static int poll__inject_sensor_data(struct sensors_poll_device_1 *dev,
+                      const sensors_event_t *data)
+{
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->injectSensorData(data);
+}
+
 /*****************************************************************************/
 
+int sensors_poll_wake(struct sensors_poll_device_1* dev)
+{
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    ctx->wake();
+    return 0;
+}
+
+int sensors_watchdog_get_stats(struct sensors_poll_device_1* dev, int handle,
+        struct sensors_watchdog_stats* stats)
+{
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->getWatchdogStats(handle, stats);
+}
+
+int sensors_busy_poll_get_stats(struct sensors_poll_device_1* dev, int handle,
+        struct sensors_busy_poll_stats* stats)
+{
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->getBusyPollStats(handle, stats);
+}
+
+int sensors_drain_get_stats(struct sensors_poll_device_1* dev,
+        struct sensors_drain_stats* stats)
+{
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    ctx->getDrainStats(stats);
+    return 0;
+}
+
+int sensors_rate_get_stats(struct sensors_poll_device_1* dev, int handle,
+        struct sensors_rate_stats* stats)
+{
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->getRateStats(handle, stats);
+}
+
+int sensors_lane_get_stats(struct sensors_poll_device_1* dev, int lane,
+        struct sensors_lane_stats* stats)
+{
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->getLaneStats(lane, stats);
+}
+
+/* the simulated clock handed out to tools, one per process */
+static VirtualClock* virtualClock()
+{
+    static VirtualClock sVirtualClock;
+    return &sVirtualClock;
+}
+
+int sensors_clock_use_virtual(int64_t start_ns, int auto_advance)
+{
+    if (start_ns < 0)
+        return -EINVAL;
+    virtualClock()->reset(start_ns, auto_advance != 0);
+    SensorClock::set(virtualClock());
+    LOGI("sensor clock: simulated from %lld ns, %s", (long long)start_ns,
+            auto_advance ? "auto advance" : "manual");
+    return 0;
+}
+
+void sensors_clock_use_real(void)
+{
+    SensorClock::set(NULL);
+}
+
+int64_t sensors_clock_now(void)
+{
+    return SensorClock::get()->boottime();
+}
+
+int sensors_clock_advance(struct sensors_poll_device_1* dev, int64_t ns)
+{
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+
+    if (ns < 0 || SensorClock::get() != virtualClock())
+        return -EINVAL;
+    virtualClock()->advance(ns);
+    /* a poll() blocked on the old time has to look at the new one */
+    if (ctx)
+        ctx->wake();
+    return 0;
+}
+
+int sensors_set_operation_mode(unsigned int mode)
+{
+    LOGI("set operation mode: %u\n", mode);
+
+    if (!sContext)
+        return mode == SENSOR_HAL_NORMAL_MODE ? 0 : -EINVAL;
+    return sContext->setOperationMode(mode);
+}
+
 int init_nusensors(hw_module_t const* module, hw_device_t** device)
 {
 	LOGD("%s\n",SENSOR_VERSION_AND_TIME);
@@ -347,7 +1484,7 @@ int init_nusensors(hw_module_t const* module, hw_device_t** device)
     memset(&dev->device, 0, sizeof(sensors_poll_device_1));
 
     dev->device.common.tag = HARDWARE_DEVICE_TAG;
-    dev->device.common.version  = SENSORS_DEVICE_API_VERSION_1_3;
+    dev->device.common.version  = SENSORS_DEVICE_API_VERSION_1_4;
     dev->device.common.module   = const_cast<hw_module_t*>(module);
     dev->device.common.close    = poll__close;
     dev->device.activate        = poll__activate;
@@ -358,6 +1495,10 @@ int init_nusensors(hw_module_t const* module, hw_device_t** device)
     dev->device.batch           = poll__batch;
     dev->device.flush           = poll__flush;
 
+    /* Data injection */
+    dev->device.inject_sensor_data = poll__inject_sensor_data;
+
+    sContext = dev;
     *device = &dev->device.common;
 
     status = 0;
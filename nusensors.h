@@ -40,9 +40,10 @@ sensor hal  v1.3 modify akm device name from akmd8975 to akmd 2013-3-14
 sensor hal  v1.4 add akm09911 support 2013-3-21
 sensor hal  v1.5 add angle calculation and calibration of gsensor support 2013-9-1
 sensor hal  v1.6 upagrde sensors device api version to SENSORS_DEVICE_API_VERSION_1_3 
+sensor hal  v1.7 upgrade sensors device api version to SENSORS_DEVICE_API_VERSION_1_4 for data injection
 */
 
-#define SENSOR_VERSION_AND_TIME  "sensor hal  v1.6 upagrde sensors device api version to SENSORS_DEVICE_API_VERSION_1_3"
+#define SENSOR_VERSION_AND_TIME  "sensor hal  v1.7 upgrade sensors device api version to SENSORS_DEVICE_API_VERSION_1_4"
 
 
 #ifndef M_PI
@@ -56,6 +57,101 @@ __BEGIN_DECLS
 
 int init_nusensors(hw_module_t const* module, hw_device_t** device);
 
+/* make a thread blocked in poll() return 0 right away */
+int sensors_poll_wake(struct sensors_poll_device_1* dev);
+
+/* stall watchdog counters of the driver behind a handle */
+struct sensors_watchdog_stats {
+    uint32_t stalls;            /* stall episodes detected */
+    uint32_t attempts;          /* recovery attempts */
+    uint32_t failures;          /* attempts that reported an error */
+    uint32_t recoveries;        /* episodes that ended with events flowing again */
+    int64_t last_recover_ns;    /* detection to first event, latest episode */
+    int64_t max_recover_ns;
+    int64_t total_recover_ns;
+};
+
+int sensors_watchdog_get_stats(struct sensors_poll_device_1* dev, int handle,
+        struct sensors_watchdog_stats* stats);
+
+/* low-latency spin counters of the driver behind a handle */
+struct sensors_busy_poll_stats {
+    int64_t window_ns;          /* spin window, 0 when the driver sleeps as usual */
+    uint32_t spins;             /* times the poll loop spun for a due sample */
+    uint32_t hits;              /* spins the sample arrived in */
+    uint32_t budget_skips;      /* spins left out because the CPU budget was used up */
+    int64_t spin_cpu_ns;        /* CPU time spent spinning */
+};
+
+int sensors_busy_poll_get_stats(struct sensors_poll_device_1* dev, int handle,
+        struct sensors_busy_poll_stats* stats);
+
+/* how many events each poll() hands back, and why draining stopped */
+struct sensors_drain_stats {
+    int64_t bound_ns;           /* longest drain after the first event, 0 when off */
+    uint64_t calls;             /* poll() calls that returned sensor events */
+    uint64_t events;            /* sensor events they returned */
+    uint32_t max_events;        /* most sensor events returned by one call */
+    uint64_t refills;           /* extra non-blocking rounds over the ready drivers */
+    uint64_t full;              /* drains that filled the caller's buffer */
+    uint64_t empty;             /* drains that found every source empty */
+    uint64_t expired;           /* drains cut short by bound_ns */
+};
+
+int sensors_drain_get_stats(struct sensors_poll_device_1* dev,
+        struct sensors_drain_stats* stats);
+
+/* sampling rate of the driver behind a handle, as asked and as timestamped */
+struct sensors_rate_stats {
+    int64_t period_ns;          /* expected sample period, 0 when idle */
+    int64_t measured_ns;        /* from the sample timestamps, 0 until measured */
+};
+
+int sensors_rate_get_stats(struct sensors_poll_device_1* dev, int handle,
+        struct sensors_rate_stats* stats);
+
+/*
+ * Priority lanes. Events of on-change, one-shot and special sensors, and
+ * of handles listed in vendor.sensor.lane.urgent, are urgent: poll()
+ * returns them ahead of continuous data and without waiting for a drain.
+ */
+#define SENSORS_LANE_BULK	0
+#define SENSORS_LANE_URGENT	1
+#define SENSORS_NUM_LANES	2
+
+struct sensors_lane_stats {
+    uint64_t calls;             /* poll() calls that returned events of this lane */
+    uint64_t events;            /* events returned, flush completions included */
+    uint64_t flushes;           /* flush completions among them */
+    int64_t last_latency_ns;    /* sample timestamp to poll() return */
+    int64_t max_latency_ns;
+    int64_t total_latency_ns;   /* over events - flushes */
+    uint64_t preempted_drains;  /* urgent lane: drains cut short to return its events */
+};
+
+int sensors_lane_get_stats(struct sensors_poll_device_1* dev, int lane,
+        struct sensors_lane_stats* stats);
+
+/*
+ * Simulated time for tests and replays. Samples, batching, wake-up
+ * deadlines and stall windows then follow a virtual clock starting at
+ * start_ns. With auto_advance the poll loop skips ahead through each
+ * timeout instead of sleeping; otherwise time only moves through
+ * sensors_clock_advance(), which also wakes a blocked poll() when dev
+ * is given. Switch before any stream starts.
+ */
+int sensors_clock_use_virtual(int64_t start_ns, int auto_advance);
+void sensors_clock_use_real(void);
+/* CLOCK_BOOTTIME, or the simulated time */
+int64_t sensors_clock_now(void);
+int sensors_clock_advance(struct sensors_poll_device_1* dev, int64_t ns);
+
+/* sensors_module_t::set_operation_mode, applied to the open device */
+int sensors_set_operation_mode(unsigned int mode);
+
+/* sensors of the aggregated sub-HAL modules, handles already remapped */
+int multihal_get_sensors_list(struct sensor_t const** list);
+
 /*****************************************************************************/
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
@@ -68,6 +164,44 @@ int init_nusensors(hw_module_t const* module, hw_device_t** device);
 #define ID_GY	(5)
 #define ID_PR	(6)
 #define ID_TMP	(7)
+#define ID_GRAV	(8)
+#define ID_LA	(9)
+#define ID_A_WAKE	(10)
+
+/* HAL-side batching FIFO of the accelerometer, in compact samples */
+#define KXTJ3_FIFO_BLOCKS	200
+#define KXTJ3_FIFO_BLOCK_SAMPLES	64
+#define KXTJ3_FIFO_EVENTS	(KXTJ3_FIFO_BLOCKS * KXTJ3_FIFO_BLOCK_SAMPLES)
+
+/* samples the wake-up accelerometer holds on its own while the AP may sleep */
+#define KXTJ3_WAKE_FIFO_EVENTS	3000
+
+/* pipe size asked for the accelerometer's data injection queue */
+#define KXTJ3_INJECT_QUEUE_BYTES	(1024 * 1024)
+
+/* sub-HAL n (from 0) exposes its handle h as ((n + 1) << SUBHAL_HANDLE_SHIFT) | h */
+#define SUBHAL_HANDLE_SHIFT	16
+
+/*
+ * Every sensor of this module, once: handle, type, string type, name,
+ * reserved FIFO events, flags, and the driver class serving it.
+ * sensors.c builds the sensor list from it and nusensors.cpp the handle
+ * dispatch, which doesn't compile when a sensor names a driver the poll
+ * context doesn't have or two sensors share a handle.
+ */
+#define NUSENSORS_SENSORS(SENSOR) \
+	SENSOR(ID_A, SENSOR_TYPE_ACCELEROMETER, SENSOR_STRING_TYPE_ACCELEROMETER, \
+			"Accelerometer sensor", KXTJ3_FIFO_EVENTS, \
+			SENSOR_FLAG_CONTINUOUS_MODE | SENSOR_FLAG_DATA_INJECTION, PipelineSensor) \
+	SENSOR(ID_GRAV, SENSOR_TYPE_GRAVITY, SENSOR_STRING_TYPE_GRAVITY, \
+			"Gravity sensor", 0, \
+			SENSOR_FLAG_CONTINUOUS_MODE, PipelineSensor) \
+	SENSOR(ID_LA, SENSOR_TYPE_LINEAR_ACCELERATION, SENSOR_STRING_TYPE_LINEAR_ACCELERATION, \
+			"Linear Acceleration sensor", 0, \
+			SENSOR_FLAG_CONTINUOUS_MODE, PipelineSensor) \
+	SENSOR(ID_A_WAKE, SENSOR_TYPE_ACCELEROMETER, SENSOR_STRING_TYPE_ACCELEROMETER, \
+			"Accelerometer sensor (wake-up)", KXTJ3_WAKE_FIFO_EVENTS, \
+			SENSOR_FLAG_CONTINUOUS_MODE | SENSOR_FLAG_WAKE_UP, PipelineSensor)
 
 
 /*****************************************************************************/
@@ -15,8 +15,12 @@
  */
 
 #include <hardware/sensors.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "nusensors.h"
+#include "BoardConfig.h"
 
 /*****************************************************************************/
 
@@ -30,34 +34,101 @@
  * resolution by 4 bits.
  */
 
-static const struct sensor_t sSensorList[] = {
-        { .name       = "Accelerometer sensor",
-          .vendor     = "The Android Open Source Project",
-          .version    = 1,
-          .handle     = SENSORS_HANDLE_BASE+ID_A,
-          .type       = SENSOR_TYPE_ACCELEROMETER,
-          .maxRange   = 2.0f*9.81f,
-          .resolution = (2.0f*9.81f)/256.0f,
-          .power      = 0.2f,
-          .minDelay   = 7000,
-          .fifoReservedEventCount = 0,
-          .fifoMaxEventCount = 0,
-          .stringType = SENSOR_STRING_TYPE_ACCELEROMETER,
-          .requiredPermission = 0,
-          .maxDelay = 200000,
-          .flags = SENSOR_FLAG_CONTINUOUS_MODE,
-          .reserved   = {}
+#define SENSOR_LIST_ENTRY(handle_, type_, string_type_, name_, reserved_, flags_, driver_) \
+        { .name       = name_, \
+          .vendor     = "The Android Open Source Project", \
+          .version    = 1, \
+          .handle     = SENSORS_HANDLE_BASE+handle_, \
+          .type       = type_, \
+          .maxRange   = 2.0f*9.81f, \
+          .resolution = (2.0f*9.81f)/256.0f, \
+          .power      = 0.2f, \
+          .minDelay   = 7000, \
+          .fifoReservedEventCount = reserved_, \
+          .fifoMaxEventCount = (flags_) & SENSOR_FLAG_WAKE_UP ? \
+                  (reserved_) : KXTJ3_FIFO_EVENTS, \
+          .stringType = string_type_, \
+          .requiredPermission = 0, \
+          .maxDelay = 200000, \
+          .flags = flags_, \
+          .reserved   = {} \
         },
+
+static struct sensor_t sSensorList[] = {
+        NUSENSORS_SENSORS(SENSOR_LIST_ENTRY)
 };
 
+static pthread_once_t sSensorListOnce = PTHREAD_ONCE_INIT;
+static struct sensor_t* sMergedList = sSensorList;
+static int sMergedCount = ARRAY_SIZE(sSensorList);
+
+/* range, resolution, rates and FIFO sizes of the accel based sensors come from the board */
+static void init_sensor_list(void)
+{
+    const struct board_config* cfg = board_config_get();
+    float fastest = 0, slowest = 0;
+    unsigned int i;
+    int j;
+
+    for (j = 0; j < cfg->accel_odr_count; j++) {
+        float hz = cfg->accel_odr_hz[j];
+        if (hz <= 0)
+            continue;
+        if (fastest == 0 || hz > fastest)
+            fastest = hz;
+        if (slowest == 0 || hz < slowest)
+            slowest = hz;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(sSensorList); i++) {
+        struct sensor_t* s = &sSensorList[i];
+        if (s->type != SENSOR_TYPE_ACCELEROMETER && s->type != SENSOR_TYPE_GRAVITY &&
+                s->type != SENSOR_TYPE_LINEAR_ACCELERATION)
+            continue;
+
+        if (cfg->accel_scale_set) {
+            s->maxRange = cfg->accel_range * GRAVITY_EARTH;
+            s->resolution = GRAVITY_EARTH / cfg->accel_lsb_per_g;
+        }
+        if (fastest > 0) {
+            s->minDelay = 1000000 / fastest;
+            s->maxDelay = 1000000 / slowest;
+        }
+        /* the wake-up variant keeps its own FIFO, not the chip's */
+        if (s->type == SENSOR_TYPE_ACCELEROMETER && cfg->accel_fifo_max &&
+                !(s->flags & SENSOR_FLAG_WAKE_UP)) {
+            s->fifoReservedEventCount = cfg->accel_fifo_reserved;
+            s->fifoMaxEventCount = cfg->accel_fifo_max;
+        } else if (s->type == SENSOR_TYPE_ACCELEROMETER && cfg->accel_spill_samples &&
+                !(s->flags & SENSOR_FLAG_WAKE_UP)) {
+            /* long batches go on to the spill file */
+            s->fifoMaxEventCount += cfg->accel_spill_samples;
+        }
+    }
+
+    /* append the sub-HAL sensors behind ours */
+    const struct sensor_t* sub;
+    int numSub = multihal_get_sensors_list(&sub);
+    if (numSub > 0) {
+        struct sensor_t* merged = malloc((ARRAY_SIZE(sSensorList) + numSub) * sizeof(*merged));
+        if (merged) {
+            memcpy(merged, sSensorList, sizeof(sSensorList));
+            memcpy(merged + ARRAY_SIZE(sSensorList), sub, numSub * sizeof(*merged));
+            sMergedList = merged;
+            sMergedCount = ARRAY_SIZE(sSensorList) + numSub;
+        }
+    }
+}
+
 static int open_sensors(const struct hw_module_t* module, const char* name,
         struct hw_device_t** device);
 
 static int sensors__get_sensors_list(struct sensors_module_t* module,
         struct sensor_t const** list)
 {
-    *list = sSensorList;
-    return ARRAY_SIZE(sSensorList);
+    pthread_once(&sSensorListOnce, init_sensor_list);
+    *list = sMergedList;
+    return sMergedCount;
 }
 
 static struct hw_module_methods_t sensors_module_methods = {
@@ -74,7 +145,8 @@ static struct hw_module_methods_t sensors_module_methods = {
         .author = "The RKdroid Project",
         .methods = &sensors_module_methods,
     },
-    .get_sensors_list = sensors__get_sensors_list
+    .get_sensors_list = sensors__get_sensors_list,
+    .set_operation_mode = sensors_set_operation_mode
 };
 
 /*****************************************************************************/
@@ -82,5 +154,6 @@ static struct hw_module_methods_t sensors_module_methods = {
 static int open_sensors(const struct hw_module_t* module, const char* name,
         struct hw_device_t** device)
 {
+    pthread_once(&sSensorListOnce, init_sensor_list);
     return init_nusensors(module, device);
 }
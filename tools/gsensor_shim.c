@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * LD_PRELOAD stand-in for /dev/gsensor. Opening GSENSOR_DEV_PATH returns a
+ * /dev/null fd; ioctls on it are answered from the gsensor_sim control
+ * block, so the daemon sees enable and rate changes and can inject faults.
+ *
+ *   LD_PRELOAD=libgsensor_shim.so <program that loads the HAL>
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "../Gsensor.h"
+#include "gsensor_sim.h"
+
+/*****************************************************************************/
+
+static int (*real_open)(const char*, int, ...);
+static int (*real_close)(int);
+#ifdef __BIONIC__
+static int (*real_ioctl)(int, int, ...);
+#else
+static int (*real_ioctl)(int, unsigned long, ...);
+#endif
+
+static struct gsensor_sim_ctl* ctl;
+static int gsensor_fd = -1;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static void shim_init(void)
+{
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+
+    const char* path = getenv(GSENSOR_SIM_CTL_ENV);
+    if (!path)
+        path = GSENSOR_SIM_CTL_PATH;
+
+    int fd = real_open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "gsensor_shim: no control block at %s (%s)\n", path, strerror(errno));
+        return;
+    }
+    void* p = mmap(NULL, sizeof(*ctl), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    real_close(fd);
+    if (p == MAP_FAILED || ((struct gsensor_sim_ctl*)p)->magic != GSENSOR_SIM_MAGIC) {
+        fprintf(stderr, "gsensor_shim: bad control block at %s\n", path);
+        return;
+    }
+    ctl = p;
+}
+
+static int should_fail(uint32_t bit)
+{
+    if (!(ctl->fail_mask & bit) || !ctl->fail_permille)
+        return 0;
+    if ((uint32_t)(rand() % 1000) >= ctl->fail_permille)
+        return 0;
+    __atomic_add_fetch(&ctl->failures, 1, __ATOMIC_RELAXED);
+    errno = ctl->fail_errno ? ctl->fail_errno : EIO;
+    return 1;
+}
+
+static int open_gsensor(void)
+{
+    if (!ctl)
+        return real_open(GSENSOR_DEV_PATH, O_RDONLY);
+    if (should_fail(GSENSOR_SIM_FAIL_OPEN))
+        return -1;
+    gsensor_fd = real_open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return gsensor_fd;
+}
+
+static int shim_open(const char* path, int flags, va_list ap)
+{
+    mode_t mode = 0;
+    pthread_once(&once, shim_init);
+
+    if (flags & O_CREAT)
+        mode = va_arg(ap, int);
+    if (!strcmp(path, GSENSOR_DEV_PATH))
+        return open_gsensor();
+    return real_open(path, flags, mode);
+}
+
+int open(const char* path, int flags, ...)
+{
+    va_list ap;
+    va_start(ap, flags);
+    int fd = shim_open(path, flags, ap);
+    va_end(ap);
+    return fd;
+}
+
+#ifdef __GLIBC__
+int open64(const char* path, int flags, ...)
+{
+    va_list ap;
+    va_start(ap, flags);
+    int fd = shim_open(path, flags | O_LARGEFILE, ap);
+    va_end(ap);
+    return fd;
+}
+#endif
+
+int close(int fd)
+{
+    pthread_once(&once, shim_init);
+    if (fd >= 0 && fd == gsensor_fd)
+        gsensor_fd = -1;
+    return real_close(fd);
+}
+
+static int gsensor_ioctl(unsigned int cmd, void* arg)
+{
+    switch (cmd) {
+        case GSENSOR_IOCTL_START:
+            if (should_fail(GSENSOR_SIM_FAIL_START))
+                return -1;
+            __atomic_add_fetch(&ctl->starts, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&ctl->enabled, 1, __ATOMIC_RELEASE);
+            return 0;
+        case GSENSOR_IOCTL_CLOSE:
+            if (should_fail(GSENSOR_SIM_FAIL_CLOSE))
+                return -1;
+            __atomic_add_fetch(&ctl->closes, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&ctl->enabled, 0, __ATOMIC_RELEASE);
+            return 0;
+        case GSENSOR_IOCTL_APP_SET_RATE:
+            if (should_fail(GSENSOR_SIM_FAIL_RATE))
+                return -1;
+            __atomic_add_fetch(&ctl->rate_sets, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&ctl->rate_ms, *(short*)arg, __ATOMIC_RELEASE);
+            return 0;
+        case GSENSOR_IOCTL_GET_CALIBRATION:
+            if (should_fail(GSENSOR_SIM_FAIL_CAL))
+                return -1;
+            memcpy(arg, ctl->calibration, sizeof(ctl->calibration));
+            return 0;
+        case GSENSOR_IOCTL_GETDATA: {
+            if (should_fail(GSENSOR_SIM_FAIL_GETDATA))
+                return -1;
+            struct gsensor_axis axis;
+            uint32_t seq;
+            do {
+                seq = __atomic_load_n(&ctl->seq, __ATOMIC_ACQUIRE);
+                axis.x = ctl->axis[0];
+                axis.y = ctl->axis[1];
+                axis.z = ctl->axis[2];
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            } while ((seq & 1) || seq != __atomic_load_n(&ctl->seq, __ATOMIC_RELAXED));
+            memcpy(arg, &axis, sizeof(axis));
+            return 0;
+        }
+        case GSENSOR_IOCTL_INIT:
+        case GSENSOR_IOCTL_RESET:
+            return 0;
+    }
+    errno = ENOTTY;
+    return -1;
+}
+
+#ifdef __BIONIC__
+int ioctl(int fd, int request, ...)
+#else
+int ioctl(int fd, unsigned long request, ...)
+#endif
+{
+    va_list ap;
+    va_start(ap, request);
+    void* arg = va_arg(ap, void*);
+    va_end(ap);
+
+    pthread_once(&once, shim_init);
+    if (ctl && fd >= 0 && fd == gsensor_fd)
+        return gsensor_ioctl((unsigned int)request, arg);
+    return real_ioctl(fd, request, arg);
+}
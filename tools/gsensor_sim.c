@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * gsensor_sim: behaves like the KXTJ3 driver stack for HAL testing.
+ *
+ * A uinput device named "gsensor" emits ABS_X/Y/Z + SYN_REPORT at the rate
+ * programmed through GSENSOR_IOCTL_APP_SET_RATE, while enabled through
+ * GSENSOR_IOCTL_START/CLOSE. Those ioctls reach us through the control
+ * block written by libgsensor_shim in the HAL process.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include "../Gsensor.h"
+#include "gsensor_sim.h"
+
+/*****************************************************************************/
+
+#define LSB_PER_G       16384       // matches ACCELERATION_RATIO_ANDROID_TO_HW
+#define NSEC_PER_SEC    1000000000LL
+#define NSEC_PER_MSEC   1000000LL
+
+enum motion {
+    MOTION_STILL,
+    MOTION_SHAKE,
+    MOTION_ROTATE,
+};
+
+struct options {
+    const char* ctl_path;
+    int rate_ms;                /* 0: follow GSENSOR_IOCTL_APP_SET_RATE */
+    int always_on;
+    enum motion motion;
+    double noise_lsb;
+    double jitter_us;
+    int burst_count;            /* extra back-to-back samples... */
+    double burst_every_s;       /* ...every this many seconds */
+    double drop_every_s;        /* evdev buffer overflow (SYN_DROPPED) */
+    double stall_every_s;
+    int stall_ms;
+    uint32_t fail_mask;
+    int fail_permille;
+    int calibration[3];
+    int duration_s;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig)
+{
+    running = 0;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void sleep_until(int64_t t)
+{
+    struct timespec ts;
+    ts.tv_sec = t / NSEC_PER_SEC;
+    ts.tv_nsec = t % NSEC_PER_SEC;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && running)
+        ;
+}
+
+static double gaussian(void)
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static double uniform(double range)
+{
+    return range * (2.0 * rand() / RAND_MAX - 1.0);
+}
+
+/*****************************************************************************/
+
+static struct gsensor_sim_ctl* ctl_create(const struct options* o)
+{
+    int fd = open(o->ctl_path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "couldn't create %s (%s)\n", o->ctl_path, strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(struct gsensor_sim_ctl)) < 0) {
+        fprintf(stderr, "couldn't size %s (%s)\n", o->ctl_path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    struct gsensor_sim_ctl* ctl = mmap(NULL, sizeof(*ctl), PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    close(fd);
+    if (ctl == MAP_FAILED)
+        return NULL;
+
+    memset(ctl, 0, sizeof(*ctl));
+    memcpy(ctl->calibration, o->calibration, sizeof(ctl->calibration));
+    ctl->fail_mask = o->fail_mask;
+    ctl->fail_permille = o->fail_permille;
+    ctl->fail_errno = EIO;
+    ctl->rate_ms = 200;
+    ctl->enabled = o->always_on;
+    __atomic_store_n(&ctl->magic, GSENSOR_SIM_MAGIC, __ATOMIC_RELEASE);
+    return ctl;
+}
+
+static int uinput_create(void)
+{
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "couldn't open /dev/uinput (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    ioctl(fd, UI_SET_EVBIT, EV_SYN);
+    ioctl(fd, UI_SET_EVBIT, EV_ABS);
+    ioctl(fd, UI_SET_ABSBIT, ABS_X);
+    ioctl(fd, UI_SET_ABSBIT, ABS_Y);
+    ioctl(fd, UI_SET_ABSBIT, ABS_Z);
+
+    struct uinput_user_dev dev;
+    memset(&dev, 0, sizeof(dev));
+    strncpy(dev.name, "gsensor", UINPUT_MAX_NAME_SIZE - 1);
+    dev.id.bustype = BUS_VIRTUAL;
+    for (int axis = ABS_X; axis <= ABS_Z; axis++) {
+        dev.absmin[axis] = -32768;
+        dev.absmax[axis] = 32767;
+    }
+
+    if (write(fd, &dev, sizeof(dev)) != sizeof(dev) || ioctl(fd, UI_DEV_CREATE) < 0) {
+        fprintf(stderr, "couldn't create uinput device (%s)\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void emit(int fd, int type, int code, int value)
+{
+    struct input_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+    if (write(fd, &ev, sizeof(ev)) < 0 && errno != EAGAIN)
+        fprintf(stderr, "uinput write failed (%s)\n", strerror(errno));
+}
+
+static void sample(const struct options* o, double t, int axis[3])
+{
+    double g[3] = { 0.0, 0.0, 1.0 };
+
+    switch (o->motion) {
+        case MOTION_STILL:
+            break;
+        case MOTION_SHAKE:
+            g[0] = 0.5 * sin(2.0 * M_PI * 5.0 * t);
+            break;
+        case MOTION_ROTATE:
+            g[0] = sin(2.0 * M_PI * 0.25 * t);
+            g[2] = cos(2.0 * M_PI * 0.25 * t);
+            break;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        /* the HAL subtracts the calibration offset again */
+        axis[i] = (int)lrint(g[i] * LSB_PER_G + o->noise_lsb * gaussian()) + o->calibration[i];
+    }
+}
+
+static void publish(struct gsensor_sim_ctl* ctl, const int axis[3])
+{
+    uint32_t seq = ctl->seq;
+    __atomic_store_n(&ctl->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(ctl->axis, axis, sizeof(ctl->axis));
+    __atomic_store_n(&ctl->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void report(int fd, struct gsensor_sim_ctl* ctl, const struct options* o, double t)
+{
+    int axis[3];
+    sample(o, t, axis);
+    emit(fd, EV_ABS, ABS_X, axis[0]);
+    emit(fd, EV_ABS, ABS_Y, axis[1]);
+    emit(fd, EV_ABS, ABS_Z, axis[2]);
+    emit(fd, EV_SYN, SYN_REPORT, 0);
+    publish(ctl, axis);
+}
+
+/*****************************************************************************/
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -c PATH      control block (default $" GSENSOR_SIM_CTL_ENV " or " GSENSOR_SIM_CTL_PATH ")\n"
+        "  -r MS        fixed period, ignore GSENSOR_IOCTL_APP_SET_RATE\n"
+        "  -a           always on, don't wait for GSENSOR_IOCTL_START\n"
+        "  -m PROFILE   still | shake | rotate\n"
+        "  -n LSB       gaussian noise sigma (default 2; evdev drops repeated values)\n"
+        "  -j US        uniform period jitter\n"
+        "  -b N,SEC     burst of N extra samples every SEC seconds\n"
+        "  -d SEC       overflow the evdev buffer (SYN_DROPPED) every SEC seconds\n"
+        "  -s SEC,MS    stall for MS milliseconds every SEC seconds\n"
+        "  -f MASK,PERMILLE  fail selected ioctls (1 start, 2 close, 4 rate, 8 cal,\n"
+        "               16 getdata, 32 open) with this probability\n"
+        "  -o X,Y,Z     calibration offsets returned by GET_CALIBRATION\n"
+        "  -t SEC       exit after SEC seconds\n",
+        name);
+}
+
+int main(int argc, char** argv)
+{
+    struct options o;
+    memset(&o, 0, sizeof(o));
+    o.ctl_path = getenv(GSENSOR_SIM_CTL_ENV);
+    if (!o.ctl_path)
+        o.ctl_path = GSENSOR_SIM_CTL_PATH;
+    o.noise_lsb = 2.0;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:r:am:n:j:b:d:s:f:o:t:h")) != -1) {
+        switch (c) {
+            case 'c': o.ctl_path = optarg; break;
+            case 'r': o.rate_ms = atoi(optarg); break;
+            case 'a': o.always_on = 1; break;
+            case 'm':
+                if (!strcmp(optarg, "shake"))
+                    o.motion = MOTION_SHAKE;
+                else if (!strcmp(optarg, "rotate"))
+                    o.motion = MOTION_ROTATE;
+                else
+                    o.motion = MOTION_STILL;
+                break;
+            case 'n': o.noise_lsb = atof(optarg); break;
+            case 'j': o.jitter_us = atof(optarg); break;
+            case 'b': sscanf(optarg, "%d,%lf", &o.burst_count, &o.burst_every_s); break;
+            case 'd': o.drop_every_s = atof(optarg); break;
+            case 's': sscanf(optarg, "%lf,%d", &o.stall_every_s, &o.stall_ms); break;
+            case 'f': sscanf(optarg, "%i,%d", (int*)&o.fail_mask, &o.fail_permille); break;
+            case 'o':
+                sscanf(optarg, "%d,%d,%d", &o.calibration[0], &o.calibration[1], &o.calibration[2]);
+                break;
+            case 't': o.duration_s = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    struct gsensor_sim_ctl* ctl = ctl_create(&o);
+    if (!ctl)
+        return 1;
+    int fd = uinput_create();
+    if (fd < 0)
+        return 1;
+
+    int64_t start = now_ns();
+    int64_t next = start;
+    int64_t next_burst = start + (int64_t)(o.burst_every_s * NSEC_PER_SEC);
+    int64_t next_drop = start + (int64_t)(o.drop_every_s * NSEC_PER_SEC);
+    int64_t next_stall = start + (int64_t)(o.stall_every_s * NSEC_PER_SEC);
+    uint64_t samples = 0;
+    int64_t last_status = start;
+
+    fprintf(stderr, "gsensor_sim: running, control block %s\n", o.ctl_path);
+
+    while (running) {
+        int64_t now = now_ns();
+        if (o.duration_s && now - start >= (int64_t)o.duration_s * NSEC_PER_SEC)
+            break;
+
+        int enabled = __atomic_load_n(&ctl->enabled, __ATOMIC_ACQUIRE);
+        int period_ms = o.rate_ms ? o.rate_ms : __atomic_load_n(&ctl->rate_ms, __ATOMIC_ACQUIRE);
+        if (period_ms <= 0)
+            period_ms = 1;
+        int64_t period = period_ms * NSEC_PER_MSEC;
+
+        if (!enabled) {
+            /* the driver is closed: idle and resync on the next START */
+            sleep_until(now + 10 * NSEC_PER_MSEC);
+            next = now_ns();
+            continue;
+        }
+
+        if (o.stall_every_s > 0 && now >= next_stall) {
+            fprintf(stderr, "gsensor_sim: stalling for %d ms\n", o.stall_ms);
+            sleep_until(now + o.stall_ms * NSEC_PER_MSEC);
+            next_stall = now_ns() + (int64_t)(o.stall_every_s * NSEC_PER_SEC);
+            next = now_ns();
+            continue;
+        }
+
+        double t = (now - start) / (double)NSEC_PER_SEC;
+        report(fd, ctl, &o, t);
+        samples++;
+
+        if (o.burst_every_s > 0 && now >= next_burst) {
+            for (int i = 0; i < o.burst_count; i++)
+                report(fd, ctl, &o, t);
+            samples += o.burst_count;
+            next_burst = now + (int64_t)(o.burst_every_s * NSEC_PER_SEC);
+        }
+
+        if (o.drop_every_s > 0 && now >= next_drop) {
+            /*
+             * uinput can't inject SYN_DROPPED itself; the evdev client
+             * buffer generates it when overrun, so flood it.
+             */
+            for (int i = 0; i < 1024; i++)
+                report(fd, ctl, &o, t);
+            samples += 1024;
+            next_drop = now + (int64_t)(o.drop_every_s * NSEC_PER_SEC);
+        }
+
+        if (now - last_status >= 10 * NSEC_PER_SEC) {
+            fprintf(stderr, "gsensor_sim: %llu samples, period %d ms, starts %u closes %u "
+                    "rate sets %u ioctl failures %u\n",
+                    (unsigned long long)samples, period_ms, ctl->starts, ctl->closes,
+                    ctl->rate_sets, ctl->failures);
+            last_status = now;
+        }
+
+        next += period;
+        if (o.jitter_us > 0)
+            sleep_until(next + (int64_t)(uniform(o.jitter_us) * 1000));
+        else
+            sleep_until(next);
+    }
+
+    ioctl(fd, UI_DEV_DESTROY);
+    close(fd);
+    munmap(ctl, sizeof(*ctl));
+    fprintf(stderr, "gsensor_sim: %llu samples\n", (unsigned long long)samples);
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GSENSOR_SIM_H
+#define GSENSOR_SIM_H
+
+#include <stdint.h>
+
+/*
+ * Control block shared between gsensor_sim (which owns the uinput device)
+ * and libgsensor_shim (LD_PRELOADed into the HAL process, where it stands
+ * in for /dev/gsensor). Both sides map the same file.
+ */
+
+#define GSENSOR_SIM_CTL_PATH    "/data/local/tmp/gsensor_sim.ctl"
+#define GSENSOR_SIM_CTL_ENV     "GSENSOR_SIM_CTL"
+#define GSENSOR_SIM_MAGIC       0x4753494d  // "GSIM"
+
+/* ioctl fault selection bits */
+#define GSENSOR_SIM_FAIL_START      (1 << 0)
+#define GSENSOR_SIM_FAIL_CLOSE      (1 << 1)
+#define GSENSOR_SIM_FAIL_RATE       (1 << 2)
+#define GSENSOR_SIM_FAIL_CAL        (1 << 3)
+#define GSENSOR_SIM_FAIL_GETDATA    (1 << 4)
+#define GSENSOR_SIM_FAIL_OPEN       (1 << 5)
+
+struct gsensor_sim_ctl {
+    uint32_t magic;
+
+    /* written by the shim, read by the daemon */
+    volatile int32_t enabled;
+    volatile int32_t rate_ms;
+    volatile uint32_t starts;
+    volatile uint32_t closes;
+    volatile uint32_t rate_sets;
+    volatile uint32_t failures;
+
+    /* written by the daemon, read by the shim */
+    int32_t calibration[3];
+    uint32_t fail_mask;
+    uint32_t fail_permille;     // probability of a selected ioctl failing
+    int32_t fail_errno;
+
+    /* latest sample for GSENSOR_IOCTL_GETDATA, seqlock protected */
+    volatile uint32_t seq;
+    int32_t axis[3];
+};
+
+#endif  // GSENSOR_SIM_H
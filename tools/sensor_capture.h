@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SENSOR_CAPTURE_H
+#define SENSOR_CAPTURE_H
+
+#include <stdint.h>
+
+/*
+ * Event stream capture, written by sensor_stream -w and read by
+ * sensor_conform. A simulator can produce one as well, in either form:
+ *
+ * binary: SENSOR_CAPTURE_MAGIC, then struct sensor_capture_record after
+ * struct sensor_capture_record in host byte order.
+ *
+ * text: one record per line, "KIND TIME HANDLE [VALUE [LATENCY]]", KIND
+ * being the letter below; '#' starts a comment.
+ *
+ * All times are CLOCK_BOOTTIME ns, the clock of the sample timestamps.
+ */
+
+#define SENSOR_CAPTURE_MAGIC    "SNSCAP01"
+#define SENSOR_CAPTURE_MAGIC_LEN 8
+
+enum {
+    SENSOR_CAPTURE_EVENT = 1,       /* E: a sample was delivered, VALUE is its timestamp */
+    SENSOR_CAPTURE_FLUSH_DONE,      /* C: a flush completion was delivered */
+    SENSOR_CAPTURE_CONFIG,          /* B: batch()/setDelay(), VALUE period, LATENCY */
+    SENSOR_CAPTURE_ACTIVATE,        /* A: activate(1) */
+    SENSOR_CAPTURE_DEACTIVATE,      /* D: activate(0) */
+    SENSOR_CAPTURE_FLUSH,           /* F: flush() was called */
+};
+
+struct sensor_capture_record {
+    int64_t time;               /* when it happened, delivery time for E and C */
+    int64_t value;
+    int64_t latency;
+    int32_t handle;
+    int32_t kind;
+};
+
+#endif  // SENSOR_CAPTURE_H
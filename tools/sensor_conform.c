@@ -0,0 +1,486 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * sensor_conform: checks a capture (see sensor_capture.h) against what
+ * the framework expects of a HAL, offline, so long runs from a board or
+ * a simulation can be judged after the fact.
+ *
+ * A capture is split per handle into segments, one per activation or
+ * reconfiguration. In each segment, after the first -k samples:
+ *  - the achieved rate must lie within -r percent of the requested one,
+ *  - the 95th percentile of the jitter, the distance of each interval
+ *    from the median interval, must stay under -j percent of the period,
+ *  - no sample may be delivered later than the batch latency plus -L ms.
+ * Across the whole capture, timestamps must increase and never lie in the
+ * future, every flush() must get exactly one completion, and no sample
+ * older than a flush() may come after its completion. Handles given
+ * with -o are on-change sensors and skip the rate and jitter checks.
+ *
+ *   sensor_stream -m sensors.amlogic.so -s 0,10000 -t 60 -w /data/local/tmp/cap
+ *   sensor_conform /data/local/tmp/cap
+ *
+ * Exits with 0 when everything passed, 1 on a failed check, 2 on errors.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sensor_capture.h"
+
+#define MAX_TRACKS      64
+#define MAX_ON_CHANGE   16
+#define READ_CHUNK      4096
+
+struct segment {
+    int64_t start;
+    int64_t end;
+    int64_t period;
+    int64_t latency;
+    size_t first;               /* samples [first, last) of the track */
+    size_t last;
+};
+
+struct track {
+    int handle;
+    int on_change;
+
+    /* samples in delivery order, kept as columns for the checks */
+    int64_t* ts;
+    int64_t* delivered;
+    size_t n;
+    size_t cap;
+
+    struct segment* segs;
+    int num_segs;
+    int cap_segs;
+    int active;
+    int64_t period;
+    int64_t latency;
+
+    /* flush() calls still waiting for their completion, oldest first */
+    int64_t* flushes;
+    int num_flushes;
+    int cap_flushes;
+    int64_t completed;          /* time of the last flush() completed, or -1 */
+
+    long unsolicited;
+    long missing;
+    long misordered;
+};
+
+struct options {
+    int skip;
+    int rate_lo;
+    int rate_hi;
+    int jitter_pct;
+    int64_t slack_ns;
+    int num_on_change;
+    int on_change[MAX_ON_CHANGE];
+};
+
+static struct track sTracks[MAX_TRACKS];
+static int sNumTracks;
+
+/*****************************************************************************/
+
+static void* grow(void* p, size_t* cap, size_t size)
+{
+    size_t n = *cap ? *cap * 2 : 256;
+    void* q = realloc(p, n * size);
+    if (!q) {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+    *cap = n;
+    return q;
+}
+
+static struct track* find_track(const struct options* o, int handle)
+{
+    for (int i = 0; i < sNumTracks; i++) {
+        if (sTracks[i].handle == handle)
+            return &sTracks[i];
+    }
+    if (sNumTracks == MAX_TRACKS) {
+        fprintf(stderr, "more than %d handles in the capture\n", MAX_TRACKS);
+        exit(2);
+    }
+    struct track* t = &sTracks[sNumTracks++];
+    memset(t, 0, sizeof(*t));
+    t->handle = handle;
+    t->completed = -1;
+    for (int i = 0; i < o->num_on_change; i++) {
+        if (o->on_change[i] == handle)
+            t->on_change = 1;
+    }
+    return t;
+}
+
+static void begin_segment(struct track* t, int64_t time)
+{
+    if (t->num_segs == t->cap_segs) {
+        size_t cap = t->cap_segs;
+        t->segs = grow(t->segs, &cap, sizeof(*t->segs));
+        t->cap_segs = cap;
+    }
+    struct segment* s = &t->segs[t->num_segs++];
+    s->start = time;
+    s->end = time;
+    s->period = t->period;
+    s->latency = t->latency;
+    s->first = t->n;
+    s->last = t->n;
+}
+
+static void end_segment(struct track* t, int64_t time)
+{
+    struct segment* s = &t->segs[t->num_segs - 1];
+    s->end = time;
+    s->last = t->n;
+}
+
+static void add_record(const struct options* o, const struct sensor_capture_record* r)
+{
+    struct track* t = find_track(o, r->handle);
+
+    switch (r->kind) {
+        case SENSOR_CAPTURE_EVENT:
+            if (t->n == t->cap) {
+                size_t cap = t->cap;
+                t->ts = grow(t->ts, &cap, sizeof(*t->ts));
+                t->delivered = grow(t->delivered, &t->cap, sizeof(*t->delivered));
+            }
+            t->ts[t->n] = r->value;
+            t->delivered[t->n] = r->time;
+            t->n++;
+            /* it should have gone out ahead of the completion */
+            if (t->completed >= 0 && r->value < t->completed - o->slack_ns)
+                t->misordered++;
+            break;
+        case SENSOR_CAPTURE_FLUSH_DONE:
+            if (t->num_flushes == 0) {
+                t->unsolicited++;
+                break;
+            }
+            t->completed = t->flushes[0];
+            memmove(t->flushes, t->flushes + 1, --t->num_flushes * sizeof(*t->flushes));
+            break;
+        case SENSOR_CAPTURE_CONFIG:
+            t->period = r->value;
+            t->latency = r->latency;
+            if (t->active) {
+                end_segment(t, r->time);
+                begin_segment(t, r->time);
+            }
+            break;
+        case SENSOR_CAPTURE_ACTIVATE:
+            if (t->active)
+                end_segment(t, r->time);
+            t->active = 1;
+            begin_segment(t, r->time);
+            break;
+        case SENSOR_CAPTURE_DEACTIVATE:
+            if (t->active)
+                end_segment(t, r->time);
+            t->active = 0;
+            break;
+        case SENSOR_CAPTURE_FLUSH:
+            if (t->num_flushes == t->cap_flushes) {
+                size_t cap = t->cap_flushes;
+                t->flushes = grow(t->flushes, &cap, sizeof(*t->flushes));
+                t->cap_flushes = cap;
+            }
+            t->flushes[t->num_flushes++] = r->time;
+            break;
+        default:
+            fprintf(stderr, "unknown record kind %d\n", r->kind);
+            exit(2);
+    }
+}
+
+static int read_binary(const struct options* o, FILE* f)
+{
+    static struct sensor_capture_record records[READ_CHUNK];
+    size_t n;
+
+    while ((n = fread(records, sizeof(records[0]), READ_CHUNK, f)) > 0) {
+        for (size_t i = 0; i < n; i++)
+            add_record(o, &records[i]);
+    }
+    return ferror(f) ? -EIO : 0;
+}
+
+static int read_text(const struct options* o, FILE* f)
+{
+    static const char kinds[] = " ECBADF";
+    char line[256];
+    int lineno = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        struct sensor_capture_record r;
+        char kind;
+        lineno++;
+        char* hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+        memset(&r, 0, sizeof(r));
+        int n = sscanf(line, " %c %" SCNd64 " %d %" SCNd64 " %" SCNd64,
+                &kind, &r.time, &r.handle, &r.value, &r.latency);
+        if (n <= 0)
+            continue;
+        const char* k = kind ? strchr(kinds + 1, kind) : NULL;
+        if (n < 3 || !k) {
+            fprintf(stderr, "line %d: bad record\n", lineno);
+            return -EINVAL;
+        }
+        r.kind = k - kinds;
+        add_record(o, &r);
+    }
+    return ferror(f) ? -EIO : 0;
+}
+
+/*****************************************************************************/
+
+/* k-th smallest of v[0..n), reorders v */
+static int64_t select_nth(int64_t* v, size_t n, size_t k)
+{
+    size_t lo = 0, hi = n - 1;
+
+    while (lo < hi) {
+        int64_t pivot = v[lo + (hi - lo) / 2];
+        size_t i = lo, j = hi;
+        while (i <= j) {
+            while (v[i] < pivot)
+                i++;
+            while (v[j] > pivot)
+                j--;
+            if (i <= j) {
+                int64_t tmp = v[i];
+                v[i] = v[j];
+                v[j] = tmp;
+                i++;
+                if (j == 0)
+                    break;
+                j--;
+            }
+        }
+        if (k <= j)
+            hi = j;
+        else if (k >= i)
+            lo = i;
+        else
+            break;
+    }
+    return v[k];
+}
+
+static int64_t percentile(int64_t* v, size_t n, int pct)
+{
+    return select_nth(v, n, (n - 1) * pct / 100);
+}
+
+static long count_late(const int64_t* ts, const int64_t* delivered, size_t n,
+        int64_t limit)
+{
+    long late = 0;
+    for (size_t i = 0; i < n; i++)
+        late += delivered[i] - ts[i] > limit;
+    return late;
+}
+
+/* checks one segment and prints it; returns the number of failed checks */
+static int check_segment(const struct options* o, const struct track* t,
+        const struct segment* s, int index, int64_t* scratch)
+{
+    size_t first = s->first + o->skip;
+    size_t n = s->last > first ? s->last - first : 0;
+    const int64_t* ts = t->ts + first;
+    int failed = 0;
+
+    printf("handle %d seg %d: period %.3f ms latency %.1f ms, %zu samples",
+            t->handle, index, s->period / 1e6, s->latency / 1e6, s->last - s->first);
+
+    long late = count_late(ts, t->delivered + first, n, s->latency + o->slack_ns);
+    if (late) {
+        printf(", %ld late", late);
+        failed++;
+    }
+
+    if (!t->on_change && s->period > 0 && n >= 2 && ts[n - 1] > ts[0]) {
+        double rate = (n - 1) * 1e9 / (ts[n - 1] - ts[0]);
+        double pct = rate * s->period / 1e7;
+        printf(", rate %.2f Hz (%.0f%%)", rate, pct);
+        if (pct < o->rate_lo || pct > o->rate_hi) {
+            printf(" OUT OF RANGE");
+            failed++;
+        }
+
+        size_t m = n - 1;
+        for (size_t i = 0; i < m; i++)
+            scratch[i] = ts[i + 1] - ts[i];
+        int64_t median = percentile(scratch, m, 50);
+        for (size_t i = 0; i < m; i++) {
+            int64_t d = scratch[i] - median;
+            scratch[i] = d < 0 ? -d : d;
+        }
+        int64_t p50 = percentile(scratch, m, 50);
+        int64_t p95 = percentile(scratch, m, 95);
+        int64_t p99 = percentile(scratch, m, 99);
+        int64_t max = percentile(scratch, m, 100);
+        printf(", jitter us p50 %.0f p95 %.0f p99 %.0f max %.0f",
+                p50 / 1e3, p95 / 1e3, p99 / 1e3, max / 1e3);
+        if (p95 * 100 > s->period * o->jitter_pct) {
+            printf(" TOO HIGH");
+            failed++;
+        }
+    } else if (!t->on_change && s->period > 0) {
+        printf(", too few samples for the rate");
+    }
+
+    printf("%s\n", failed ? "  FAIL" : "");
+    return failed;
+}
+
+static int check_track(const struct options* o, struct track* t)
+{
+    long backwards = 0, future = 0;
+    int failed = 0;
+
+    for (size_t i = 1; i < t->n; i++)
+        backwards += t->ts[i] <= t->ts[i - 1];
+    for (size_t i = 0; i < t->n; i++)
+        future += t->ts[i] > t->delivered[i];
+
+    if (t->active)
+        end_segment(t, t->n ? t->delivered[t->n - 1] : t->segs[t->num_segs - 1].start);
+
+    int64_t* scratch = malloc((t->n ? t->n : 1) * sizeof(*scratch));
+    if (!scratch) {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+    for (int i = 0; i < t->num_segs; i++)
+        failed += check_segment(o, t, &t->segs[i], i, scratch);
+    free(scratch);
+
+    t->missing = t->num_flushes;
+    printf("handle %d: %zu samples, %ld non-monotonic, %ld in the future, "
+            "flushes: %ld unsolicited, %ld missing, %ld samples after completion\n",
+            t->handle, t->n, backwards, future,
+            t->unsolicited, t->missing, t->misordered);
+    if (backwards || future || t->unsolicited || t->missing || t->misordered)
+        failed++;
+    return failed;
+}
+
+/*****************************************************************************/
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "usage: %s [options] CAPTURE\n"
+        "  -k N         skip the first N samples of each segment (default 10)\n"
+        "  -r LO,HI     accepted rate in percent of the requested (default 90,220)\n"
+        "  -j PCT       accepted p95 jitter in percent of the period (default 10)\n"
+        "  -L MS        slack on the batch latency and flush ordering (default 100)\n"
+        "  -o HANDLE    HANDLE is an on-change sensor, no rate or jitter checks\n"
+        "CAPTURE is binary from sensor_stream -w or text, '-' for stdin.\n",
+        name);
+}
+
+int main(int argc, char** argv)
+{
+    struct options o;
+    int c;
+
+    memset(&o, 0, sizeof(o));
+    o.skip = 10;
+    o.rate_lo = 90;
+    o.rate_hi = 220;
+    o.jitter_pct = 10;
+    o.slack_ns = 100000000LL;
+
+    while ((c = getopt(argc, argv, "k:r:j:L:o:h")) != -1) {
+        switch (c) {
+            case 'k': o.skip = atoi(optarg); break;
+            case 'r':
+                if (sscanf(optarg, "%d,%d", &o.rate_lo, &o.rate_hi) != 2) {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'j': o.jitter_pct = atoi(optarg); break;
+            case 'L': o.slack_ns = atoll(optarg) * 1000000LL; break;
+            case 'o':
+                if (o.num_on_change == MAX_ON_CHANGE) {
+                    fprintf(stderr, "too many on-change handles\n");
+                    return 2;
+                }
+                o.on_change[o.num_on_change++] = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    const char* path = argv[optind];
+    FILE* f = strcmp(path, "-") ? fopen(path, "re") : stdin;
+    if (!f) {
+        fprintf(stderr, "couldn't open %s (%s)\n", path, strerror(errno));
+        return 2;
+    }
+
+    /* binary captures start with the magic; text records never start with 'S' */
+    int err;
+    int first = getc(f);
+    ungetc(first, f);
+    if (first == SENSOR_CAPTURE_MAGIC[0]) {
+        char magic[SENSOR_CAPTURE_MAGIC_LEN];
+        if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+                memcmp(magic, SENSOR_CAPTURE_MAGIC, sizeof(magic)))
+            err = -EINVAL;
+        else
+            err = read_binary(&o, f);
+    } else {
+        err = read_text(&o, f);
+    }
+    if (f != stdin)
+        fclose(f);
+    if (err) {
+        fprintf(stderr, "couldn't read %s (%s)\n", path, strerror(-err));
+        return 2;
+    }
+    if (!sNumTracks) {
+        fprintf(stderr, "%s has no records\n", path);
+        return 2;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < sNumTracks; i++)
+        failed += check_track(&o, &sTracks[i]);
+    printf("%s: %d failed check%s\n", failed ? "FAIL" : "PASS", failed, failed == 1 ? "" : "s");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,532 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * sensor_stream: drives the sensors HAL module without the sensor service.
+ *
+ * The module is dlopen()ed and opened through HAL_MODULE_INFO_SYM like
+ * hw_get_module() would; the chosen handles are batched, activated and
+ * optionally flushed, and the poll loop runs on this thread. At the end
+ * (and every -i seconds) each handle reports the achieved rate, the
+ * jitter of the sample timestamps, percentiles of the latency from sample
+ * timestamp to delivery, and the process CPU time per event. With -w,
+ * every call and delivered event is also captured for sensor_conform.
+ * With -q, events come through the module's HAL 2.x style event queue
+ * instead, read from shared memory, and wake-up events are acknowledged
+ * the way the framework would.
+ * On a host, the host builds of the module and of libgsensor_shim run it
+ * against gsensor_sim:
+ *
+ *   gsensor_sim -a &
+ *   LD_PRELOAD=libgsensor_shim.so sensor_stream -m sensors.amlogic.so -s 0,10000
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <hardware/sensors.h>
+
+#include "sensor_capture.h"
+
+/*****************************************************************************/
+
+#ifdef __LP64__
+#define DEFAULT_MODULE_PATH "/vendor/lib64/hw/sensors.amlogic.so"
+#else
+#define DEFAULT_MODULE_PATH "/vendor/lib/hw/sensors.amlogic.so"
+#endif
+
+#define NSEC_PER_SEC    1000000000LL
+#define NSEC_PER_USEC   1000LL
+#define MAX_STREAMS     16
+#define POLL_EVENTS     64
+#define QUEUE_WAIT_NS   100000000LL     /* so -i and -t still run on an idle queue */
+
+struct stream {
+    int handle;
+    int64_t period_ns;
+    int64_t latency_ns;         /* max report latency passed to batch() */
+
+    /* since the last report */
+    uint64_t count;
+    int64_t last_ts;
+    double interval_sum;
+    double interval_sq_sum;
+    int64_t interval_max;
+    int64_t* delays;            /* delivery - timestamp, per event */
+    size_t delay_count;
+    size_t delay_cap;
+    uint32_t flushes;
+};
+
+/* the event queue adapter exported by the module, see SensorsHal2.h */
+struct hal2 {
+    void* (*start)(struct sensors_poll_device_1* dev, size_t eventQueueSize, int* fd);
+    void (*stop)(void* adapter);
+    void* (*attach)(int fd);
+    int (*read)(void* client, sensors_event_t* data, int count, int64_t timeoutNs);
+    int (*ack)(void* client, uint32_t count);
+    void (*detach)(void* client);
+    void* adapter;
+    void* client;
+};
+
+struct options {
+    const char* module_path;
+    int list;
+    int flush;
+    int duration_s;
+    int interval_s;
+    FILE* capture;
+    int queue_size;
+    struct hal2 hal2;
+    const struct sensor_t* sensors;
+    int num_sensors;
+    struct stream streams[MAX_STREAMS];
+    int num_streams;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig)
+{
+    running = 0;
+}
+
+static int64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void capture(struct options* o, int kind, int64_t time, int handle,
+        int64_t value, int64_t latency)
+{
+    struct sensor_capture_record r;
+
+    if (!o->capture)
+        return;
+    r.time = time;
+    r.value = value;
+    r.latency = latency;
+    r.handle = handle;
+    r.kind = kind;
+    fwrite(&r, sizeof(r), 1, o->capture);
+}
+
+/*****************************************************************************/
+
+static struct sensors_module_t* load_module(const char* path)
+{
+    void* lib = dlopen(path, RTLD_NOW);
+    if (!lib) {
+        fprintf(stderr, "couldn't load %s (%s)\n", path, dlerror());
+        return NULL;
+    }
+    struct sensors_module_t* module = dlsym(lib, HAL_MODULE_INFO_SYM_AS_STR);
+    if (!module) {
+        fprintf(stderr, "%s has no %s\n", path, HAL_MODULE_INFO_SYM_AS_STR);
+        dlclose(lib);
+        return NULL;
+    }
+    if (strcmp(module->common.id, SENSORS_HARDWARE_MODULE_ID)) {
+        fprintf(stderr, "%s is module \"%s\", not %s\n", path, module->common.id,
+                SENSORS_HARDWARE_MODULE_ID);
+        dlclose(lib);
+        return NULL;
+    }
+    module->common.dso = lib;
+    return module;
+}
+
+static void list_sensors(const struct sensor_t* list, int count)
+{
+    printf("%-6s %-6s %-36s %-32s %10s %10s %6s\n",
+            "handle", "type", "string type", "name", "min us", "max us", "fifo");
+    for (int i = 0; i < count; i++) {
+        const struct sensor_t* s = &list[i];
+        printf("%-6d %-6d %-36s %-32s %10d %10ld %6u\n",
+                s->handle, s->type, s->stringType ? s->stringType : "", s->name,
+                s->minDelay, (long)s->maxDelay, s->fifoMaxEventCount);
+    }
+}
+
+static int is_wake_up(const struct options* o, int handle)
+{
+    for (int i = 0; i < o->num_sensors; i++) {
+        if (o->sensors[i].handle == handle)
+            return (o->sensors[i].flags & SENSOR_FLAG_WAKE_UP) != 0;
+    }
+    return 0;
+}
+
+static struct stream* find_stream(struct options* o, int handle)
+{
+    for (int i = 0; i < o->num_streams; i++) {
+        if (o->streams[i].handle == handle)
+            return &o->streams[i];
+    }
+    return NULL;
+}
+
+/*****************************************************************************/
+
+static void record(struct stream* s, const sensors_event_t* ev, int64_t delivered)
+{
+    if (s->count) {
+        int64_t interval = ev->timestamp - s->last_ts;
+        s->interval_sum += interval;
+        s->interval_sq_sum += (double)interval * interval;
+        if (interval > s->interval_max)
+            s->interval_max = interval;
+    }
+    s->last_ts = ev->timestamp;
+    s->count++;
+
+    if (s->delay_count == s->delay_cap) {
+        size_t cap = s->delay_cap ? s->delay_cap * 2 : 1024;
+        int64_t* delays = realloc(s->delays, cap * sizeof(*delays));
+        if (!delays)
+            return;
+        s->delays = delays;
+        s->delay_cap = cap;
+    }
+    s->delays[s->delay_count++] = delivered - ev->timestamp;
+}
+
+static int compare_int64(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const int64_t* sorted, size_t count, int p)
+{
+    if (!count)
+        return 0.0;
+    size_t i = (count * p + 99) / 100;
+    if (i)
+        i--;
+    return sorted[i] / (double)NSEC_PER_USEC;
+}
+
+static void report(struct options* o, int64_t elapsed, int64_t cpu)
+{
+    uint64_t events = 0;
+    for (int i = 0; i < o->num_streams; i++)
+        events += o->streams[i].count;
+
+    printf("--- %.3f s, %llu events, cpu %.1f us/event\n",
+            elapsed / (double)NSEC_PER_SEC, (unsigned long long)events,
+            events ? cpu / (double)events / NSEC_PER_USEC : 0.0);
+
+    for (int i = 0; i < o->num_streams; i++) {
+        struct stream* s = &o->streams[i];
+        double rate = s->count * (double)NSEC_PER_SEC / elapsed;
+        double mean = 0.0, sdev = 0.0;
+        if (s->count > 1) {
+            uint64_t n = s->count - 1;
+            mean = s->interval_sum / n;
+            sdev = sqrt(fmax(s->interval_sq_sum / n - mean * mean, 0.0));
+        }
+
+        qsort(s->delays, s->delay_count, sizeof(*s->delays), compare_int64);
+        printf("handle %d: %llu events %.2f Hz (requested %.2f Hz)"
+                " interval mean %.1f us sdev %.1f us max %.1f us flushes %u\n",
+                s->handle, (unsigned long long)s->count, rate,
+                s->period_ns ? NSEC_PER_SEC / (double)s->period_ns : 0.0,
+                mean / NSEC_PER_USEC, sdev / NSEC_PER_USEC,
+                s->interval_max / (double)NSEC_PER_USEC, s->flushes);
+        printf("    latency us p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+                percentile_us(s->delays, s->delay_count, 50),
+                percentile_us(s->delays, s->delay_count, 90),
+                percentile_us(s->delays, s->delay_count, 99),
+                percentile_us(s->delays, s->delay_count, 100));
+
+        s->count = 0;
+        s->interval_sum = 0.0;
+        s->interval_sq_sum = 0.0;
+        s->interval_max = 0;
+        s->delay_count = 0;
+        s->flushes = 0;
+    }
+    fflush(stdout);
+}
+
+static int start_hal2(struct sensors_module_t* module, struct sensors_poll_device_1* dev,
+        struct options* o)
+{
+    struct hal2* h = &o->hal2;
+    void* lib = module->common.dso;
+
+    h->start = dlsym(lib, "sensors_hal2_start");
+    h->stop = dlsym(lib, "sensors_hal2_stop");
+    h->attach = dlsym(lib, "sensors_hal2_client_attach");
+    h->read = dlsym(lib, "sensors_hal2_client_read");
+    h->ack = dlsym(lib, "sensors_hal2_client_ack");
+    h->detach = dlsym(lib, "sensors_hal2_client_detach");
+    if (!h->start || !h->stop || !h->attach || !h->read || !h->ack || !h->detach) {
+        fprintf(stderr, "%s has no event queue adapter\n", o->module_path);
+        return -ENOSYS;
+    }
+
+    int fd;
+    h->adapter = h->start(dev, o->queue_size, &fd);
+    if (!h->adapter) {
+        fprintf(stderr, "couldn't start the event queue adapter\n");
+        return -ENODEV;
+    }
+    h->client = h->attach(fd);
+    if (!h->client) {
+        h->stop(h->adapter);
+        h->adapter = NULL;
+        return -ENODEV;
+    }
+    return 0;
+}
+
+static void stop_hal2(struct options* o)
+{
+    if (o->hal2.client)
+        o->hal2.detach(o->hal2.client);
+    if (o->hal2.adapter)
+        o->hal2.stop(o->hal2.adapter);
+    o->hal2.client = o->hal2.adapter = NULL;
+}
+
+static int read_events(struct sensors_poll_device_1* dev, struct options* o,
+        sensors_event_t* buffer, int count)
+{
+    if (o->hal2.client)
+        return o->hal2.read(o->hal2.client, buffer, count, QUEUE_WAIT_NS);
+    return dev->poll(&dev->v0, buffer, count);
+}
+
+/* sample timestamps are elapsedRealtimeNano(), so delivery is measured on CLOCK_BOOTTIME too */
+static void stream_events(struct sensors_poll_device_1* dev, struct options* o)
+{
+    sensors_event_t buffer[POLL_EVENTS];
+    int64_t start = clock_ns(CLOCK_BOOTTIME);
+    int64_t cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    int64_t last = start;
+    int64_t end = o->duration_s ? start + o->duration_s * NSEC_PER_SEC : 0;
+
+    while (running) {
+        int n = read_events(dev, o, buffer, POLL_EVENTS);
+        int64_t now = clock_ns(CLOCK_BOOTTIME);
+        if (n < 0) {
+            if (n == -EINTR)
+                continue;
+            fprintf(stderr, "poll failed (%s)\n", strerror(-n));
+            break;
+        }
+
+        uint32_t wake_up = 0;
+        for (int i = 0; i < n; i++) {
+            const sensors_event_t* ev = &buffer[i];
+            if (is_wake_up(o, ev->type == SENSOR_TYPE_META_DATA ? ev->meta_data.sensor : ev->sensor))
+                wake_up++;
+            if (ev->type == SENSOR_TYPE_META_DATA) {
+                struct stream* s = find_stream(o, ev->meta_data.sensor);
+                if (s && ev->meta_data.what == META_DATA_FLUSH_COMPLETE) {
+                    s->flushes++;
+                    capture(o, SENSOR_CAPTURE_FLUSH_DONE, now, s->handle, 0, 0);
+                }
+                continue;
+            }
+            struct stream* s = find_stream(o, ev->sensor);
+            if (s) {
+                record(s, ev, now);
+                capture(o, SENSOR_CAPTURE_EVENT, now, s->handle, ev->timestamp, 0);
+            }
+        }
+        /* handled: the adapter may let go of its wake lock */
+        if (wake_up && o->hal2.client)
+            o->hal2.ack(o->hal2.client, wake_up);
+
+        if (end && now >= end)
+            break;
+        if (o->interval_s && now - last >= o->interval_s * NSEC_PER_SEC) {
+            int64_t cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+            report(o, now - last, cpu - cpu_start);
+            last = now;
+            cpu_start = cpu;
+        }
+    }
+
+    int64_t now = clock_ns(CLOCK_BOOTTIME);
+    if (now > last)
+        report(o, now - last, clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start);
+}
+
+/*****************************************************************************/
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -m PATH      HAL module (default " DEFAULT_MODULE_PATH ")\n"
+        "  -l           list the sensors and exit\n"
+        "  -s HANDLE[,PERIOD_US[,LATENCY_US]]\n"
+        "               stream a sensor (default period 200000, latency 0);\n"
+        "               may be repeated\n"
+        "  -f           flush every stream once it is active\n"
+        "  -i SEC       report every SEC seconds, not only at the end\n"
+        "  -t SEC       exit after SEC seconds\n"
+        "  -w FILE      capture the calls and events for sensor_conform\n"
+        "  -q EVENTS    read through the HAL 2.x event queue of EVENTS slots\n",
+        name);
+}
+
+int main(int argc, char** argv)
+{
+    struct options o;
+    memset(&o, 0, sizeof(o));
+    o.module_path = DEFAULT_MODULE_PATH;
+
+    int c;
+    const char* capture_path = NULL;
+    while ((c = getopt(argc, argv, "m:ls:fi:t:w:q:h")) != -1) {
+        switch (c) {
+            case 'm': o.module_path = optarg; break;
+            case 'l': o.list = 1; break;
+            case 's': {
+                if (o.num_streams == MAX_STREAMS) {
+                    fprintf(stderr, "at most %d streams\n", MAX_STREAMS);
+                    return 1;
+                }
+                struct stream* s = &o.streams[o.num_streams++];
+                long long period_us = 200000, latency_us = 0;
+                if (sscanf(optarg, "%d,%lld,%lld", &s->handle, &period_us, &latency_us) < 1) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                s->period_ns = period_us * NSEC_PER_USEC;
+                s->latency_ns = latency_us * NSEC_PER_USEC;
+                break;
+            }
+            case 'f': o.flush = 1; break;
+            case 'i': o.interval_s = atoi(optarg); break;
+            case 't': o.duration_s = atoi(optarg); break;
+            case 'w': capture_path = optarg; break;
+            case 'q': o.queue_size = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (!o.list && !o.num_streams) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct sensors_module_t* module = load_module(o.module_path);
+    if (!module)
+        return 1;
+
+    const struct sensor_t* list;
+    int count = module->get_sensors_list(module, &list);
+    o.sensors = list;
+    o.num_sensors = count;
+    if (o.list) {
+        list_sensors(list, count);
+        return 0;
+    }
+
+    if (capture_path) {
+        o.capture = fopen(capture_path, "we");
+        if (!o.capture) {
+            fprintf(stderr, "couldn't create %s (%s)\n", capture_path, strerror(errno));
+            return 1;
+        }
+        fwrite(SENSOR_CAPTURE_MAGIC, SENSOR_CAPTURE_MAGIC_LEN, 1, o.capture);
+    }
+
+    struct hw_device_t* device;
+    int err = module->common.methods->open(&module->common, SENSORS_HARDWARE_POLL, &device);
+    if (err) {
+        fprintf(stderr, "couldn't open %s (%s)\n", SENSORS_HARDWARE_POLL, strerror(-err));
+        return 1;
+    }
+    struct sensors_poll_device_1* dev = (struct sensors_poll_device_1*)device;
+    int has_batch = dev->common.version >= SENSORS_DEVICE_API_VERSION_1_0;
+    int has_flush = dev->common.version >= SENSORS_DEVICE_API_VERSION_1_1;
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    /* the adapter's thread calls poll() from here on */
+    if (o.queue_size && start_hal2(module, dev, &o) < 0) {
+        dev->common.close(&dev->common);
+        return 1;
+    }
+
+    for (int i = 0; i < o.num_streams; i++) {
+        struct stream* s = &o.streams[i];
+        capture(&o, SENSOR_CAPTURE_CONFIG, clock_ns(CLOCK_BOOTTIME), s->handle,
+                s->period_ns, has_batch ? s->latency_ns : 0);
+        if (has_batch)
+            err = dev->batch(dev, s->handle, 0, s->period_ns, s->latency_ns);
+        else
+            err = dev->setDelay(&dev->v0, s->handle, s->period_ns);
+        if (!err) {
+            capture(&o, SENSOR_CAPTURE_ACTIVATE, clock_ns(CLOCK_BOOTTIME), s->handle, 0, 0);
+            err = dev->activate(&dev->v0, s->handle, 1);
+        }
+        if (err) {
+            fprintf(stderr, "couldn't start handle %d (%s)\n", s->handle, strerror(-err));
+            running = 0;
+            break;
+        }
+    }
+
+    if (running && o.flush) {
+        for (int i = 0; i < o.num_streams; i++) {
+            /* only a flush() that succeeded owes a completion */
+            int64_t when = clock_ns(CLOCK_BOOTTIME);
+            err = has_flush ? dev->flush(dev, o.streams[i].handle) : -ENOSYS;
+            if (err)
+                fprintf(stderr, "flush of handle %d failed (%s)\n",
+                        o.streams[i].handle, strerror(-err));
+            else
+                capture(&o, SENSOR_CAPTURE_FLUSH, when, o.streams[i].handle, 0, 0);
+        }
+    }
+
+    if (running)
+        stream_events(dev, &o);
+
+    for (int i = 0; i < o.num_streams; i++) {
+        capture(&o, SENSOR_CAPTURE_DEACTIVATE, clock_ns(CLOCK_BOOTTIME), o.streams[i].handle, 0, 0);
+        dev->activate(&dev->v0, o.streams[i].handle, 0);
+        free(o.streams[i].delays);
+    }
+    stop_hal2(&o);
+    dev->common.close(&dev->common);
+    if (o.capture)
+        fclose(o.capture);
+    return 0;
+}